@@ -0,0 +1,351 @@
+#include "aggregate.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// A number as a GROUP BY key: 0 and -0 are one group, and so are all NaNs.
+static uint64_t numberKey(double v) {
+    if (v == 0) return 0;
+    if (v != v) return 0x7ff8000000000000ULL;
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof bits);
+    return bits;
+}
+
+// MIN/MAX of strings and bools keep the row holding the extreme.
+// Numeric MIN/MAX order: -0 sorts below 0 so that a tie does not depend on
+// which thread saw its row first.
+static bool numberLess(double a, double b) {
+    return a < b || (a == b && std::signbit(a) && !std::signbit(b));
+}
+
+static bool extremeByRow(const Column* col) {
+    return col && col->type != FT_NUMBER;
+}
+
+// COUNT(field) of a number column counts the rows that are not NaN, which
+// stands for a missing value as in MIN and MAX. Bool and string rows
+// always have a value, so COUNT of those is the group's row count.
+static bool countsNumbers(AggFunc func, const Column* col) {
+    return func == AGG_COUNT && col && col->type == FT_NUMBER;
+}
+
+static bool rowLess(const Column& col, uint32_t a, uint32_t b) {
+    if (col.type == FT_BOOL) return col.bools[a] < col.bools[b];
+    return col.stringAt(a) < col.stringAt(b);
+}
+
+// Distinct values a direct key can take.
+static uint64_t keySize(const Column* k) {
+    return k->type == FT_BOOL ? 2 : std::max<size_t>(k->dict.size(), 1);
+}
+
+HashAggregator::HashAggregator(const CompiledQuery& plan, const Table& input)
+    : input(input), slots(64, 0) {
+    for (int c : plan.groupBy) keys.push_back(&input.column(c));
+    for (const AggregateColumn& a : plan.aggregates) {
+        states.push_back(State{a.func, a.column >= 0 ? &input.column(a.column) : nullptr, {}, {}, {}});
+    }
+    if (keys.empty()) findOrAdd(0, 0);      // the only group
+    else reindex();
+}
+
+// Picks direct indexing when every key is a bool or an encoded string and
+// the keys have few combinations, then files the existing groups again.
+// Runs again when a key's dictionary has grown, as it may on a table that
+// is appended to between add() calls.
+void HashAggregator::reindex() {
+    direct.clear();
+    directSizes.clear();
+    uint64_t combinations = 1;
+    for (const Column* k : keys) {
+        if (k->type == FT_NUMBER || (k->type == FT_STRING && !k->encoded) ||
+            (combinations *= keySize(k)) > 65536) {
+            directSizes.clear();
+            break;
+        }
+        directSizes.push_back(keySize(k));
+    }
+    if (!directSizes.empty()) {
+        direct.assign(combinations, 0);
+        for (uint32_t g = 0; g < firstRows.size(); ++g) {
+            uint64_t combo = combination(firstRows[g]);
+            direct[combo] = g + 1;
+            hashes[g] = mix(combo);
+        }
+    } else {
+        hashRows(firstRows.data(), firstRows.size());
+        hashes.assign(batchHashes.begin(), batchHashes.end());
+    }
+    fileSlots(slots.size());
+}
+
+bool HashAggregator::keysGrew() const {
+    for (size_t i = 0; i < directSizes.size(); ++i) {
+        if (keySize(keys[i]) != directSizes[i]) return true;
+    }
+    return false;
+}
+
+void HashAggregator::hashRows(const uint32_t* rows, size_t n) {
+    batchHashes.assign(n, 0x9e3779b97f4a7c15ULL);
+    uint64_t* h = batchHashes.data();
+    for (const Column* k : keys) {
+        if (k->type == FT_NUMBER) {
+            const double* v = k->numbers.data();
+            for (size_t i = 0; i < n; ++i) h[i] = mix(h[i] ^ numberKey(v[rows[i]]));
+        } else if (k->type == FT_BOOL) {
+            const uint8_t* v = k->bools.data();
+            for (size_t i = 0; i < n; ++i) h[i] = mix(h[i] ^ v[rows[i]]);
+        } else if (k->encoded) {
+            const uint32_t* v = k->codes.data();
+            for (size_t i = 0; i < n; ++i) h[i] = mix(h[i] ^ v[rows[i]]);
+        } else {
+            std::hash<string_view> hs;
+            for (size_t i = 0; i < n; ++i) h[i] = mix(h[i] ^ hs(k->stringAt(rows[i])));
+        }
+    }
+}
+
+uint64_t HashAggregator::combination(uint32_t row) const {
+    uint64_t combo = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const Column* k = keys[i];
+        combo = combo * directSizes[i] + (k->type == FT_BOOL ? k->bools[row] : k->codes[row]);
+    }
+    return combo;
+}
+
+// The group of each row by its key combination, with the combination's
+// hash standing in for the key hash.
+void HashAggregator::directGroups(const uint32_t* rows, size_t n, uint32_t* groups) {
+    batchHashes.assign(n, 0);
+    uint64_t* combo = batchHashes.data();
+    for (size_t j = 0; j < keys.size(); ++j) {
+        const Column* k = keys[j];
+        uint64_t size = directSizes[j];
+        if (k->type == FT_BOOL) {
+            const uint8_t* v = k->bools.data();
+            for (size_t i = 0; i < n; ++i) combo[i] = combo[i] * size + v[rows[i]];
+        } else {
+            const uint32_t* v = k->codes.data();
+            for (size_t i = 0; i < n; ++i) combo[i] = combo[i] * size + v[rows[i]];
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t& g = direct[combo[i]];
+        if (!g) g = findOrAdd(mix(combo[i]), rows[i]) + 1;
+        groups[i] = g - 1;
+        counts[g - 1]++;
+    }
+}
+
+bool HashAggregator::sameKey(uint32_t a, uint32_t b) const {
+    for (const Column* k : keys) {
+        switch (k->type) {
+            case FT_NUMBER:
+                if (numberKey(k->numbers[a]) != numberKey(k->numbers[b])) return false;
+                break;
+            case FT_BOOL:
+                if (k->bools[a] != k->bools[b]) return false;
+                break;
+            case FT_STRING:
+                if (k->encoded ? k->codes[a] != k->codes[b] : k->stringAt(a) != k->stringAt(b)) {
+                    return false;
+                }
+                break;
+        }
+    }
+    return true;
+}
+
+uint32_t HashAggregator::findOrAdd(uint64_t hash, uint32_t row) {
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    for (; slots[i]; i = (i + 1) & mask) {
+        uint32_t g = slots[i] - 1;
+        if (hashes[g] == hash && sameKey(firstRows[g], row)) return g;
+    }
+
+    uint32_t g = (uint32_t)firstRows.size();
+    slots[i] = g + 1;
+    hashes.push_back(hash);
+    firstRows.push_back(row);
+    counts.push_back(0);
+    for (State& s : states) {
+        if (s.func == AGG_SUM || s.func == AGG_AVG || countsNumbers(s.func, s.col)) s.value.push_back(0);
+        if (s.func == AGG_SUM || s.func == AGG_AVG) s.present.push_back(0);
+        if (s.func != AGG_MIN && s.func != AGG_MAX) continue;
+        if (extremeByRow(s.col)) s.row.push_back(NO_ROW);
+        else s.value.push_back(NAN);
+    }
+    if (2 * firstRows.size() > slots.size()) fileSlots(slots.size() * 2);
+    return g;
+}
+
+// Refills the slots from the group hashes, with room for at least `n`
+// slots and a load of at most one half.
+void HashAggregator::fileSlots(size_t n) {
+    while (n < 2 * firstRows.size()) n *= 2;
+    slots.assign(n, 0);
+    size_t mask = n - 1;
+    for (uint32_t g = 0; g < hashes.size(); ++g) {
+        size_t i = hashes[g] & mask;
+        while (slots[i]) i = (i + 1) & mask;
+        slots[i] = g + 1;
+    }
+}
+
+void HashAggregator::add(const uint32_t* rows, size_t n) {
+    if (n == 0) return;
+    batchGroups.resize(n);
+    uint32_t* groups = batchGroups.data();
+    if (!direct.empty() && keysGrew()) reindex();
+    if (keys.empty()) {
+        std::fill(groups, groups + n, 0);
+        counts[0] += n;
+    } else if (!direct.empty()) {
+        directGroups(rows, n, groups);
+    } else {
+        hashRows(rows, n);
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t g = findOrAdd(batchHashes[i], rows[i]);
+            groups[i] = g;
+            counts[g]++;
+        }
+    }
+
+    // NaN is a missing value: SUM and AVG skip it, and so do MIN and MAX
+    // unless nothing else has been seen
+    for (State& s : states) {
+        if (s.func == AGG_SUM || s.func == AGG_AVG) {
+            const double* v = s.col->numbers.data();
+            if (keys.empty()) {
+                double sum = 0;
+                uint64_t present = 0;
+                for (size_t i = 0; i < n; ++i) {
+                    double x = v[rows[i]];
+                    if (x != x) continue;
+                    sum += x;
+                    present++;
+                }
+                s.value[0] += sum;
+                s.present[0] += present;
+            } else {
+                for (size_t i = 0; i < n; ++i) {
+                    double x = v[rows[i]];
+                    if (x != x) continue;
+                    s.value[groups[i]] += x;
+                    s.present[groups[i]]++;
+                }
+            }
+        } else if (countsNumbers(s.func, s.col)) {
+            const double* v = s.col->numbers.data();
+            for (size_t i = 0; i < n; ++i) s.value[groups[i]] += v[rows[i]] == v[rows[i]];
+        } else if ((s.func == AGG_MIN || s.func == AGG_MAX) && extremeByRow(s.col)) {
+            bool isMin = s.func == AGG_MIN;
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t& best = s.row[groups[i]];
+                if (best == NO_ROW || (isMin ? rowLess(*s.col, rows[i], best)
+                                             : rowLess(*s.col, best, rows[i]))) {
+                    best = rows[i];
+                }
+            }
+        } else if (s.func == AGG_MIN) {
+            const double* v = s.col->numbers.data();
+            for (size_t i = 0; i < n; ++i) {
+                double x = v[rows[i]];
+                double& best = s.value[groups[i]];
+                if (numberLess(x, best) || best != best) best = x;
+            }
+        } else if (s.func == AGG_MAX) {
+            const double* v = s.col->numbers.data();
+            for (size_t i = 0; i < n; ++i) {
+                double x = v[rows[i]];
+                double& best = s.value[groups[i]];
+                if (numberLess(best, x) || best != best) best = x;
+            }
+        }
+    }
+}
+
+void HashAggregator::fold(State& s, uint32_t g, const State& from, uint32_t og) {
+    switch (s.func) {
+        case AGG_NONE:
+            return;
+        case AGG_COUNT:
+            if (countsNumbers(s.func, s.col)) s.value[g] += from.value[og];
+            return;
+        case AGG_SUM:
+        case AGG_AVG:
+            s.value[g] += from.value[og];
+            s.present[g] += from.present[og];
+            return;
+        case AGG_MIN:
+        case AGG_MAX: {
+            bool isMin = s.func == AGG_MIN;
+            if (extremeByRow(s.col)) {
+                uint32_t r = from.row[og], best = s.row[g];
+                if (r == NO_ROW) return;
+                if (best == NO_ROW || (isMin ? rowLess(*s.col, r, best) : rowLess(*s.col, best, r))) {
+                    s.row[g] = r;
+                }
+                return;
+            }
+            double x = from.value[og], best = s.value[g];
+            if ((isMin ? numberLess(x, best) : numberLess(best, x)) || best != best) s.value[g] = x;
+            return;
+        }
+    }
+}
+
+void HashAggregator::merge(const HashAggregator& other) {
+    for (uint32_t og = 0; og < other.firstRows.size(); ++og) {
+        uint32_t g = findOrAdd(other.hashes[og], other.firstRows[og]);
+        if (!direct.empty()) direct[combination(other.firstRows[og])] = g + 1;
+        firstRows[g] = std::min(firstRows[g], other.firstRows[og]);
+        counts[g] += other.counts[og];
+        for (size_t s = 0; s < states.size(); ++s) fold(states[s], g, other.states[s], og);
+    }
+}
+
+void HashAggregator::emit(const vector<uint32_t>& groups, Table& out) const {
+    for (uint32_t g : groups) {
+        for (size_t c = 0; c < states.size(); ++c) {
+            const State& s = states[c];
+            Column& dst = out.column(c);
+            switch (s.func) {
+                case AGG_NONE:
+                    dst.appendFrom(*s.col, firstRows[g]);
+                    break;
+                case AGG_COUNT:
+                    dst.appendNumber(countsNumbers(s.func, s.col) ? s.value[g] : (double)counts[g]);
+                    break;
+                case AGG_SUM:
+                    dst.appendNumber(s.value[g]);
+                    break;
+                case AGG_AVG:
+                    dst.appendNumber(s.present[g] ? s.value[g] / s.present[g] : NAN);
+                    break;
+                case AGG_MIN:
+                case AGG_MAX:
+                    if (!extremeByRow(s.col)) dst.appendNumber(s.value[g]);
+                    else if (s.row[g] != NO_ROW) dst.appendFrom(*s.col, s.row[g]);
+                    else if (s.col->type == FT_BOOL) dst.appendBool(false);
+                    else dst.appendString("");
+                    break;
+            }
+        }
+        out.finishRow();
+    }
+}
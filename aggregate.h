@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "compiler.h"
+#include "table.h"
+
+using std::vector;
+
+// Groups rows of one table by the GROUP BY columns of an aggregating plan
+// and keeps the plan's aggregates for each group. Groups live in an
+// open-addressing hash table keyed by the hash of their GROUP BY values;
+// a group stores its first row rather than a copy of the values, and keys
+// are compared through that row. Without GROUP BY there is one group.
+// When every key is a bool or a dictionary-encoded string and the keys
+// have few combinations, the combination indexes the groups directly.
+//
+// Rows are added in batches of row ids, in increasing row order. Scan
+// threads each fill their own aggregator and merge them at the end. The
+// table may have rows appended between add() calls, which is how
+// continuous queries keep their aggregates up to date.
+class HashAggregator {
+public:
+    HashAggregator(const CompiledQuery& plan, const Table& input);
+
+    // Adds rows[0, n) to their groups.
+    void add(const uint32_t* rows, size_t n);
+    // Folds in the groups of `other`, built from the same plan and table.
+    void merge(const HashAggregator& other);
+
+    // Groups are numbered in order of creation.
+    size_t groupCount() const { return firstRows.size(); }
+    // Lowest row id added to group g.
+    uint32_t firstRow(size_t g) const { return firstRows[g]; }
+    // Appends one output row for each group in `groups`, in that order.
+    void emit(const vector<uint32_t>& groups, Table& out) const;
+
+private:
+    static constexpr uint32_t NO_ROW = UINT32_MAX;
+
+    // The running value of one output column, indexed by group: sums of
+    // the non-NaN values for SUM and AVG, non-NaN rows for COUNT of a
+    // number column, the extreme for MIN/MAX of numbers, and the row
+    // holding the extreme for MIN/MAX of strings and bools.
+    struct State {
+        AggFunc func;
+        const Column* col;      // the column it reads; null for COUNT(*)
+        vector<double> value;
+        vector<uint64_t> present;   // non-NaN values summed, for SUM and AVG
+        vector<uint32_t> row;
+    };
+
+    void hashRows(const uint32_t* rows, size_t n);
+    uint64_t combination(uint32_t row) const;
+    void directGroups(const uint32_t* rows, size_t n, uint32_t* groups);
+    bool sameKey(uint32_t a, uint32_t b) const;
+    uint32_t findOrAdd(uint64_t hash, uint32_t row);
+    void reindex();
+    bool keysGrew() const;
+    void fileSlots(size_t n);
+    void fold(State& s, uint32_t g, const State& from, uint32_t og);
+
+    const Table& input;
+    vector<const Column*> keys;     // GROUP BY columns
+    vector<State> states;           // one per output column
+    vector<uint32_t> slots;         // group + 1, or 0 when free; a power of two long
+    vector<uint64_t> hashes;        // per group
+    vector<uint32_t> firstRows;     // per group
+    vector<uint64_t> counts;        // rows per group
+    vector<uint32_t> direct;        // key combination -> group + 1, when small
+    vector<uint64_t> directSizes;   // per key, the values it had when `direct` was built
+    vector<uint64_t> batchHashes;   // scratch for add()
+    vector<uint32_t> batchGroups;
+};
@@ -0,0 +1,41 @@
+#include "arena.h"
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+
+void* Arena::allocate(size_t bytes, size_t align) {
+    uintptr_t p = ((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1);
+    if (!cur || p + bytes > (uintptr_t)end) {
+        // oversized requests get a block of their own
+        size_t size = std::max(blockBytes, bytes + align);
+        blocks.emplace_back(new char[size]);
+        if (blocks.size() == 1) firstBytes = size;
+        capacity += size;
+        cur = blocks.back().get();
+        end = cur + size;
+        p = ((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1);
+    }
+    cur = (char*)(p + bytes);
+    used += bytes;
+    return (void*)p;
+}
+
+std::string_view Arena::copy(std::string_view s) {
+    if (s.empty()) return std::string_view();
+    char* p = makeArray<char>(s.size());
+    memcpy(p, s.data(), s.size());
+    return std::string_view(p, s.size());
+}
+
+void Arena::reset() {
+    if (blocks.size() > 1) {
+        // replace the chain with one block that fits it, so a caller that
+        // reuses the arena for similar work stops allocating
+        blocks.clear();
+        blocks.emplace_back(new char[capacity]);
+        firstBytes = capacity;
+    }
+    cur = blocks.empty() ? nullptr : blocks[0].get();
+    end = blocks.empty() ? nullptr : cur + firstBytes;
+    used = 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator. Objects are carved out of large blocks and are all
+// freed together when the arena is reset or destroyed; nothing is freed
+// one at a time and no destructors run, so only trivially destructible
+// types may be allocated.
+class Arena {
+public:
+    explicit Arena(size_t blockBytes = 4096) : blockBytes(blockBytes) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t bytes, size_t align);
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Uninitialised storage for n objects of T.
+    template <typename T>
+    T* makeArray(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    // Copies `s` into the arena.
+    std::string_view copy(std::string_view s);
+
+    // Frees everything. The memory is kept for reuse, merged into a
+    // single block if more than one was needed.
+    void reset();
+
+    size_t bytesUsed() const { return used; }
+    size_t blockCount() const { return blocks.size(); }
+
+private:
+    size_t blockBytes;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t firstBytes = 0;      // size of blocks[0]
+    size_t capacity = 0;        // total size of all blocks
+    char* cur = nullptr;
+    char* end = nullptr;
+    size_t used = 0;
+};
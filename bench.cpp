@@ -0,0 +1,1243 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "tokenizer.h"
+#include "parser.h"
+#include "symbol_table.h"
+#include "evaluator.h"
+#include "kernels.h"
+#include "csv_reader.h"
+#include "column_file.h"
+#include "query_cache.h"
+#include "optimizer.h"
+#include "continuous.h"
+#include "server.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// Heap allocations made by this thread, for the ast and suite benchmarks.
+static thread_local size_t allocations = 0;
+
+void* operator new(size_t n) {
+    ++allocations;
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// SELECT name FROM Customers WHERE age = 0 OR age = 1 OR ... (n predicates)
+static string makeOrChain(size_t n) {
+    string q = "SELECT name, age\nFROM Customers\nWHERE ";
+    for (size_t i = 0; i < n; ++i) {
+        if (i) q += (i % 8 == 0) ? "\n  OR " : " OR ";
+        q += "age = " + to_string(i);
+    }
+    q += "\n";
+    return q;
+}
+
+static double secondsSince(Clock::time_point start) {
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Parse time per predicate should stay flat as the chain grows.
+static void benchParse() {
+    cout << "predicates\tbytes\tparse_ms\tns_per_predicate\n";
+    for (size_t n : {100, 1000, 10000, 100000}) {
+        string text = makeOrChain(n);
+        int reps = n >= 100000 ? 3 : n >= 10000 ? 10 : 100;
+        double best = 1e30;
+        for (int r = 0; r < reps; ++r) {
+            string s = text;
+            Query q;
+            auto start = Clock::now();
+            if (!parseQuery(s, q)) {
+                cerr << "parse failed at n=" << n << "\n";
+                return;
+            }
+            double t = secondsSince(start);
+            if (t < best) best = t;
+        }
+        cout << n << "\t" << text.size() << "\t" << best * 1e3
+             << "\t" << best * 1e9 / n << "\n";
+    }
+}
+
+static SymbolTable customerSchema() {
+    SymbolTable schema;
+    schema.addField("name",   FT_STRING);
+    schema.addField("age",    FT_NUMBER);
+    schema.addField("status", FT_STRING);
+    schema.addField("active", FT_BOOL);
+    return schema;
+}
+
+// A small mix of dashboard-sized queries.
+static vector<string> makeQueryMix() {
+    vector<string> qs;
+    for (int i = 0; i < 64; ++i) {
+        string q = "SELECT name, status FROM Customers WHERE ";
+        q += "(age >= " + to_string(18 + i % 40) + " AND active = true)";
+        for (int j = 0; j < i % 16; ++j) {
+            q += " OR status = \"s" + to_string(j) + "\"";
+        }
+        qs.push_back(q);
+    }
+    return qs;
+}
+
+// Parse + semantic check throughput with one ParseContext per thread.
+static void benchCompileThreads() {
+    const SymbolTable schema = customerSchema();
+    const vector<string> mix = makeQueryMix();
+    const size_t perThread = 20000;
+
+    unsigned hw = thread::hardware_concurrency();
+    if (hw == 0) hw = 1;
+    vector<unsigned> counts = {1};
+    for (unsigned t = 2; t <= hw; t *= 2) counts.push_back(t);
+    if (counts.back() != hw) counts.push_back(hw);
+
+    cout << "threads\tqueries\tseconds\tqueries_per_sec\tspeedup\n";
+    double base = 0;
+    for (unsigned n : counts) {
+        vector<thread> workers;
+        auto start = Clock::now();
+        for (unsigned t = 0; t < n; ++t) {
+            workers.emplace_back([&, t] {
+                ParseContext ctx;
+                ctx.filename = "bench";
+                for (size_t i = 0; i < perThread; ++i) {
+                    Query q;
+                    const string& text = mix[(i + t) % mix.size()];
+                    if (!parseQuery(ctx, text, q) || !checkQuerySemantics(q, schema)) {
+                        cerr << "compile failed: " << text << "\n";
+                        return;
+                    }
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        double secs = secondsSince(start);
+        double qps = n * perThread / secs;
+        if (n == 1) base = qps;
+        cout << n << "\t" << n * perThread << "\t" << secs << "\t" << qps
+             << "\t" << qps / base << "\n";
+    }
+}
+
+// Deterministic customers-shaped table with `n` rows.
+static Table makeCustomers(size_t n) {
+    static const char* names[] = {"Alice", "Ben", "Bob", "Carol", "Ava", "Dan", "Eve", "Finn"};
+    Table t(customerSchema());
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < n; ++i) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        t.column(t.findColumn("name")).appendString(names[x % 8]);
+        t.column(t.findColumn("age")).appendNumber((double)(x >> 8 & 127) * 0.75);
+        t.column(t.findColumn("status")).appendString((x >> 20) % 5 == 0 ? "vip" : "regular");
+        t.column(t.findColumn("active")).appendBool((x >> 24) & 1);
+        t.finishRow();
+    }
+    return t;
+}
+
+static bool compileText(const string& text, const SymbolTable& schema, CompiledQuery& plan) {
+    ParseContext ctx;
+    Query q;
+    return parseQuery(ctx, text, q) && checkQuerySemantics(q, schema) &&
+           compileQuery(q, schema, plan);
+}
+
+// Filter throughput: row-at-a-time versus block bitmaps on each kernel set.
+static void benchKernels() {
+    const size_t n = 4000000;
+    Table t = makeCustomers(n);
+    const char* filters[] = {
+        "SELECT name FROM Customers WHERE age >= 21 AND active = true",
+        "SELECT name FROM Customers WHERE age < 30 OR age > 90",
+        "SELECT name FROM Customers WHERE age >= 10 AND age < 80 AND active = false",
+    };
+
+    cout << "filter\tmode\tmatches\tms\tmrows_per_sec\n";
+    for (int f = 0; f < 3; ++f) {
+        CompiledQuery plan;
+        if (!compileText(filters[f], t.schema(), plan)) return;
+
+        auto report = [&](const string& mode, size_t matches, double secs) {
+            cout << f << "\t" << mode << "\t" << matches << "\t" << secs * 1e3
+                 << "\t" << n / secs / 1e6 << "\n";
+        };
+
+        auto start = Clock::now();
+        size_t matches = 0;
+        for (size_t r = 0; r < n; ++r) matches += matchesRow(plan, t, r);
+        report("row", matches, secondsSince(start));
+
+        for (int isa = ISA_SCALAR; isa <= bestKernelIsa(); ++isa) {
+            setKernelIsa((KernelIsa)isa);
+            start = Clock::now();
+            matches = selectRows(plan, t).size();
+            report(string("block-") + kernelIsaName((KernelIsa)isa), matches, secondsSince(start));
+        }
+        setKernelIsa(bestKernelIsa());
+    }
+}
+
+// evaluateQuery wall time by scan thread count.
+static void benchScanThreads() {
+    const size_t n = 4000000;
+    Table t = makeCustomers(n);
+    CompiledQuery plan;
+    if (!compileText("SELECT name, age FROM Customers WHERE age >= 21 AND active = true",
+                     t.schema(), plan)) return;
+
+    unsigned hw = thread::hardware_concurrency();
+    if (hw == 0) hw = 1;
+    cout << "threads\trows_out\tms\tmrows_per_sec\n";
+    size_t expected = 0;
+    for (unsigned n_threads = 1; n_threads <= hw; n_threads *= 2) {
+        EvalOptions opts;
+        opts.threads = n_threads;
+        auto start = Clock::now();
+        Table out = evaluateQuery(plan, t, opts);
+        double secs = secondsSince(start);
+        if (n_threads == 1) expected = out.rowCount();
+        if (out.rowCount() != expected) cerr << "row count mismatch at " << n_threads << " threads\n";
+        cout << n_threads << "\t" << out.rowCount() << "\t" << secs * 1e3
+             << "\t" << n / secs / 1e6 << "\n";
+    }
+}
+
+// CSV load throughput for a generated customers file.
+static void benchIngest() {
+    const size_t n = 2000000;
+    const string path = "/tmp/querybench_ingest.csv";
+    {
+        Table t = makeCustomers(n);
+        ofstream out(path);
+        out << "name,age,status,active\n";
+        for (size_t r = 0; r < n; ++r) {
+            out << t.column(0).stringAt(r) << ',' << t.column(1).numbers[r] << ','
+                << t.column(2).stringAt(r) << ',' << (t.column(3).bools[r] ? "true" : "false") << '\n';
+        }
+    }
+    ifstream sizer(path, ios::binary | ios::ate);
+    double mb = sizer.tellg() / 1e6;
+
+    cout << "mode\trows\tmb\tms\tmb_per_sec\n";
+    for (bool infer : {false, true}) {
+        SymbolTable schema = customerSchema();
+        CsvOptions opts;
+        opts.inferSchema = infer;
+        Table t;
+        auto start = Clock::now();
+        if (!loadDelimitedFile(path, opts, schema, t)) return;
+        double secs = secondsSince(start);
+        cout << (infer ? "infer" : "schema") << "\t" << t.rowCount() << "\t" << mb
+             << "\t" << secs * 1e3 << "\t" << mb / secs << "\n";
+    }
+    remove(path.c_str());
+}
+
+// Selective scans over a column file whose ages are clustered, with and
+// without the zone maps.
+static void benchZoneMaps() {
+    const size_t n = 8000000;
+    const string path = "/tmp/querybench_zones.qcol";
+    {
+        Table t = makeCustomers(n);
+        Table sorted(t.schema());
+        // ages rise with row number, like an export ordered by signup date
+        for (size_t r = 0; r < n; ++r) {
+            sorted.column(0).appendFrom(t.column(0), r);
+            sorted.column(1).appendNumber((double)(r * 96 / n));
+            sorted.column(2).appendFrom(t.column(2), r);
+            sorted.column(3).appendFrom(t.column(3), r);
+            sorted.finishRow();
+        }
+        if (!writeColumnFile(sorted, path)) return;
+    }
+
+    const char* filters[] = {
+        "SELECT name FROM Customers WHERE age >= 65",
+        "SELECT name FROM Customers WHERE age = 40 AND active = true",
+        "SELECT name FROM Customers WHERE age < 5 OR age > 90",
+    };
+    cout << "filter\tzonemaps\trows_out\tms\n";
+    for (int f = 0; f < 3; ++f) {
+        for (bool zones : {false, true}) {
+            Table t;
+            if (!openColumnFile(path, t)) return;
+            if (!zones) t.clearZoneMaps();
+            CompiledQuery plan;
+            if (!compileText(filters[f], t.schema(), plan)) return;
+            auto start = Clock::now();
+            Table out = evaluateQuery(plan, t);
+            double secs = secondsSince(start);
+            cout << f << "\t" << (zones ? "on" : "off") << "\t" << out.rowCount()
+                 << "\t" << secs * 1e3 << "\n";
+        }
+    }
+    remove(path.c_str());
+}
+
+// Point and range lookups on a 4M-row table with and without indexes.
+static void benchIndex() {
+    const size_t n = 4000000;
+    Table t = makeCustomers(n);
+    SymbolTable schema = t.schema();
+    schema.addField("id", FT_NUMBER);
+    Table keyed(schema);
+    for (size_t c = 0; c < t.columnCount(); ++c) keyed.column(c).appendColumn(t.column(c), n);
+    // ids are a permutation of 0..n-1
+    for (size_t r = 0; r < n; ++r) keyed.column(4).appendNumber((double)((r * 2654435761ULL) % n));
+    keyed.setRowCount(n);
+
+    Table indexed = keyed;
+    createIndex(indexed, "id", INDEX_SORTED);
+    createIndex(indexed, "name", INDEX_HASH);
+
+    const char* queries[] = {
+        "SELECT name FROM Customers WHERE id = 123457",
+        "SELECT name FROM Customers WHERE id >= 1000 AND id < 1100 AND active = true",
+        "SELECT age FROM Customers WHERE name = \"Nobody\"",
+    };
+    cout << "query\tindexes\trows_out\tus\n";
+    for (int q = 0; q < 3; ++q) {
+        for (const Table* tab : {&keyed, &indexed}) {
+            CompiledQuery plan;
+            if (!compileText(queries[q], schema, plan)) return;
+            const int reps = 20;
+            size_t rows = 0;
+            auto start = Clock::now();
+            for (int r = 0; r < reps; ++r) rows = evaluateQuery(plan, *tab).rowCount();
+            cout << q << "\t" << (tab == &indexed ? "on" : "off") << "\t" << rows
+                 << "\t" << secondsSince(start) / reps * 1e6 << "\n";
+        }
+    }
+}
+
+// String equality filters on plain versus dictionary-encoded columns.
+static void benchDictionary() {
+    const size_t n = 4000000;
+    Table plain = makeCustomers(n);
+    Table encoded = plain;
+    encoded.dictionaryEncode();
+    const char* filters[] = {
+        "SELECT age FROM Customers WHERE status = \"vip\"",
+        "SELECT age FROM Customers WHERE name != \"Carol\" AND status = \"regular\"",
+        "SELECT age FROM Customers WHERE name = \"Zed\"",
+    };
+    cout << "filter\tencoding\tmatches\tms\n";
+    for (int f = 0; f < 3; ++f) {
+        for (const Table* tab : {&plain, &encoded}) {
+            CompiledQuery plan;
+            if (!compileText(filters[f], tab->schema(), plan)) return;
+            const int reps = 5;
+            size_t rows = 0;
+            auto start = Clock::now();
+            for (int r = 0; r < reps; ++r) rows = evaluateQuery(plan, *tab).rowCount();
+            cout << f << "\t" << (tab == &encoded ? "dict" : "plain") << "\t" << rows
+                 << "\t" << secondsSince(start) / reps * 1e3 << "\n";
+        }
+    }
+}
+
+// Dashboard-style traffic: a few query shapes with changing literals,
+// compiled from scratch each time versus prepared once and bound.
+static void benchPrepared() {
+    Catalog catalog;
+    catalog.addTable("Customers", makeCustomers(1000));
+    const char* shapes[] = {
+        "SELECT name, age FROM Customers WHERE age >= ? AND active = ?",
+        "SELECT name FROM Customers WHERE status = ? OR (age < ? AND name != ?)",
+        "SELECT * FROM Customers WHERE age > ? AND age < ? AND status != ?",
+    };
+    const int reps = 100000;
+    // literal tokens for query i of a shape; strings keep their quotes
+    auto literals = [](int i, int shape) -> vector<string> {
+        string n = to_string(i % 97);
+        if (shape == 0) return {n, i & 1 ? "true" : "false"};
+        if (shape == 1) return {i & 1 ? "\"vip\"" : "\"regular\"", n, "\"Bob\""};
+        return {n, to_string(i % 97 + 10), "\"vip\""};
+    };
+    auto inlined = [](const string& shape, const vector<string>& lits) {
+        string out;
+        size_t k = 0;
+        for (char c : shape) {
+            if (c == '?') out += lits[k++];
+            else out += c;
+        }
+        return out;
+    };
+    auto params = [](vector<string> lits) {
+        for (auto& v : lits) {
+            if (v.front() == '"') v = v.substr(1, v.size() - 2);
+        }
+        return lits;
+    };
+
+    shared_ptr<const Table> table = catalog.lookup("Customers");
+    cout << "mode\tqueries\tus_per_query\n";
+    {
+        size_t rows = 0;
+        auto start = Clock::now();
+        for (int i = 0; i < reps; ++i) {
+            string text = inlined(shapes[i % 3], literals(i, i % 3));
+            CompiledQuery plan;
+            if (!compileText(text, table->schema(), plan)) return;
+            rows += evaluateQuery(plan, *table).rowCount();
+        }
+        cout << "compile\t" << reps << "\t" << secondsSince(start) / reps * 1e6 << "\n";
+    }
+    {
+        QueryCache cache(catalog);
+        size_t rows = 0;
+        auto start = Clock::now();
+        for (int i = 0; i < reps; ++i) {
+            shared_ptr<const PreparedQuery> q = cache.prepare(shapes[i % 3]);
+            Table out;
+            if (!q || !executePrepared(*q, params(literals(i, i % 3)), out)) return;
+            rows += out.rowCount();
+        }
+        cout << "cached\t" << reps << "\t" << secondsSince(start) / reps * 1e6
+             << "\t(hits " << cache.hits() << ", misses " << cache.misses() << ")\n";
+    }
+}
+
+// A reporting job's worth of filters over one table: one scan per query
+// versus a single shared scan for the whole batch.
+static void benchBatch() {
+    const size_t n = 4000000;
+    Table t = makeCustomers(n);
+    t.dictionaryEncode();
+    vector<CompiledQuery> plans;
+    static const char* names[] = {"Alice", "Ben", "Bob", "Carol"};
+    for (int i = 0; i < 32; ++i) {
+        // selective filters, so the scan rather than the output dominates
+        string q = "SELECT name, age FROM Customers WHERE age >= " + to_string(i * 3) +
+                   " AND age < " + to_string(i * 3 + 1) +
+                   (i % 2 ? " AND status = \"vip\"" : " AND name != \"" + string(names[i % 4]) + "\"");
+        plans.emplace_back();
+        if (!compileText(q, t.schema(), plans.back())) return;
+    }
+    EvalOptions opts;
+    opts.threads = max(1u, thread::hardware_concurrency());
+
+    cout << "queries\tmode\trows_out\tms\n";
+    for (size_t count : {1, 8, 32}) {
+        size_t rows = 0;
+        auto start = Clock::now();
+        for (size_t q = 0; q < count; ++q) rows += evaluateQuery(plans[q], t, opts).rowCount();
+        cout << count << "\tseparate\t" << rows << "\t" << secondsSince(start) * 1e3 << "\n";
+
+        vector<const CompiledQuery*> batch;
+        for (size_t q = 0; q < count; ++q) batch.push_back(&plans[q]);
+        rows = 0;
+        start = Clock::now();
+        for (const Table& out : evaluateBatch(batch, t, opts)) rows += out.rowCount();
+        cout << count << "\tshared\t" << rows << "\t" << secondsSince(start) * 1e3 << "\n";
+    }
+}
+
+// Filters whose written order puts the unselective factor first, with
+// and without adaptive reordering.
+static void benchAdaptive() {
+    const size_t n = 4000000;
+    Table t = makeCustomers(n);
+    const char* filters[] = {
+        "SELECT name FROM Customers WHERE age >= 0 AND status = \"vip\" AND age < 3",
+        "SELECT name FROM Customers WHERE name != \"Zed\" AND active = true AND age = 12",
+        "SELECT name FROM Customers WHERE age < 90 OR status = \"regular\" OR active = true",
+    };
+    cout << "filter\tadaptive\tmatches\tms\n";
+    for (int f = 0; f < 3; ++f) {
+        CompiledQuery plan;
+        if (!compileText(filters[f], t.schema(), plan)) return;
+        for (bool adaptive : {false, true}) {
+            EvalOptions opts;
+            opts.adaptive = adaptive;
+            const int reps = 5;
+            size_t rows = 0;
+            auto start = Clock::now();
+            for (int r = 0; r < reps; ++r) rows = evaluateQuery(plan, t, opts).rowCount();
+            cout << f << "\t" << (adaptive ? "on" : "off") << "\t" << rows << "\t"
+                 << secondsSince(start) / reps * 1e3 << "\n";
+        }
+    }
+}
+
+// Comparisons tested on a few rows at a time: the later factors of a
+// selective AND, the later terms of an OR that accepts most rows, and the
+// factors left over after an index lookup.
+static void benchRefine() {
+    const size_t n = 4000000;
+    Table t = makeCustomers(n);
+    Table indexed = t;
+    createIndex(indexed, "age", INDEX_SORTED);
+    const char* filters[] = {
+        "SELECT name FROM Customers WHERE age = 12 AND active = true AND status != \"vip\" AND name != \"Zed\"",
+        "SELECT name FROM Customers WHERE age < 95 OR status = \"vip\" OR name = \"Ann\" OR active = true",
+        "SELECT name FROM Customers WHERE age = 12 AND active = true AND status != \"vip\" AND name != \"Zed\"",
+    };
+    cout << "filter\ttable\tmatches\tms\n";
+    for (int f = 0; f < 3; ++f) {
+        const Table& tab = f == 2 ? indexed : t;
+        CompiledQuery plan;
+        if (!compileText(filters[f], tab.schema(), plan)) return;
+        const int reps = 10;
+        size_t rows = 0;
+        auto start = Clock::now();
+        for (int r = 0; r < reps; ++r) rows = selectRows(plan, tab).size();
+        cout << f << "\t" << (f == 2 ? "indexed" : "plain") << "\t" << rows << "\t"
+             << secondsSince(start) / reps * 1e3 << "\n";
+    }
+}
+
+// LIMIT without ORDER BY stops the scan; ORDER BY ... LIMIT keeps a
+// bounded heap instead of sorting every match.
+static void benchTopN() {
+    const size_t n = 4000000;
+    Table t = makeCustomers(n);
+    const char* queries[] = {
+        "SELECT name, age FROM Customers WHERE age > 10",
+        "SELECT name, age FROM Customers WHERE age > 10 LIMIT 100",
+        "SELECT name, age FROM Customers WHERE age > 10 ORDER BY age DESC",
+        "SELECT name, age FROM Customers WHERE age > 10 ORDER BY age DESC LIMIT 10",
+        "SELECT name, age FROM Customers WHERE active = true ORDER BY name LIMIT 10",
+    };
+    cout << "query\tthreads\trows_out\tms\n";
+    for (int q = 0; q < 5; ++q) {
+        CompiledQuery plan;
+        if (!compileText(queries[q], t.schema(), plan)) return;
+        for (unsigned threads : {1u, 4u}) {
+            EvalOptions opts;
+            opts.threads = threads;
+            const int reps = 3;
+            size_t rows = 0;
+            auto start = Clock::now();
+            for (int r = 0; r < reps; ++r) rows = evaluateQuery(plan, t, opts).rowCount();
+            cout << q << "\t" << threads << "\t" << rows << "\t"
+                 << secondsSince(start) / reps * 1e3 << "\n";
+        }
+    }
+}
+
+// Aggregates computed by the engine next to materializing the matching
+// rows and folding them afterwards.
+static void benchAggregate() {
+    const size_t n = 4000000;
+    Table t = makeCustomers(n);
+    t.dictionaryEncode();
+    const pair<const char*, const char*> queries[] = {
+        {"SELECT COUNT(*) FROM Customers WHERE age > 10",
+         "SELECT age FROM Customers WHERE age > 10"},
+        {"SELECT status, COUNT(*), SUM(age), AVG(age) FROM Customers GROUP BY status",
+         "SELECT status, age FROM Customers"},
+        {"SELECT name, active, MAX(age) FROM Customers WHERE age < 50 GROUP BY name, active",
+         "SELECT name, active, age FROM Customers WHERE age < 50"},
+    };
+    cout << "query\tthreads\taggregate_ms\tmaterialize_ms\n";
+    for (int q = 0; q < 3; ++q) {
+        CompiledQuery agg, rows;
+        if (!compileText(queries[q].first, t.schema(), agg)) return;
+        if (!compileText(queries[q].second, t.schema(), rows)) return;
+        for (unsigned threads : {1u, 4u}) {
+            EvalOptions opts;
+            opts.threads = threads;
+            const int reps = 3;
+            auto start = Clock::now();
+            for (int r = 0; r < reps; ++r) evaluateQuery(agg, t, opts);
+            double aggMs = secondsSince(start) / reps * 1e3;
+            start = Clock::now();
+            for (int r = 0; r < reps; ++r) {
+                Table out = evaluateQuery(rows, t, opts);
+                map<string, double> sums;
+                const Column& age = out.column(out.columnCount() - 1);
+                for (size_t i = 0; i < out.rowCount(); ++i) {
+                    string key;
+                    for (size_t c = 0; c + 1 < out.columnCount(); ++c) key += out.column(c).cellText(i);
+                    sums[key] += age.numbers[i];
+                }
+            }
+            cout << q << "\t" << threads << "\t" << aggMs << "\t"
+                 << secondsSince(start) / reps * 1e3 << "\n";
+        }
+    }
+}
+
+// Standing queries refreshed on each appended batch, next to re-running
+// them over the whole table after every batch. The append time includes
+// copying the batch into the table.
+static void benchContinuous() {
+    const size_t n = 4000000, batchRows = 10000, batches = 20;
+    Table base = makeCustomers(n);
+    base.dictionaryEncode();
+    Table batch = makeCustomers(batchRows);
+    const char* queries[] = {
+        "SELECT name, age FROM Customers WHERE age > 90 AND status = \"vip\"",
+        "SELECT status, COUNT(*), AVG(age) FROM Customers GROUP BY status",
+        "SELECT name, MAX(age) FROM Customers WHERE active = true GROUP BY name ORDER BY name",
+    };
+    cout << "query\ttable_rows\tappend_refresh_ms\trerun_ms\n";
+    for (int q = 0; q < 3; ++q) {
+        CompiledQuery plan;
+        if (!compileText(queries[q], base.schema(), plan)) return;
+        ContinuousTable live(base);
+        int id = live.addQuery(plan);
+        live.refresh();
+        double refresh = 0, rerun = 0;
+        for (size_t b = 0; b < batches; ++b) {
+            auto start = Clock::now();
+            live.append(batch);
+            refresh += secondsSince(start);
+            start = Clock::now();
+            evaluateQuery(plan, live.table());
+            rerun += secondsSince(start);
+        }
+        live.removeQuery(id);
+        cout << q << "\t" << live.table().rowCount() << "\t" << refresh / batches * 1e3 << "\t"
+             << rerun / batches * 1e3 << "\n";
+    }
+}
+
+// Redundant, set-like and contradictory filters with and without the
+// logical optimizer.
+static void benchOptimizer() {
+    const size_t n = 4000000;
+    Table t = makeCustomers(n);
+    string inList = "SELECT name FROM Customers WHERE ";
+    for (int i = 0; i < 24; ++i) inList += (i ? " OR age = " : "age = ") + to_string(i * 3);
+    string filters[] = {
+        "SELECT name FROM Customers WHERE age >= 10 AND age > 20 AND age >= 30 AND age < 90 AND age <= 60",
+        inList,
+        "SELECT name FROM Customers WHERE (age < 10 AND age > 20) OR (status = \"vip\" AND status = \"regular\")",
+    };
+    cout << "filter\toptimized\tnodes\tmatches\tms\n";
+    for (int f = 0; f < 3; ++f) {
+        CompiledQuery plan;
+        if (!compileText(filters[f], t.schema(), plan)) return;
+        for (bool optimized : {false, true}) {
+            if (optimized) optimizeQuery(plan);
+            const int reps = 5;
+            size_t rows = 0;
+            auto start = Clock::now();
+            for (int r = 0; r < reps; ++r) rows = evaluateQuery(plan, t).rowCount();
+            cout << f << "\t" << (optimized ? "on" : "off") << "\t" << plan.where.size() << "\t"
+                 << rows << "\t" << secondsSince(start) / reps * 1e3 << "\n";
+        }
+    }
+}
+
+// age = 0 AND (age = 1 OR (age = 2 AND (...))), `depth` levels deep.
+static string makeNested(size_t depth) {
+    string q = "SELECT name FROM Customers WHERE ";
+    for (size_t i = 0; i < depth; ++i) {
+        q += "age = " + to_string(i) + (i % 2 ? " OR (" : " AND (");
+    }
+    q += "active = true";
+    q += string(depth, ')');
+    return q;
+}
+
+// Front-end cost per query: parse alone and parse + check + compile, with
+// the ParseContext and Query reused the way a server loop would.
+static void benchAst() {
+    SymbolTable schema = customerSchema();
+    vector<string> mix = makeQueryMix();
+    struct Workload { string name; vector<string> texts; };
+    Workload loads[] = {
+        {"mix", mix},
+        {"or64", {makeOrChain(64)}},
+        {"nested64", {makeNested(64)}},
+    };
+
+    cout << "workload\tstage\tqueries\tus_per_query\tallocs_per_query\n";
+    for (const Workload& w : loads) {
+        const size_t reps = 200000 / w.texts.size() / (w.name == "mix" ? 1 : 8);
+        for (bool full : {false, true}) {
+            ParseContext ctx;
+            ctx.filename = "bench";
+            Query q;
+            size_t queries = 0;
+            size_t before = allocations;
+            auto start = Clock::now();
+            for (size_t r = 0; r < reps; ++r) {
+                for (const string& text : w.texts) {
+                    bool ok = parseQuery(ctx, text, q);
+                    if (ok && full) {
+                        CompiledQuery plan;
+                        ok = checkQuerySemantics(q, schema) && compileQuery(q, schema, plan);
+                    }
+                    if (!ok) {
+                        cerr << "compile failed: " << text << "\n";
+                        return;
+                    }
+                    ++queries;
+                }
+            }
+            double secs = secondsSince(start);
+            cout << w.name << "\t" << (full ? "compile" : "parse") << "\t" << queries << "\t"
+                 << secs * 1e6 / queries << "\t" << (double)(allocations - before) / queries << "\n";
+        }
+    }
+}
+
+// --- suite: synthetic data and query sets, per-phase timings ---
+
+struct SuiteOptions {
+    size_t rows = 1000000;
+    size_t cardinality = 1000;  // distinct names
+    string dist = "uniform";    // uniform | zipf | sorted
+    size_t queries = 2000;      // per query set, for the front-end phases
+    size_t evalQueries = 50;    // per query set, for the evaluate phase
+    unsigned threads = 1;       // scan threads
+    uint64_t seed = 1;
+    string format = "tsv";      // tsv | json
+    string label;               // copied to every record, e.g. a commit id
+};
+
+struct Rng {
+    uint64_t x;
+    explicit Rng(uint64_t seed) : x(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+    uint64_t next() { x ^= x << 13; x ^= x >> 7; x ^= x << 17; return x; }
+    // Uniform in [0, 1).
+    double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    // Uniform in [0, n).
+    size_t pick(size_t n) { return min(n - 1, (size_t)(unit() * n)); }
+};
+
+// Zipf-distributed ranks in [0, n): rank k comes up with probability
+// proportional to 1 / (k + 1)^s. Drawn by rejection-inversion (Hoermann
+// and Derflinger, 1996), which needs no table, so n may be large.
+struct Zipf {
+    size_t n;
+    double s;
+    double hFirst, hLast, threshold;
+
+    explicit Zipf(size_t n, double s = 1.0) : n(max<size_t>(n, 1)), s(s) {
+        hFirst = hIntegral(1.5) - 1.0;
+        hLast = hIntegral((double)this->n + 0.5);
+        threshold = 2.0 - hIntegralInverse(hIntegral(2.5) - h(2.0));
+    }
+
+    size_t pick(Rng& rng) const {
+        while (true) {
+            double u = hLast + rng.unit() * (hFirst - hLast);
+            double x = hIntegralInverse(u);
+            double k = floor(x + 0.5);
+            if (k < 1) k = 1;
+            else if (k > (double)n) k = (double)n;
+            if (k - x <= threshold || u >= hIntegral(k + 0.5) - h(k)) return (size_t)k - 1;
+        }
+    }
+
+private:
+    // h(x) = x^-s, and its integral and inverse, written through
+    // log1p/expm1 so that s = 1 needs no special case
+    double h(double x) const { return exp(-s * log(x)); }
+    double hIntegral(double x) const {
+        double lx = log(x);
+        return expm1Over((1.0 - s) * lx) * lx;
+    }
+    double hIntegralInverse(double x) const {
+        double t = max(x * (1.0 - s), -1.0);
+        return exp(log1pOver(t) * x);
+    }
+    // log1p(x) / x and expm1(x) / x, with their limits at 0
+    static double log1pOver(double x) {
+        return fabs(x) > 1e-8 ? log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+    }
+    static double expm1Over(double x) {
+        return fabs(x) > 1e-8 ? expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x / 3.0 * (1.0 + 0.25 * x));
+    }
+};
+
+static string nameValue(size_t k) { return "n" + to_string(k); }
+
+// Customers-shaped table: `cardinality` distinct names and ages in
+// [0, 100), drawn uniformly or Zipf-distributed (rank 0 most common), or
+// with ages rising with the row number; a Zipf-distributed five-value
+// status column and an even bool. Name and status are
+// dictionary-encoded when the cardinality allows it, and zone maps are
+// built, as the loaders do.
+static Table generateCustomers(const SuiteOptions& o) {
+    Table t(customerSchema());
+    Rng rng(o.seed);
+    bool skewed = o.dist == "zipf";
+    bool sorted = o.dist == "sorted";
+    Zipf names(o.cardinality), ages(100), statusRanks(5);
+    Column& name = t.column(t.findColumn("name"));
+    Column& age = t.column(t.findColumn("age"));
+    Column& status = t.column(t.findColumn("status"));
+    Column& active = t.column(t.findColumn("active"));
+    static const char* statuses[] = {"regular", "vip", "trial", "churned", "staff"};
+
+    bool encodeNames = o.cardinality <= DICT_MAX_DISTINCT;
+    if (encodeNames) {
+        name.encoded = true;
+        for (size_t k = 0; k < o.cardinality; ++k) name.codeFor(nameValue(k));
+        name.codes.reserve(o.rows);
+    }
+    status.encoded = true;
+    for (const char* s : statuses) status.codeFor(s);
+    status.codes.reserve(o.rows);
+    age.numbers.reserve(o.rows);
+    active.bools.reserve(o.rows);
+
+    for (size_t i = 0; i < o.rows; ++i) {
+        size_t k = skewed ? names.pick(rng) : rng.pick(o.cardinality);
+        if (encodeNames) name.codes.push_back((uint32_t)k);
+        else name.appendString(nameValue(k));
+        double a = sorted ? floor(100.0 * i / o.rows) : (double)(skewed ? ages.pick(rng) : rng.pick(100));
+        age.appendNumber(a);
+        status.codes.push_back((uint32_t)statusRanks.pick(rng));
+        active.appendBool(rng.next() & 1);
+        t.finishRow();
+    }
+    if (o.rows >= Table::DEFAULT_ZONE_ROWS) t.buildZoneMaps();
+    return t;
+}
+
+// A name drawn as generateCustomers draws them.
+static string randomName(Rng& rng, const SuiteOptions& o) {
+    return nameValue(o.dist == "zipf" ? Zipf(o.cardinality).pick(rng) : rng.pick(o.cardinality));
+}
+
+static string randomPredicate(Rng& rng, const SuiteOptions& o) {
+    static const char* cmp[] = {"=", "!=", "<", "<=", ">", ">="};
+    switch (rng.next() % 4) {
+        case 0: return "age " + string(cmp[rng.next() % 6]) + " " + to_string(rng.next() % 100);
+        case 1: return "name " + string(rng.next() % 4 ? "=" : "!=") + " \"" +
+                       randomName(rng, o) + "\"";
+        case 2: return string("status = ") + (rng.next() % 2 ? "\"vip\"" : "\"trial\"");
+        default: return string("active = ") + (rng.next() % 2 ? "true" : "false");
+    }
+}
+
+// Short: one to four predicates joined by AND/OR, as a dashboard sends.
+// Nested: 32 levels of alternating AND/OR parentheses.
+// Or-chain: 256 equality terms over names and ages.
+static vector<string> generateQueries(const string& set, size_t n, const SuiteOptions& o) {
+    Rng rng(o.seed * 31 + set.size());
+    vector<string> out;
+    for (size_t i = 0; i < n; ++i) {
+        string q = rng.next() % 2 ? "SELECT name, age FROM Customers WHERE " : "SELECT * FROM Customers WHERE ";
+        if (set == "short") {
+            size_t preds = 1 + rng.next() % 4;
+            for (size_t p = 0; p < preds; ++p) {
+                if (p) q += rng.next() % 3 ? " AND " : " OR ";
+                q += randomPredicate(rng, o);
+            }
+        } else if (set == "nested") {
+            const size_t depth = 32;
+            for (size_t d = 0; d < depth; ++d) q += randomPredicate(rng, o) + (d % 2 ? " OR (" : " AND (");
+            q += randomPredicate(rng, o) + string(depth, ')');
+        } else {
+            for (size_t p = 0; p < 256; ++p) {
+                if (p) q += " OR ";
+                if (rng.next() % 2) q += "age = " + to_string(rng.next() % 100);
+                else q += "name = \"" + randomName(rng, o) + "\"";
+            }
+        }
+        out.push_back(q);
+    }
+    return out;
+}
+
+// Latencies (ns) and allocations of one phase over a query set.
+struct PhaseSamples {
+    vector<double> nanos;
+    size_t allocs = 0;
+    size_t rows = 0;        // evaluate: rows scanned
+    size_t matches = 0;     // evaluate: rows returned
+};
+
+// Counts the result rows without keeping them.
+class CountSink : public ResultSink {
+public:
+    size_t rows = 0;
+    bool consume(const Table& batch) override { rows += batch.rowCount(); return true; }
+};
+
+static double percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t i = (size_t)ceil(p / 100 * sorted.size());
+    return sorted[min(sorted.size(), max<size_t>(i, 1)) - 1];
+}
+
+static void reportPhase(const SuiteOptions& o, const string& set, const string& phase, PhaseSamples& s) {
+    sort(s.nanos.begin(), s.nanos.end());
+    double total = 0;
+    for (double ns : s.nanos) total += ns;
+    size_t n = s.nanos.size();
+    double perSec = total > 0 ? n / (total * 1e-9) : 0;
+    double rowsPerSec = total > 0 ? s.rows / (total * 1e-9) : 0;
+    double allocs = n ? (double)s.allocs / n : 0;
+    double p50 = percentile(s.nanos, 50) / 1e3, p90 = percentile(s.nanos, 90) / 1e3;
+    double p99 = percentile(s.nanos, 99) / 1e3, pmax = n ? s.nanos.back() / 1e3 : 0;
+    if (o.format == "json") {
+        cout << "{\"label\":\"" << o.label << "\",\"rows\":" << o.rows << ",\"dist\":\"" << o.dist
+             << "\",\"set\":\"" << set << "\",\"phase\":\"" << phase << "\",\"samples\":" << n
+             << ",\"total_ms\":" << total / 1e6 << ",\"per_sec\":" << perSec
+             << ",\"rows_per_sec\":" << rowsPerSec << ",\"matches\":" << s.matches
+             << ",\"p50_us\":" << p50 << ",\"p90_us\":" << p90 << ",\"p99_us\":" << p99
+             << ",\"max_us\":" << pmax << ",\"allocs_per_query\":" << allocs << "}\n";
+    } else {
+        cout << o.label << "\t" << o.rows << "\t" << o.dist << "\t" << set << "\t" << phase << "\t" << n
+             << "\t" << total / 1e6 << "\t" << perSec << "\t" << rowsPerSec << "\t" << s.matches
+             << "\t" << p50 << "\t" << p90 << "\t" << p99 << "\t" << pmax << "\t" << allocs << "\n";
+    }
+}
+
+// Parses the value of a numeric option of `mode`: a whole decimal number
+// from `min` to `max`. Prints why and returns false otherwise.
+template <class T>
+static bool parseNumber(const char* mode, const string& flag, const string& v,
+                        uint64_t min, uint64_t max, T& out) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long x = strtoull(v.c_str(), &end, 10);
+    if (v.empty() || !isdigit((unsigned char)v[0]) || *end != '\0' || errno == ERANGE ||
+        x < min || x > max) {
+        cerr << mode << ": " << flag << " needs a whole number from " << min << " to " << max
+             << ", got '" << v << "'\n";
+        return false;
+    }
+    out = (T)x;
+    return true;
+}
+
+static bool parseSuiteOptions(int argc, char** argv, SuiteOptions& o) {
+    for (int i = 2; i < argc; ++i) {
+        string flag = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "suite: " << flag << " needs a value\n";
+            return false;
+        }
+        string v = argv[++i];
+        bool ok = true;
+        if (flag == "--rows") ok = parseNumber("suite", flag, v, 0, 100000000, o.rows);
+        else if (flag == "--cardinality") ok = parseNumber("suite", flag, v, 1, UINT32_MAX, o.cardinality);
+        else if (flag == "--dist") o.dist = v;
+        else if (flag == "--queries") ok = parseNumber("suite", flag, v, 0, SIZE_MAX, o.queries);
+        else if (flag == "--eval-queries") ok = parseNumber("suite", flag, v, 0, SIZE_MAX, o.evalQueries);
+        else if (flag == "--threads") ok = parseNumber("suite", flag, v, 1, 1024, o.threads);
+        else if (flag == "--seed") ok = parseNumber("suite", flag, v, 0, UINT64_MAX, o.seed);
+        else if (flag == "--format") o.format = v;
+        else if (flag == "--label") o.label = v;
+        else {
+            cerr << "suite: unknown option " << flag << "\n";
+            return false;
+        }
+        if (!ok) return false;
+    }
+    if (o.dist != "uniform" && o.dist != "zipf" && o.dist != "sorted") {
+        cerr << "suite: --dist must be uniform, zipf or sorted\n";
+        return false;
+    }
+    if (o.format != "tsv" && o.format != "json") {
+        cerr << "suite: --format must be tsv or json\n";
+        return false;
+    }
+    return true;
+}
+
+// One record per (query set, phase): tokenize, parse, check, compile
+// (compile + optimize) and evaluate are timed separately per query.
+// Allocations are those made on the calling thread, so they are complete
+// only with --threads 1.
+static void benchSuite(const SuiteOptions& o) {
+    PhaseSamples gen;
+    size_t before = allocations;
+    auto start = Clock::now();
+    Table table = generateCustomers(o);
+    gen.nanos.push_back(secondsSince(start) * 1e9);
+    gen.allocs = allocations - before;
+    gen.rows = o.rows;
+
+    if (o.format == "tsv") {
+        cout << "label\trows\tdist\tset\tphase\tsamples\ttotal_ms\tper_sec\trows_per_sec\tmatches"
+                "\tp50_us\tp90_us\tp99_us\tmax_us\tallocs_per_query\n";
+    }
+    reportPhase(o, "data", "generate", gen);
+
+    EvalOptions opts;
+    opts.threads = o.threads;
+    const SymbolTable& schema = table.schema();
+    for (const string set : {"short", "nested", "orchain"}) {
+        vector<string> texts = generateQueries(set, max(o.queries, o.evalQueries), o);
+        PhaseSamples tok, parse, check, compile, eval;
+        ParseContext ctx;
+        ctx.filename = "suite";
+        Query q;
+        for (size_t i = 0; i < texts.size(); ++i) {
+            auto timed = [&](PhaseSamples& s, auto&& fn) {
+                size_t a = allocations;
+                auto t0 = Clock::now();
+                bool ok = fn();
+                s.nanos.push_back(chrono::duration<double, nano>(Clock::now() - t0).count());
+                s.allocs += allocations - a;
+                return ok;
+            };
+            CompiledQuery plan;
+            bool ok = timed(tok, [&] {
+                ctx.tokens.toks.clear();
+                tokenize(texts[i], ctx.tokens.toks);
+                return true;
+            });
+            ok = ok && timed(parse, [&] { return parseTokens(ctx, q); });
+            ok = ok && timed(check, [&] { return checkQuerySemantics(q, schema); });
+            ok = ok && timed(compile, [&] {
+                if (!compileQuery(q, schema, plan)) return false;
+                optimizeQuery(plan);
+                return true;
+            });
+            if (!ok) {
+                cerr << "suite: query failed: " << texts[i] << "\n";
+                return;
+            }
+            if (i < o.evalQueries) {
+                CountSink sink;
+                timed(eval, [&] { evaluateQuery(plan, table, sink, opts); return true; });
+                eval.rows += table.rowCount();
+                eval.matches += sink.rows;
+            }
+        }
+        reportPhase(o, set, "tokenize", tok);
+        reportPhase(o, set, "parse", parse);
+        reportPhase(o, set, "check", check);
+        reportPhase(o, set, "compile", compile);
+        reportPhase(o, set, "evaluate", eval);
+    }
+}
+
+struct LoadOptions {
+    string socket;              // a running server; empty starts one in-process
+    vector<unsigned> clients = {1, 4, 16};
+    size_t requests = 2000;     // per client
+    size_t pipeline = 1;        // requests a client keeps in flight
+    unsigned workers = max(1u, thread::hardware_concurrency());
+    size_t rows = 100000;       // in-process table size
+    vector<string> queries;
+};
+
+static bool parseLoadOptions(int argc, char** argv, LoadOptions& o) {
+    for (int i = 2; i < argc; ++i) {
+        string flag = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "load: " << flag << " needs a value\n";
+            return false;
+        }
+        string v = argv[++i];
+        bool ok = true;
+        unsigned clients;
+        if (flag == "--socket") o.socket = v;
+        else if (flag == "--clients") {
+            ok = parseNumber("load", flag, v, 1, 4096, clients);
+            o.clients = {clients};
+        }
+        else if (flag == "--requests") ok = parseNumber("load", flag, v, 1, SIZE_MAX, o.requests);
+        else if (flag == "--pipeline") ok = parseNumber("load", flag, v, 1, SIZE_MAX, o.pipeline);
+        else if (flag == "--workers") ok = parseNumber("load", flag, v, 1, 1024, o.workers);
+        else if (flag == "--rows") ok = parseNumber("load", flag, v, 0, 100000000, o.rows);
+        else if (flag == "--query") o.queries.push_back(v);
+        else {
+            cerr << "load: unknown option " << flag << "\n";
+            return false;
+        }
+        if (!ok) return false;
+    }
+    if (o.queries.empty()) {
+        o.queries = {
+            "SELECT name, status FROM Customers WHERE age = 30",
+            "SELECT COUNT(*) FROM Customers WHERE status = \"vip\" AND active = true",
+            "SELECT name, age FROM Customers WHERE age > 90 LIMIT 10",
+            "SELECT status, AVG(age) FROM Customers GROUP BY status",
+        };
+    }
+    return true;
+}
+
+// Load generator for the query server: each client connects, keeps up
+// to --pipeline requests in flight and times each from sending it to the
+// end of its answer. Without --socket a server over a generated Customers
+// table runs in this process.
+static void benchLoad(const LoadOptions& o) {
+    Catalog catalog;
+    unique_ptr<QueryServer> local;
+    string path = o.socket;
+    if (path.empty()) {
+        catalog.addTable("Customers", makeCustomers(o.rows));
+        ServerOptions so;
+        so.workers = o.workers;
+        local = make_unique<QueryServer>(catalog, so);
+        path = "/tmp/querybench-" + to_string(getpid()) + ".sock";
+        if (!local->listen(path)) return;
+    }
+
+    cout << "clients\tpipeline\trequests\tseconds\tqps\tp50_ms\tp99_ms\terrors\n";
+    for (unsigned clients : o.clients) {
+        vector<vector<double>> latency(clients);
+        atomic<size_t> errors{0};
+        auto client = [&](unsigned c) {
+            QueryClient conn;
+            if (!conn.connect(path)) {
+                errors += o.requests;
+                return;
+            }
+            deque<Clock::time_point> sent;
+            string text;
+            bool ok;
+            for (size_t next = 0, done = 0; done < o.requests;) {
+                while (next < o.requests && next - done < o.pipeline) {
+                    if (!conn.send(o.queries[(c + next) % o.queries.size()])) break;
+                    sent.push_back(Clock::now());
+                    next++;
+                }
+                if (sent.empty() || !conn.receive(text, ok)) {
+                    errors += o.requests - done;
+                    return;
+                }
+                latency[c].push_back(secondsSince(sent.front()) * 1e3);
+                sent.pop_front();
+                done++;
+                if (!ok) errors++;
+            }
+        };
+        auto start = Clock::now();
+        vector<thread> threads;
+        for (unsigned c = 0; c < clients; ++c) threads.emplace_back(client, c);
+        for (auto& t : threads) t.join();
+        double seconds = secondsSince(start);
+
+        vector<double> all;
+        for (const auto& l : latency) all.insert(all.end(), l.begin(), l.end());
+        sort(all.begin(), all.end());
+        cout << clients << "\t" << o.pipeline << "\t" << all.size() << "\t" << seconds << "\t"
+             << all.size() / seconds << "\t" << percentile(all, 50) << "\t" << percentile(all, 99)
+             << "\t" << errors << "\n";
+    }
+}
+
+// Writes `t` as comma-separated text with a header row.
+static void writeCsv(const Table& t, const string& path) {
+    ofstream out(path);
+    string line;
+    for (size_t c = 0; c < t.columnCount(); ++c) {
+        if (c) line += ',';
+        line += t.schema().fieldName(c);
+    }
+    out << line << '\n';
+    for (size_t r = 0; r < t.rowCount(); ++r) {
+        line.clear();
+        for (size_t c = 0; c < t.columnCount(); ++c) {
+            if (c) line += ',';
+            t.column(c).writeCell(r, line);
+        }
+        out << line << '\n';
+    }
+}
+
+// A narrow query from a fresh catalog over the customers columns alone
+// and over the same columns plus 60 unused ones, as CSV and as a column
+// file. "full" loads the whole table first, as every query used to;
+// "pushdown" lets the query load only the columns it reads.
+static void benchWide() {
+    const size_t n = 400000;
+    Table narrow = makeCustomers(n);
+    SymbolTable wideSchema = customerSchema();
+    for (int i = 0; i < 40; ++i) wideSchema.addField("x" + to_string(i), FT_NUMBER);
+    for (int i = 0; i < 20; ++i) wideSchema.addField("s" + to_string(i), FT_STRING);
+    Table wide(wideSchema);
+    for (size_t c = 0; c < narrow.columnCount(); ++c) wide.column(c).appendColumn(narrow.column(c), n);
+    for (size_t r = 0; r < n; ++r) {
+        for (int i = 0; i < 40; ++i) wide.column(4 + i).appendNumber((double)((r * 7 + i) % 1000));
+        for (int i = 0; i < 20; ++i) wide.column(44 + i).appendString("v" + to_string((r + i) % 50));
+    }
+    wide.setRowCount(n);
+
+    const string base = "/tmp/querybench_wide";
+    writeCsv(narrow, base + "_narrow.csv");
+    writeCsv(wide, base + "_wide.csv");
+    narrow.dictionaryEncode();
+    wide.dictionaryEncode();
+    if (!writeColumnFile(narrow, base + "_narrow.qcol") || !writeColumnFile(wide, base + "_wide.qcol")) return;
+
+    const string query = "SELECT name FROM t WHERE age >= 60";
+    cout << "format\ttable\tcolumns\tload\trows_out\tms\n";
+    for (const string format : {"csv", "qcol"}) {
+        for (const string width : {"narrow", "wide"}) {
+            for (bool pushdown : {false, true}) {
+                const int reps = 3;
+                double best = 1e30;
+                size_t rows = 0;
+                for (int r = 0; r < reps; ++r) {
+                    Catalog catalog;
+                    catalog.addFile("t", base + "_" + width + "." + format);
+                    auto start = Clock::now();
+                    if (!pushdown && !catalog.lookup("t")) return;
+                    shared_ptr<PreparedQuery> q = prepareQuery(catalog, query);
+                    CountSink sink;
+                    if (!q || !executePrepared(*q, {}, sink)) return;
+                    best = min(best, secondsSince(start));
+                    rows = sink.rows;
+                }
+                cout << format << "\t" << width << "\t" << (width == "wide" ? wide : narrow).columnCount()
+                     << "\t" << (pushdown ? "pushdown" : "full") << "\t" << rows << "\t" << best * 1e3 << "\n";
+            }
+        }
+    }
+    for (const char* f : {"_narrow.csv", "_wide.csv", "_narrow.qcol", "_wide.qcol"}) remove((base + f).c_str());
+}
+
+int main(int argc, char** argv) {
+    string which = argc > 1 ? argv[1] : "all";
+    if (which == "load") {
+        LoadOptions o;
+        if (!parseLoadOptions(argc, argv, o)) return 1;
+        benchLoad(o);
+        return 0;
+    }
+    if (which == "suite") {
+        SuiteOptions o;
+        if (!parseSuiteOptions(argc, argv, o)) return 1;
+        benchSuite(o);
+        return 0;
+    }
+    if (which == "parse" || which == "all") benchParse();
+    if (which == "compile-mt" || which == "all") benchCompileThreads();
+    if (which == "kernels" || which == "all") benchKernels();
+    if (which == "scan-mt" || which == "all") benchScanThreads();
+    if (which == "ingest" || which == "all") benchIngest();
+    if (which == "zonemap" || which == "all") benchZoneMaps();
+    if (which == "index" || which == "all") benchIndex();
+    if (which == "dict" || which == "all") benchDictionary();
+    if (which == "prepared" || which == "all") benchPrepared();
+    if (which == "batch" || which == "all") benchBatch();
+    if (which == "adaptive" || which == "all") benchAdaptive();
+    if (which == "refine" || which == "all") benchRefine();
+    if (which == "topn" || which == "all") benchTopN();
+    if (which == "aggregate" || which == "all") benchAggregate();
+    if (which == "continuous" || which == "all") benchContinuous();
+    if (which == "optimizer" || which == "all") benchOptimizer();
+    if (which == "ast" || which == "all") benchAst();
+    if (which == "wide" || which == "all") benchWide();
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "catalog.h"
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+#include "column_file.h"
+#include "diagnostics.h"
+
+
+// Size and modification time of `path`. Prints an error and returns
+// false if it cannot be read.
+static bool fileStamp(const string& path, uint64_t& size, int64_t& time) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        diagnostics() << "Load error: cannot stat '" << path << "': " << strerror(errno) << "\n";
+        return false;
+    }
+    size = (uint64_t)st.st_size;
+    time = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+string Catalog::key(const string& name) {
+    string k = name;
+    for (auto& c : k) c = (char)tolower((unsigned char)c);
+    return k;
+}
+
+void Catalog::addTable(const string& name, Table table) {
+    std::lock_guard<std::mutex> g(lock);
+    Entry& e = entries[key(name)];
+    e = Entry();
+    e.version = ++versions;
+    e.schema = table.schema();
+    e.table = std::make_shared<Table>(std::move(table));
+    e.table->dictionaryEncode();
+    e.loaded.assign(e.table->columnCount(), true);
+}
+
+void Catalog::addFile(const string& name, const string& path, const SymbolTable* schema) {
+    std::lock_guard<std::mutex> g(lock);
+    Entry& e = entries[key(name)];
+    e = Entry();
+    e.version = ++versions;
+    e.path = path;
+    if (schema) e.schema = *schema;
+    else e.csv.inferSchema = true;
+}
+
+bool Catalog::hasTable(const string& name) const {
+    std::lock_guard<std::mutex> g(lock);
+    return entries.count(key(name)) != 0;
+}
+
+uint64_t Catalog::schemaVersion(const string& name) const {
+    std::lock_guard<std::mutex> g(lock);
+    auto it = entries.find(key(name));
+    return it == entries.end() ? 0 : it->second.version;
+}
+
+shared_ptr<Table> Catalog::load(const string& name, const vector<bool>* want) {
+    auto it = entries.find(key(name));
+    if (it == entries.end()) {
+        diagnostics() << "Semantic error: unknown table in FROM: '" << name << "'\n";
+        return nullptr;
+    }
+    Entry& e = it->second;
+
+    // columns to read now: all of them on a first full load, otherwise
+    // those wanted (every one without `want`) that are still missing
+    bool all = !want && !e.table;
+    vector<bool> read;
+    if (!e.table) {
+        if (want) read = *want;
+    } else {
+        read.assign(e.table->columnCount(), false);
+        bool any = false;
+        for (size_t c = 0; c < read.size(); ++c) {
+            read[c] = (!want || (c < want->size() && (*want)[c])) && !e.loaded[c];
+            any = any || read[c];
+        }
+        if (!any) return e.table;
+    }
+
+    uint64_t fileSize;
+    int64_t fileTime;
+    if (!fileStamp(e.path, fileSize, fileTime)) return nullptr;
+    if (e.table && (fileSize != e.fileSize || fileTime != e.fileTime)) {
+        diagnostics() << "Load error: '" << e.path << "' has changed since table '" << name
+             << "' was first loaded\n";
+        return nullptr;
+    }
+
+    Table part;
+    bool columnFile = isColumnFile(e.path);
+    if (columnFile) {
+        if (!openColumnFile(e.path, part, all ? nullptr : &read)) return nullptr;
+        e.schema = part.schema();
+    } else {
+        if (!loadDelimitedFile(e.path, e.csv, e.schema, part, all ? nullptr : &read)) return nullptr;
+        // later loads match the file against the schema found now
+        e.csv.inferSchema = false;
+        part.setZoneRows(Table::DEFAULT_ZONE_ROWS);
+    }
+    read.resize(part.columnCount(), all);
+
+    // the first load fixes the row count, before any reader sees the table
+    if (!e.table) {
+        e.table = std::make_shared<Table>(std::move(part));
+        e.loaded.assign(read.size(), false);
+        e.fileSize = fileSize;
+        e.fileTime = fileTime;
+    } else {
+        if (part.rowCount() != e.table->rowCount() || part.columnCount() != e.table->columnCount()) {
+            diagnostics() << "Load error: '" << e.path << "' no longer matches table '" << name
+                 << "' as first loaded\n";
+            return nullptr;
+        }
+        for (size_t c = 0; c < read.size(); ++c) {
+            if (read[c]) e.table->column(c) = std::move(part.column(c));
+        }
+        for (const auto& b : part.backings()) e.table->addBacking(b);
+    }
+    for (size_t c = 0; c < read.size(); ++c) {
+        if (!read[c]) continue;
+        e.loaded[c] = true;
+        if (!columnFile) {
+            e.table->dictionaryEncodeColumn(c);
+            e.table->buildZoneMap(c);
+        }
+    }
+    return e.table;
+}
+
+shared_ptr<const Table> Catalog::lookup(const string& name) {
+    std::lock_guard<std::mutex> g(lock);
+    return load(name);
+}
+
+shared_ptr<const Table> Catalog::lookup(const string& name, const vector<int>& columns) {
+    std::lock_guard<std::mutex> g(lock);
+    vector<bool> want;
+    for (int c : columns) {
+        if (c < 0) continue;
+        if ((size_t)c >= want.size()) want.resize(c + 1, false);
+        want[c] = true;
+    }
+    return load(name, &want);
+}
+
+bool Catalog::createIndex(const string& table, const string& field, IndexKind kind) {
+    std::lock_guard<std::mutex> g(lock);
+    vector<bool> want;
+    shared_ptr<Table> t = load(table, &want);
+    if (!t) return false;
+    int c = t->findColumn(field);
+    if (c >= 0) {
+        want.assign(c + 1, false);
+        want[c] = true;
+        if (!load(table, &want)) return false;
+    }
+    return ::createIndex(*t, field, kind);
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "csv_reader.h"
+#include "table.h"
+
+using std::map;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+// Maps the names used in FROM to tables. Names are matched
+// case-insensitively. File-backed tables are loaded column by column as
+// queries first need them, and then shared by every later query.
+class Catalog {
+public:
+    // Registers a table that is already in memory.
+    void addTable(const string& name, Table table);
+    // Registers a column file (see column_file.h) or a CSV/TSV file. For
+    // CSV/TSV with a null schema the layout is inferred from the header row.
+    void addFile(const string& name, const string& path,
+                 const SymbolTable* schema = nullptr);
+
+    // Builds an index on a field of a catalog table, loading it if needed.
+    // Indexes are meant to be created up front, before queries run against
+    // the table.
+    bool createIndex(const string& table, const string& field, IndexKind kind);
+
+    bool hasTable(const string& name) const;
+    // Changes whenever `name` is registered again, so plans compiled
+    // against an older schema can be detected. 0 if the name is unknown.
+    uint64_t schemaVersion(const string& name) const;
+    // Resolves a FROM name, loading the whole table if needed. Prints an
+    // error and returns null if the name is unknown or the load fails.
+    shared_ptr<const Table> lookup(const string& name);
+    // The same, but only `columns` (schema column indexes) are guaranteed
+    // to be loaded; with none, only the schema and the row count are.
+    // Columns that are loaded are never changed, so the table may be
+    // scanned while other columns are being added. A file that has changed
+    // since its first columns were loaded is refused until it is
+    // registered again.
+    shared_ptr<const Table> lookup(const string& name, const vector<int>& columns);
+
+private:
+    struct Entry {
+        string path;
+        CsvOptions csv;
+        SymbolTable schema;
+        shared_ptr<Table> table;
+        vector<bool> loaded;        // per column of `table`
+        // size and modification time of the file when `table` was first
+        // loaded; later columns must come from the same file
+        uint64_t fileSize = 0;
+        int64_t fileTime = 0;       // nanoseconds
+        uint64_t version = 0;
+    };
+
+    static string key(const string& name);
+    // Loads the entry's table, or the columns in `want` not loaded yet when
+    // given; call with `lock` held.
+    shared_ptr<Table> load(const string& name, const vector<bool>* want = nullptr);
+
+    map<string, Entry> entries;
+    uint64_t versions = 0;
+    mutable std::mutex lock;
+};
@@ -0,0 +1,276 @@
+#include "column_file.h"
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include "diagnostics.h"
+#include "mapped_file.h"
+
+
+namespace {
+
+const char MAGIC[8] = {'Q','C','O','L','v','2',0,0};
+const uint32_t COLUMN_DICT = 1;
+const uint64_t ALIGN = 64;
+
+struct FileHeader {
+    char magic[8];
+    uint64_t rows;
+    uint32_t columns;
+    uint32_t reserved;
+    uint64_t zoneRows;
+    uint64_t zoneCount;
+};
+
+struct ColumnEntry {
+    uint32_t type;
+    uint32_t flags;             // COLUMN_DICT for dictionary-encoded strings
+    uint32_t nameLen;
+    uint32_t reserved;
+    uint64_t nameOffset;
+    uint64_t dataOffset;        // values, string bytes, or dictionary codes
+    uint64_t dataBytes;
+    uint64_t offsetsOffset;     // FT_STRING: string or dictionary offsets
+    uint64_t dictSize;          // COLUMN_DICT: dictionary entries
+    uint64_t dictOffset;        // COLUMN_DICT: dictionary bytes
+    uint64_t dictBytes;
+    uint64_t zoneMinOffset;     // 0 when the column has no zone maps
+    uint64_t zoneMaxOffset;
+};
+
+uint64_t alignUp(uint64_t n) {
+    return (n + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+// Reserves `bytes` at the end of the layout and returns their offset.
+uint64_t place(uint64_t& end, uint64_t bytes) {
+    uint64_t at = alignUp(end);
+    end = at + bytes;
+    return at;
+}
+
+void writeAt(std::ofstream& out, uint64_t offset, const void* p, size_t n) {
+    out.seekp((std::streamoff)offset);
+    out.write((const char*)p, (std::streamsize)n);
+}
+
+}
+
+bool writeColumnFile(const Table& t, const string& path) {
+    size_t zoneRows = t.zoneRows() ? t.zoneRows() : Table::DEFAULT_ZONE_ROWS;
+    size_t rows = t.rowCount();
+
+    FileHeader h;
+    memcpy(h.magic, MAGIC, sizeof MAGIC);
+    h.rows = rows;
+    h.columns = (uint32_t)t.columnCount();
+    h.reserved = 0;
+    h.zoneRows = zoneRows;
+    h.zoneCount = (rows + zoneRows - 1) / zoneRows;
+
+    vector<ColumnEntry> entries(t.columnCount());
+    vector<ZoneMap> zones(t.columnCount());
+    uint64_t end = sizeof h + sizeof(ColumnEntry) * entries.size();
+    for (size_t c = 0; c < t.columnCount(); ++c) {
+        const Column& col = t.column(c);
+        ColumnEntry& e = entries[c];
+        memset(&e, 0, sizeof e);
+        e.type = col.type;
+        e.nameLen = (uint32_t)col.name.size();
+        e.nameOffset = place(end, col.name.size());
+        switch (col.type) {
+            case FT_NUMBER: e.dataBytes = rows * sizeof(double); break;
+            case FT_BOOL:   e.dataBytes = rows; break;
+            case FT_STRING:
+                if (col.encoded) {
+                    e.flags = COLUMN_DICT;
+                    e.dictSize = col.dict.size();
+                    e.offsetsOffset = place(end, (e.dictSize + 1) * sizeof(uint64_t));
+                    for (const auto& s : col.dict) e.dictBytes += s.size();
+                    e.dictOffset = place(end, e.dictBytes);
+                    e.dataBytes = rows * sizeof(uint32_t);
+                } else {
+                    e.offsetsOffset = place(end, (rows + 1) * sizeof(uint64_t));
+                    e.dataBytes = col.offsets[rows] - col.offsets[0];
+                }
+                break;
+        }
+        e.dataOffset = place(end, e.dataBytes);
+        if (col.type != FT_STRING) {
+            zones[c] = t.zoneRows() == zoneRows && !col.zones.min.empty()
+                     ? col.zones : computeZoneMap(col, rows, zoneRows);
+            e.zoneMinOffset = place(end, h.zoneCount * sizeof(double));
+            e.zoneMaxOffset = place(end, h.zoneCount * sizeof(double));
+        }
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        diagnostics() << "Write error: cannot create '" << path << "'\n";
+        return false;
+    }
+    writeAt(out, 0, &h, sizeof h);
+    writeAt(out, sizeof h, entries.data(), sizeof(ColumnEntry) * entries.size());
+    for (size_t c = 0; c < t.columnCount(); ++c) {
+        const Column& col = t.column(c);
+        const ColumnEntry& e = entries[c];
+        writeAt(out, e.nameOffset, col.name.data(), col.name.size());
+        switch (col.type) {
+            case FT_NUMBER: writeAt(out, e.dataOffset, col.numbers.data(), e.dataBytes); break;
+            case FT_BOOL:   writeAt(out, e.dataOffset, col.bools.data(), e.dataBytes); break;
+            case FT_STRING: {
+                if (col.encoded) {
+                    vector<uint64_t> offs(1, 0);
+                    string bytes;
+                    for (const auto& s : col.dict) {
+                        bytes += s;
+                        offs.push_back(bytes.size());
+                    }
+                    writeAt(out, e.offsetsOffset, offs.data(), offs.size() * sizeof(uint64_t));
+                    writeAt(out, e.dictOffset, bytes.data(), bytes.size());
+                    writeAt(out, e.dataOffset, col.codes.data(), e.dataBytes);
+                    break;
+                }
+                // rebase so the first string starts at byte 0 of the section
+                vector<uint64_t> offs(rows + 1);
+                for (size_t r = 0; r <= rows; ++r) offs[r] = col.offsets[r] - col.offsets[0];
+                writeAt(out, e.offsetsOffset, offs.data(), offs.size() * sizeof(uint64_t));
+                writeAt(out, e.dataOffset, col.blob.data() + col.offsets[0], e.dataBytes);
+                break;
+            }
+        }
+        if (e.zoneMinOffset) {
+            writeAt(out, e.zoneMinOffset, zones[c].min.data(), h.zoneCount * sizeof(double));
+            writeAt(out, e.zoneMaxOffset, zones[c].max.data(), h.zoneCount * sizeof(double));
+        }
+    }
+    // pad to the end of the last section so every offset is in bounds
+    out.seekp(0, std::ios::end);
+    for (uint64_t pos = (uint64_t)out.tellp(); pos < end; ++pos) out.put('\0');
+    out.flush();
+    if (!out) {
+        diagnostics() << "Write error: failed writing '" << path << "'\n";
+        return false;
+    }
+    return true;
+}
+
+bool isColumnFile(const string& path) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof MAGIC];
+    return in.read(magic, sizeof magic) && memcmp(magic, MAGIC, sizeof MAGIC) == 0;
+}
+
+bool openColumnFile(const string& path, Table& out, const vector<bool>* columns) {
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(path)) return false;
+    const char* base = file->data();
+    uint64_t size = file->size();
+
+    auto corrupt = [&](const char* what) {
+        diagnostics() << "Load error: " << path << ": " << what << "\n";
+        return false;
+    };
+    auto inBounds = [&](uint64_t offset, uint64_t bytes) {
+        return offset <= size && bytes <= size - offset;
+    };
+    // count values of `width` bytes fit at offset, checked before multiplying
+    auto arrayInBounds = [&](uint64_t offset, uint64_t count, uint64_t width) {
+        return count <= size / width && inBounds(offset, count * width);
+    };
+
+    FileHeader h;
+    if (size < sizeof h) return corrupt("file too short");
+    memcpy(&h, base, sizeof h);
+    if (memcmp(h.magic, MAGIC, sizeof MAGIC) != 0) return corrupt("not a column file");
+    if (h.zoneRows == 0 || h.zoneCount != (h.rows + h.zoneRows - 1) / h.zoneRows) {
+        return corrupt("bad zone map header");
+    }
+    if (!arrayInBounds(sizeof h, h.columns, sizeof(ColumnEntry))) {
+        return corrupt("column directory out of bounds");
+    }
+
+    vector<ColumnEntry> entries(h.columns);
+    memcpy(entries.data(), base + sizeof h, sizeof(ColumnEntry) * h.columns);
+
+    SymbolTable schema;
+    for (const auto& e : entries) {
+        if (e.type > FT_BOOL || !inBounds(e.nameOffset, e.nameLen)) return corrupt("bad column entry");
+        schema.addField(string(base + e.nameOffset, e.nameLen), (FieldType)e.type);
+    }
+    if (schema.fieldCount() != entries.size()) return corrupt("duplicate column name");
+
+    Table t(schema);
+    for (size_t c = 0; c < entries.size(); ++c) {
+        if (columns && (c >= columns->size() || !(*columns)[c])) continue;
+        const ColumnEntry& e = entries[c];
+        Column& col = t.column(c);
+        if (!inBounds(e.dataOffset, e.dataBytes) || e.dataOffset % ALIGN) {
+            return corrupt("column data out of bounds");
+        }
+        switch (col.type) {
+            case FT_NUMBER:
+                if (h.rows > size / sizeof(double) || e.dataBytes != h.rows * sizeof(double)) {
+                    return corrupt("bad number column size");
+                }
+                col.numbers.borrow((const double*)(base + e.dataOffset), h.rows);
+                break;
+            case FT_BOOL:
+                if (e.dataBytes != h.rows) return corrupt("bad bool column size");
+                col.bools.borrow((const uint8_t*)(base + e.dataOffset), h.rows);
+                break;
+            case FT_STRING: {
+                if (e.flags & COLUMN_DICT) {
+                    if (h.rows > size / sizeof(uint32_t) || e.dataBytes != h.rows * sizeof(uint32_t) ||
+                        e.dictSize >= size / sizeof(uint64_t) ||
+                        !arrayInBounds(e.offsetsOffset, e.dictSize + 1, sizeof(uint64_t)) ||
+                        e.offsetsOffset % ALIGN || !inBounds(e.dictOffset, e.dictBytes)) {
+                        return corrupt("bad dictionary column");
+                    }
+                    const uint64_t* offs = (const uint64_t*)(base + e.offsetsOffset);
+                    const uint32_t* codes = (const uint32_t*)(base + e.dataOffset);
+                    if (offs[0] != 0 || offs[e.dictSize] != e.dictBytes) return corrupt("bad dictionary offsets");
+                    for (uint64_t r = 0; r < h.rows; ++r) {
+                        if (codes[r] >= e.dictSize) return corrupt("dictionary code out of range");
+                    }
+                    col.encoded = true;
+                    for (uint64_t d = 0; d < e.dictSize; ++d) {
+                        if (offs[d] > offs[d + 1]) return corrupt("bad dictionary offsets");
+                        col.codeFor(string_view(base + e.dictOffset + offs[d], offs[d + 1] - offs[d]));
+                    }
+                    // codeFor merges repeated values, which would leave codes past the end
+                    if (col.dict.size() != e.dictSize) return corrupt("duplicate dictionary entry");
+                    col.codes.borrow(codes, h.rows);
+                    break;
+                }
+                if (h.rows >= size / sizeof(uint64_t) ||
+                    !arrayInBounds(e.offsetsOffset, h.rows + 1, sizeof(uint64_t)) || e.offsetsOffset % ALIGN) {
+                    return corrupt("string offsets out of bounds");
+                }
+                const uint64_t* offs = (const uint64_t*)(base + e.offsetsOffset);
+                if (offs[0] != 0 || offs[h.rows] != e.dataBytes) return corrupt("bad string offsets");
+                // stringAt subtracts neighbouring offsets, so they may never go backwards
+                for (uint64_t r = 0; r < h.rows; ++r) {
+                    if (offs[r] > offs[r + 1]) return corrupt("bad string offsets");
+                }
+                col.offsets.borrow(offs, h.rows + 1);
+                col.blob.borrow(base + e.dataOffset, e.dataBytes);
+                break;
+            }
+        }
+        if (e.zoneMinOffset) {
+            if (!arrayInBounds(e.zoneMinOffset, h.zoneCount, sizeof(double)) ||
+                !arrayInBounds(e.zoneMaxOffset, h.zoneCount, sizeof(double))) {
+                return corrupt("zone maps out of bounds");
+            }
+            const double* mn = (const double*)(base + e.zoneMinOffset);
+            const double* mx = (const double*)(base + e.zoneMaxOffset);
+            col.zones.min.assign(mn, mn + h.zoneCount);
+            col.zones.max.assign(mx, mx + h.zoneCount);
+        }
+    }
+    t.setRowCount(h.rows);
+    t.setZoneRows(h.zoneRows);
+    t.addBacking(file);
+    out = std::move(t);
+    return true;
+}
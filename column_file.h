@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include "table.h"
+
+using std::string;
+
+// Binary columnar table file (".qcol"). Layout, all integers in native
+// (little-endian) byte order:
+//
+//   FileHeader
+//   ColumnEntry[columns]
+//   names and column sections, each section 64-byte aligned:
+//     FT_NUMBER  double[rows]
+//     FT_BOOL    uint8_t[rows]
+//     FT_STRING  uint64_t offsets[rows+1], then the string bytes; or, for
+//                dictionary-encoded columns, uint32_t codes[rows], then
+//                uint64_t offsets[dictSize+1] and the dictionary bytes
+//     zone maps  double min[zones], double max[zones] (number/bool only)
+//
+// Opening maps the file and points the table's columns at it, so pages
+// are only read for the columns and zones a query actually touches.
+
+// Writes `t`, computing zone maps if the table has none.
+bool writeColumnFile(const Table& t, const string& path);
+// Maps `path` into `out`. With `columns`, only the columns whose entry is
+// true are attached and checked; the others are left empty. Prints an
+// error and returns false on failure.
+bool openColumnFile(const string& path, Table& out, const vector<bool>* columns = nullptr);
+// True if `path` starts with the column file magic.
+bool isColumnFile(const string& path);
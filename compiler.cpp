@@ -0,0 +1,329 @@
+#include "compiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "diagnostics.h"
+#include "tokenizer.h"
+
+
+static bool compileBoolExpr(const BoolExpr* expr, const SymbolTable& schema,
+                            CompiledQuery& out);
+static bool compilePredicate(const Predicate* pred, const SymbolTable& schema,
+                             PredNode& node);
+
+static string stripQuotes(string_view s) {
+    if (s.size() >= 2 && s.front() == '"' && s.back() == '"') {
+        return string(s.substr(1, s.size()-2));
+    }
+    return string(s);
+}
+
+// Below this size a linear scan of the sorted values beats hashing.
+const size_t SET_HASH_MIN = 8;
+
+bool ValueSet::hasNumber(double v) const {
+    if (!dense.empty()) {
+        double d = v - denseBase;
+        if (!(d >= 0 && d < (double)dense.size())) return false;
+        size_t i = (size_t)d;
+        return (double)i == d && dense[i];
+    }
+    if (numbers.size() < SET_HASH_MIN) {
+        for (double x : numbers) if (x == v) return true;
+        return false;
+    }
+    return numberHash.count(v) != 0;
+}
+
+bool ValueSet::hasString(std::string_view s) const {
+    if (strings.size() < SET_HASH_MIN) {
+        for (const string& x : strings) if (x == s) return true;
+        return false;
+    }
+    return stringHash.count(s) != 0;
+}
+
+std::shared_ptr<ValueSet> makeNumberSet(vector<double> values) {
+    auto set = std::make_shared<ValueSet>();
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    set->numbers = std::move(values);
+    const vector<double>& v = set->numbers;
+    bool whole = !v.empty() && v.back() - v.front() < (double)DENSE_SET_SPAN;
+    for (size_t i = 0; whole && i < v.size(); ++i) whole = v[i] == std::floor(v[i]);
+    if (whole) {
+        set->denseBase = v.front();
+        set->dense.assign((size_t)(v.back() - v.front()) + 1, 0);
+        for (double x : v) set->dense[(size_t)(x - v.front())] = 1;
+    } else if (v.size() >= SET_HASH_MIN) {
+        set->numberHash.insert(set->numbers.begin(), set->numbers.end());
+    }
+    return set;
+}
+
+std::shared_ptr<ValueSet> makeStringSet(vector<string> values) {
+    auto set = std::make_shared<ValueSet>();
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    set->strings = std::move(values);
+    if (set->strings.size() >= SET_HASH_MIN) {
+        for (const string& s : set->strings) set->stringHash.insert(s);
+    }
+    return set;
+}
+
+static PredNode makeNode(OpCode op, uint32_t end) {
+    PredNode n;
+    n.op = op;
+    n.end = end;
+    return n;
+}
+
+static OpCode numberOp(Symbol op) {
+    switch (op) {
+        case EQUALS:   return OP_NUM_EQ;
+        case NOTEQUAL: return OP_NUM_NE;
+        case LT:       return OP_NUM_LT;
+        case LTE:      return OP_NUM_LE;
+        case GT:       return OP_NUM_GT;
+        default:       return OP_NUM_GE;
+    }
+}
+
+bool compileQuery(const Query& q, const SymbolTable& schema, CompiledQuery& out) {
+    out = CompiledQuery();
+
+    // an item listed twice in SELECT is output once, so output names are unique
+    if (q.selectAll) {
+        out.outSchema = schema;
+        for (size_t c = 0; c < schema.fieldCount(); ++c) {
+            out.projection.push_back((int)c);
+        }
+    } else if (q.grouped()) {
+        for (size_t i = 0; i < q.fields.size(); ++i) {
+            const string& f = q.fields[i];
+            AggFunc func = q.aggregates[i];
+            int c = f == "*" ? -1 : schema.getColumn(f);
+            if (c < 0 && !(func == AGG_COUNT && f == "*")) {
+                diagnostics() << "Compile error: unknown field in SELECT list: '" << f << "'\n";
+                return false;
+            }
+            if (out.outSchema.hasField(selectItemName(func, f))) continue;
+            bool keepsType = func == AGG_NONE || func == AGG_MIN || func == AGG_MAX;
+            out.outSchema.addField(selectItemName(func, f),
+                                   keepsType ? schema.getFieldType(f) : FT_NUMBER);
+            out.aggregates.push_back(AggregateColumn{func, c});
+        }
+        for (const auto& g : q.groupBy) {
+            int c = schema.getColumn(g);
+            if (c < 0) {
+                diagnostics() << "Compile error: unknown field in GROUP BY: '" << g << "'\n";
+                return false;
+            }
+            out.groupBy.push_back(c);
+        }
+    } else {
+        for (const auto& f : q.fields) {
+            int c = schema.getColumn(f);
+            if (c < 0) {
+                diagnostics() << "Compile error: unknown field in SELECT list: '" << f << "'\n";
+                return false;
+            }
+            if (out.outSchema.hasField(f)) continue;
+            out.outSchema.addField(f, schema.getFieldType(f));
+            out.projection.push_back(c);
+        }
+    }
+
+    if (!q.orderBy.empty()) {
+        out.orderColumn = schema.getColumn(q.orderBy);
+        if (out.orderColumn < 0) {
+            diagnostics() << "Compile error: unknown field in ORDER BY: '" << q.orderBy << "'\n";
+            return false;
+        }
+        out.descending = q.descending;
+    }
+    if (q.limit >= 0) out.limit = (size_t)q.limit;
+
+    if (q.where) {
+        return compileBoolExpr(q.where, schema, out);
+    }
+    return true;
+}
+
+static bool compileChildren(OpCode op, const ExprList& kids,
+                            const SymbolTable& schema, CompiledQuery& plan) {
+    vector<PredNode>& out = plan.where;
+    size_t at = out.size();
+    out.push_back(makeNode(op, 0));
+    for (const BoolExpr* k : kids) {
+        if (!compileBoolExpr(k, schema, plan)) return false;
+    }
+    out[at].end = (uint32_t)out.size();
+    return true;
+}
+
+static bool compileBoolExpr(const BoolExpr* expr, const SymbolTable& schema,
+                            CompiledQuery& plan) {
+    vector<PredNode>& out = plan.where;
+    switch (expr->kind) {
+    case EXPR_OR:
+        return compileChildren(OP_OR, static_cast<const OrExpr*>(expr)->terms, schema, plan);
+    case EXPR_AND:
+        return compileChildren(OP_AND, static_cast<const AndExpr*>(expr)->factors, schema, plan);
+    case EXPR_PREDICATE: {
+        const Predicate* pred = static_cast<const Predicate*>(expr);
+        PredNode node = makeNode(OP_FALSE, 0);
+        if (!compilePredicate(pred, schema, node)) return false;
+        if (pred->literalKind == PARAM) {
+            bool negate = node.op == OP_BOOL_EQ && pred->op == NOTEQUAL;
+            plan.params.push_back({pred->param, (uint32_t)out.size(), negate});
+        }
+        node.end = (uint32_t)out.size() + 1;
+        out.push_back(node);
+        return true;
+    }
+    case EXPR_PAREN: {
+        const ParenExpr* par = static_cast<const ParenExpr*>(expr);
+        if (!par->inner) {
+            out.push_back(makeNode(OP_FALSE, (uint32_t)out.size() + 1));
+            return true;
+        }
+        return compileBoolExpr(par->inner, schema, plan);
+    }
+    }
+    out.push_back(makeNode(OP_FALSE, (uint32_t)out.size() + 1));
+    return true;
+}
+
+static bool compilePredicate(const Predicate* pred, const SymbolTable& schema,
+                             PredNode& node) {
+    node.column = schema.getColumn(pred->ident);
+    if (node.column < 0) {
+        diagnostics() << "Compile error: unknown field in WHERE: '" << pred->ident << "'\n";
+        return false;
+    }
+
+    switch (schema.getFieldType(pred->ident)) {
+        case FT_NUMBER:
+            node.op = numberOp(pred->op);
+            node.number = std::strtod(string(pred->literalText).c_str(), nullptr);
+            // the optimizer sorts and compares literals, which needs them finite
+            if (!std::isfinite(node.number)) {
+                diagnostics() << "Compile error: number out of range in WHERE: "
+                     << pred->literalText << "\n";
+                return false;
+            }
+            break;
+        case FT_BOOL: {
+            bool lit = pred->literalKind == TRUE_LIT;
+            node.op = OP_BOOL_EQ;
+            node.boolean = (pred->op == NOTEQUAL) ? !lit : lit;
+            break;
+        }
+        case FT_STRING:
+            node.op = pred->op == NOTEQUAL ? OP_STR_NE : OP_STR_EQ;
+            node.str = stripQuotes(pred->literalText);
+            break;
+    }
+    return true;
+}
+
+bool bindParameters(CompiledQuery& plan, const vector<string>& values) {
+    if (values.size() != plan.params.size()) {
+        diagnostics() << "Bind error: query takes " << plan.params.size()
+             << " parameter(s), got " << values.size() << "\n";
+        return false;
+    }
+    for (const ParamSlot& slot : plan.params) {
+        PredNode& node = plan.where[slot.node];
+        const string& v = values[slot.param];
+        switch (node.op) {
+            case OP_BOOL_EQ:
+                if (v != "true" && v != "false") {
+                    diagnostics() << "Bind error: parameter " << slot.param + 1
+                         << " must be true or false, got '" << v << "'\n";
+                    return false;
+                }
+                node.boolean = (v == "true") != slot.negate;
+                break;
+            case OP_STR_EQ:
+            case OP_STR_NE:
+                node.str = v;
+                break;
+            default:
+                // the same text a number literal in the query could have
+                if (!isNumberLiteral(v)) {
+                    diagnostics() << "Bind error: parameter " << slot.param + 1
+                         << " must be a number, got '" << v << "'\n";
+                    return false;
+                }
+                node.number = std::strtod(v.c_str(), nullptr);
+                if (!std::isfinite(node.number)) {
+                    diagnostics() << "Bind error: parameter " << slot.param + 1
+                         << " is out of range: '" << v << "'\n";
+                    return false;
+                }
+                break;
+        }
+    }
+    // the plan is now an ordinary one with no placeholders
+    plan.params.clear();
+    return true;
+}
+
+static string formatLiteral(double v) {
+    char buf[32];
+    snprintf(buf, sizeof buf, "%.15g", v);
+    return buf;
+}
+
+vector<int> referencedColumns(const CompiledQuery& plan) {
+    vector<int> cols = plan.projection;
+    for (const PredNode& n : plan.where) {
+        if (n.column >= 0) cols.push_back(n.column);
+    }
+    for (const AggregateColumn& a : plan.aggregates) {
+        if (a.column >= 0) cols.push_back(a.column);
+    }
+    cols.insert(cols.end(), plan.groupBy.begin(), plan.groupBy.end());
+    if (plan.orderColumn >= 0) cols.push_back(plan.orderColumn);
+    std::sort(cols.begin(), cols.end());
+    cols.erase(std::unique(cols.begin(), cols.end()), cols.end());
+    return cols;
+}
+
+string describeNode(const PredNode& node, const SymbolTable& schema) {
+    string field = node.column >= 0 ? schema.fieldName(node.column) : "?";
+    switch (node.op) {
+        case OP_AND:     return "AND";
+        case OP_OR:      return "OR";
+        case OP_TRUE:    return "TRUE";
+        case OP_FALSE:   return "FALSE";
+        case OP_NUM_EQ:  return field + " = " + formatLiteral(node.number);
+        case OP_NUM_NE:  return field + " != " + formatLiteral(node.number);
+        case OP_NUM_LT:  return field + " < " + formatLiteral(node.number);
+        case OP_NUM_LE:  return field + " <= " + formatLiteral(node.number);
+        case OP_NUM_GT:  return field + " > " + formatLiteral(node.number);
+        case OP_NUM_GE:  return field + " >= " + formatLiteral(node.number);
+        case OP_BOOL_EQ: return field + (node.boolean ? " = true" : " = false");
+        case OP_STR_EQ:
+        case OP_CODE_EQ: return field + " = \"" + node.str + "\"";
+        case OP_STR_NE:
+        case OP_CODE_NE: return field + " != \"" + node.str + "\"";
+        case OP_NUM_IN:
+        case OP_STR_IN:
+        case OP_CODE_IN: {
+            string s = field + " IN (";
+            size_t count = node.op == OP_NUM_IN ? node.set->numbers.size() : node.set->strings.size();
+            for (size_t k = 0; k < count; ++k) {
+                if (k) s += ", ";
+                if (node.op == OP_NUM_IN) s += formatLiteral(node.set->numbers[k]);
+                else s += "\"" + node.set->strings[k] + "\"";
+            }
+            return s + ")";
+        }
+    }
+    return "?";
+}
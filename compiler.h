@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include "parser.h"
+#include "symbol_table.h"
+
+using std::string;
+using std::vector;
+
+// Instruction set for compiled WHERE clauses. Comparisons are
+// specialised by column type and operator when the query is compiled, so
+// evaluation is a switch with no string parsing. Bool != is folded into
+// = against the negated literal. OP_CODE_* are never produced by
+// compileQuery; bindProgram() rewrites string comparisons on
+// dictionary-encoded columns into them for one execution. OP_*_IN are
+// set-membership tests the optimizer makes from ORs of equalities.
+enum OpCode {
+    OP_AND, OP_OR,
+    OP_TRUE, OP_FALSE,
+    OP_NUM_EQ, OP_NUM_NE, OP_NUM_LT, OP_NUM_LE, OP_NUM_GT, OP_NUM_GE,
+    OP_BOOL_EQ,
+    OP_STR_EQ, OP_STR_NE,
+    OP_CODE_EQ, OP_CODE_NE,
+    OP_NUM_IN, OP_STR_IN, OP_CODE_IN
+};
+
+// The values of an OP_*_IN test. Built once by makeNumberSet or
+// makeStringSet and then shared, read-only, by every copy of the program.
+struct ValueSet {
+    vector<double> numbers;     // OP_NUM_IN: sorted, distinct
+    vector<string> strings;     // OP_STR_IN and OP_CODE_IN: sorted, distinct
+    vector<uint8_t> codes;      // OP_CODE_IN: nonzero at each member's dictionary code
+
+    ValueSet() = default;
+    ValueSet(const ValueSet&) = delete;
+    ValueSet& operator=(const ValueSet&) = delete;
+
+    bool hasNumber(double v) const;
+    bool hasString(std::string_view s) const;
+    bool hasCode(uint32_t c) const { return c < codes.size() && codes[c]; }
+
+    // whole numbers spanning at most DENSE_SET_SPAN are looked up in a
+    // table indexed by value - denseBase; other larger sets are hashed,
+    // with string views pointing into `strings`
+    vector<uint8_t> dense;
+    double denseBase = 0;
+    std::unordered_set<double> numberHash;
+    std::unordered_set<std::string_view> stringHash;
+};
+
+const size_t DENSE_SET_SPAN = 64 * 1024;
+
+std::shared_ptr<ValueSet> makeNumberSet(vector<double> values);
+std::shared_ptr<ValueSet> makeStringSet(vector<string> values);
+
+// One node of a compiled WHERE tree. Nodes are stored in preorder and
+// `end` is the index one past the node's subtree, so the children of an
+// AND/OR at i start at i+1 and each sibling begins at the previous
+// sibling's `end`.
+struct PredNode {
+    OpCode op;
+    uint32_t end;
+    int column = -1;        // comparisons: resolved column index
+    double number = 0;      // OP_NUM_*
+    uint8_t boolean = 0;    // OP_BOOL_EQ
+    string str;             // OP_STR_* and OP_CODE_*, quotes already stripped
+    uint32_t code = 0;      // OP_CODE_*: dictionary code of `str`
+    std::shared_ptr<const ValueSet> set;    // OP_*_IN
+};
+
+// A `?` placeholder in a compiled WHERE program: the comparison at
+// where[node] takes its literal from parameter `param` when bound. Bool
+// != is compiled as = and bound to the negated value.
+struct ParamSlot {
+    int param;
+    uint32_t node;
+    bool negate;
+};
+
+const size_t NO_LIMIT = SIZE_MAX;
+
+// One output column of an aggregating query: a GROUP BY field (AGG_NONE)
+// or an aggregate of input column `column`, which is -1 for COUNT(*).
+struct AggregateColumn {
+    AggFunc func;
+    int column;
+};
+
+struct CompiledQuery {
+    vector<PredNode> where;     // empty when the query has no WHERE
+    vector<int> projection;     // input column for each output column
+    SymbolTable outSchema;      // schema of the result table
+    // Aggregating queries only, when `projection` is empty: one entry per
+    // output column, one output row per group of equal GROUP BY values.
+    vector<AggregateColumn> aggregates;
+    vector<int> groupBy;        // GROUP BY input columns
+    vector<ParamSlot> params;   // in placeholder order
+    int orderColumn = -1;       // ORDER BY input column; -1 for input order
+    bool descending = false;
+    size_t limit = NO_LIMIT;    // most rows to return
+};
+
+// Compiles a query that has passed checkQuerySemantics against `schema`.
+// Returns false (after printing why) if a field cannot be resolved or a
+// number literal is too large to be finite.
+bool compileQuery(const Query& q, const SymbolTable& schema, CompiledQuery& out);
+
+// Input columns the query reads, ascending: the projection or aggregated
+// columns, every column the WHERE program compares, and the GROUP BY and
+// ORDER BY columns. No other column is touched.
+vector<int> referencedColumns(const CompiledQuery& plan);
+
+// WHERE text for one node, e.g. `age >= 21` or `status = "vip"`; AND/OR
+// nodes print as the operator alone.
+string describeNode(const PredNode& node, const SymbolTable& schema);
+
+// Fills the placeholder literals of `plan` from `values`, one per `?` in
+// order. Numbers must be written as number literals in a query would be
+// (digits with an optional fraction) and bools as true or false; string
+// values are taken as-is, without quotes. On success plan.params is cleared. Returns
+// false (after printing why) if the count is wrong or a value does not
+// fit its field.
+bool bindParameters(CompiledQuery& plan, const vector<string>& values);
@@ -0,0 +1,103 @@
+#include "continuous.h"
+#include "diagnostics.h"
+
+using namespace std;
+
+ContinuousTable::ContinuousTable(Table initial) : data(std::move(initial)) {}
+
+ContinuousTable::~ContinuousTable() {
+    for (auto& q : queries) endAll(q.second);
+}
+
+int ContinuousTable::addQuery(const CompiledQuery& plan) {
+    if (!plan.params.empty()) {
+        diagnostics() << "Continuous query error: placeholders must be bound before the query is registered" << endl;
+        return -1;
+    }
+    if (plan.orderColumn >= 0 && plan.aggregates.empty()) {
+        diagnostics() << "Continuous query error: ORDER BY needs GROUP BY or an aggregate in a standing query" << endl;
+        return -1;
+    }
+    int id = nextId++;
+    Standing& q = queries[id];
+    q.plan = plan;
+    if (!plan.aggregates.empty()) q.groups = make_unique<HashAggregator>(q.plan, data);
+    return id;
+}
+
+void ContinuousTable::removeQuery(int id) {
+    auto it = queries.find(id);
+    if (it == queries.end()) return;
+    endAll(it->second);
+    queries.erase(it);
+}
+
+bool ContinuousTable::subscribe(int id, ResultSink& sink) {
+    auto it = queries.find(id);
+    if (it == queries.end()) return false;
+    Standing& q = it->second;
+    sink.begin(q.plan.outSchema);
+    if (q.groups && q.refreshed) {
+        Table result = aggregateResult(q.plan, data, *q.groups);
+        if (result.rowCount() && !sink.consume(result)) {
+            sink.end();
+            return true;
+        }
+    }
+    if (!q.groups && q.sent >= q.plan.limit) {
+        sink.end();         // already finished
+        return true;
+    }
+    q.subscribers.push_back(&sink);
+    return true;
+}
+
+void ContinuousTable::append(const Table& batch) {
+    data.append(batch);
+    refresh();
+}
+
+void ContinuousTable::refresh() {
+    for (auto& q : queries) refresh(q.second);
+}
+
+size_t ContinuousTable::highWater(int id) const {
+    auto it = queries.find(id);
+    return it == queries.end() ? 0 : it->second.highWater;
+}
+
+void ContinuousTable::refresh(Standing& q) {
+    size_t end = data.rowCount();
+    if (q.refreshed && q.highWater == end) return;
+    bool first = !q.refreshed;
+    vector<uint32_t> rows;
+    if (q.sent < q.plan.limit) rows = selectRows(q.plan, data, q.highWater);
+    q.highWater = end;
+    q.refreshed = true;
+
+    if (q.groups) {
+        q.groups->add(rows.data(), rows.size());
+        // an ungrouped result has its one row even before anything matches
+        if (!rows.empty() || first) publish(q, aggregateResult(q.plan, data, *q.groups));
+        return;
+    }
+    if (rows.size() > q.plan.limit - q.sent) rows.resize(q.plan.limit - q.sent);
+    q.sent += rows.size();
+    if (!rows.empty()) publish(q, projectRows(q.plan, data, rows));
+    if (q.sent >= q.plan.limit) endAll(q);
+}
+
+void ContinuousTable::publish(Standing& q, const Table& batch) {
+    if (batch.rowCount() == 0) return;
+    size_t kept = 0;
+    for (ResultSink* s : q.subscribers) {
+        if (s->consume(batch)) q.subscribers[kept++] = s;
+        else s->end();
+    }
+    q.subscribers.resize(kept);
+}
+
+void ContinuousTable::endAll(Standing& q) {
+    for (ResultSink* s : q.subscribers) s->end();
+    q.subscribers.clear();
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+#include "aggregate.h"
+#include "compiler.h"
+#include "evaluator.h"
+#include "table.h"
+
+using std::map;
+using std::unique_ptr;
+using std::vector;
+
+// A table that only grows, with standing queries kept up to date as rows
+// are appended. Each query keeps a high-water mark, the number of rows it
+// has evaluated, and a refresh runs it over the rows past that mark only,
+// so refreshing costs about as much as the new rows, whatever the size of
+// the table.
+//
+// Subscribers of a filtering query receive the new matching rows of each
+// refresh, in table order; with LIMIT the query ends once that many rows
+// have been sent. An aggregating query folds new rows into groups it
+// keeps between refreshes, and its subscribers receive the whole updated
+// result after each refresh that changed it. ORDER BY is accepted only on
+// aggregating queries.
+//
+// Not safe to share between threads.
+class ContinuousTable {
+public:
+    explicit ContinuousTable(Table initial);
+    // Ends every remaining subscriber.
+    ~ContinuousTable();
+    ContinuousTable(const ContinuousTable&) = delete;
+    ContinuousTable& operator=(const ContinuousTable&) = delete;
+
+    const Table& table() const { return data; }
+
+    // Registers a standing query compiled against table().schema() and
+    // returns its id, or -1 (after printing why) if it cannot run
+    // incrementally. A new query starts at row 0, so its first refresh
+    // covers the rows already in the table.
+    int addQuery(const CompiledQuery& plan);
+    // Ends the query's subscribers and drops it.
+    void removeQuery(int id);
+    // Sends the results of query `id` to `sink`, which must outlive the
+    // subscription. sink.begin() is called at once, followed by the current
+    // result of an aggregating query that has been refreshed. A sink that
+    // declines a batch is ended and dropped. Returns false if there is no
+    // such query.
+    bool subscribe(int id, ResultSink& sink);
+
+    // Appends the rows of `batch`, which must have the table's layout, and
+    // refreshes every query.
+    void append(const Table& batch);
+    // Runs every query over the rows past its high-water mark.
+    void refresh();
+
+    // Rows query `id` has evaluated; 0 if there is no such query.
+    size_t highWater(int id) const;
+
+private:
+    struct Standing {
+        CompiledQuery plan;
+        size_t highWater = 0;
+        size_t sent = 0;                        // rows sent, for LIMIT
+        bool refreshed = false;
+        unique_ptr<HashAggregator> groups;      // aggregating queries only
+        vector<ResultSink*> subscribers;
+    };
+
+    void refresh(Standing& q);
+    // Sends `batch` to each subscriber of `q`, dropping those that decline.
+    void publish(Standing& q, const Table& batch);
+    static void endAll(Standing& q);
+
+    Table data;
+    map<int, Standing> queries;
+    int nextId = 0;
+};
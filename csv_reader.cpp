@@ -0,0 +1,340 @@
+#include "csv_reader.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include "diagnostics.h"
+#include "mapped_file.h"
+
+
+namespace {
+
+// Walks the records and fields of a mapped file.
+struct CsvCursor {
+    const char* p;
+    const char* end;
+    char delim;
+    size_t line = 1;
+    const string* path;
+
+    bool atEnd() const { return p >= end; }
+
+    void skipBlankLines() {
+        while (p < end && (*p == '\n' || *p == '\r')) {
+            if (*p == '\n') line++;
+            p++;
+        }
+    }
+
+    void error(const string& msg) const {
+        diagnostics() << "Load error: " << *path << ':' << line << ' ' << msg << "\n";
+    }
+
+    // Moves past the rest of the current record and returns the number of
+    // fields in it, without looking at them one by one. Returns 0 without
+    // moving if the rest holds a quote, whose fields must be read in full.
+    size_t skipRest() {
+        const char* nl = (const char*)memchr(p, '\n', end - p);
+        const char* stop = nl ? nl : end;
+        if (memchr(p, '"', stop - p)) return 0;
+        size_t fields = 1 + std::count(p, stop, delim);
+        p = nl ? nl + 1 : end;
+        if (nl) line++;
+        return fields;
+    }
+
+    // Reads one field. `quoted` fields come back without their quotes and
+    // `escaped` says whether they still contain doubled "" pairs. `last` is
+    // set when the field ends its record.
+    bool nextField(string_view& field, bool& escaped, bool& last) {
+        escaped = false;
+        if (p < end && *p == '"') {
+            const char* start = ++p;
+            while (true) {
+                const char* q = (const char*)memchr(p, '"', end - p);
+                if (!q) {
+                    error("unterminated quoted field");
+                    return false;
+                }
+                for (const char* c = p; c < q; ++c) if (*c == '\n') line++;
+                if (q + 1 < end && q[1] == '"') {
+                    escaped = true;
+                    p = q + 2;
+                    continue;
+                }
+                field = string_view(start, q - start);
+                p = q + 1;
+                break;
+            }
+            if (p < end && *p == '\r') p++;
+            if (p < end && *p != delim && *p != '\n') {
+                error("unexpected character after quoted field");
+                return false;
+            }
+        } else {
+            const char* start = p;
+            while (p < end && *p != delim && *p != '\n') p++;
+            const char* stop = p;
+            if (stop > start && stop[-1] == '\r') stop--;
+            field = string_view(start, stop - start);
+        }
+
+        if (p < end && *p == delim) {
+            p++;
+            last = false;
+        } else {
+            if (p < end) { p++; line++; }
+            last = true;
+        }
+        return true;
+    }
+};
+
+string_view trim(string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+// An empty field is not a number (nor a bool, below): a file with missing
+// values in such a column is rejected rather than loaded with zeros.
+bool parseDouble(string_view s, double& out) {
+    s = trim(s);
+    if (s.empty()) return false;
+    if (s.front() == '+') s.remove_prefix(1);
+    auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+    return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+bool equalsNoCase(string_view a, const char* b) {
+    size_t n = strlen(b);
+    if (a.size() != n) return false;
+    for (size_t i = 0; i < n; ++i) {
+        if (tolower((unsigned char)a[i]) != b[i]) return false;
+    }
+    return true;
+}
+
+bool parseBool(string_view s, uint8_t& out) {
+    s = trim(s);
+    if (s == "0" || equalsNoCase(s, "false")) { out = 0; return true; }
+    if (s == "1" || equalsNoCase(s, "true")) { out = 1; return true; }
+    return false;
+}
+
+void appendStringField(Column& col, string_view field, bool escaped) {
+    if (!escaped) {
+        col.appendString(field);
+        return;
+    }
+    // collapse "" to " while copying into the blob
+    for (size_t i = 0; i < field.size(); ++i) {
+        col.blob.push_back(field[i]);
+        if (field[i] == '"' && i + 1 < field.size() && field[i+1] == '"') i++;
+    }
+    col.offsets.push_back(col.blob.size());
+}
+
+// Reads the header record into `names`.
+bool readHeader(CsvCursor& cur, vector<string>& names) {
+    cur.skipBlankLines();
+    if (cur.atEnd()) {
+        cur.error("missing header row");
+        return false;
+    }
+    bool last = false, escaped;
+    while (!last) {
+        string_view f;
+        if (!cur.nextField(f, escaped, last)) return false;
+        names.push_back(string(trim(f)));
+    }
+    return true;
+}
+
+// Guesses a type per column from up to `limit` records, without storing
+// anything. The cursor is copied so the records are read again later.
+bool inferTypes(CsvCursor cur, size_t columns, size_t limit, vector<FieldType>& types) {
+    vector<bool> canNumber(columns, true), canBool(columns, true), seen(columns, false);
+    for (size_t r = 0; r < limit; ++r) {
+        cur.skipBlankLines();
+        if (cur.atEnd()) break;
+        bool last = false, escaped;
+        for (size_t c = 0; !last; ++c) {
+            string_view f;
+            if (!cur.nextField(f, escaped, last)) return false;
+            if (c >= columns || trim(f).empty()) continue;
+            seen[c] = true;
+            double d;
+            uint8_t b;
+            if (canNumber[c] && !parseDouble(f, d)) canNumber[c] = false;
+            if (canBool[c] && (!parseBool(f, b) || f == "0" || f == "1")) canBool[c] = false;
+        }
+    }
+    types.resize(columns);
+    for (size_t c = 0; c < columns; ++c) {
+        if (!seen[c]) types[c] = FT_STRING;
+        else if (canBool[c]) types[c] = FT_BOOL;
+        else if (canNumber[c]) types[c] = FT_NUMBER;
+        else types[c] = FT_STRING;
+    }
+    return true;
+}
+
+// Rough row count for the rest of the file, from the first 64KB.
+size_t estimateRows(const CsvCursor& cur) {
+    size_t sample = std::min<size_t>(cur.end - cur.p, 64 * 1024);
+    size_t lines = 0;
+    for (const char* c = cur.p; c < cur.p + sample; ++c) if (*c == '\n') lines++;
+    if (lines == 0) return 1;
+    return (size_t)((double)(cur.end - cur.p) / sample * lines) + 1;
+}
+
+char defaultDelimiter(const string& path) {
+    auto endsWith = [&](const char* ext) {
+        size_t n = strlen(ext);
+        return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+    };
+    return (endsWith(".tsv") || endsWith(".tab")) ? '\t' : ',';
+}
+
+}
+
+bool loadDelimitedFile(const string& path, const CsvOptions& opts,
+                       SymbolTable& schema, Table& out, const vector<bool>* columns) {
+    MappedFile file;
+    if (!file.open(path, true)) return false;
+
+    CsvCursor cur{file.data(), file.data() + file.size(),
+                  opts.delimiter ? opts.delimiter : defaultDelimiter(path), 1, &path};
+
+    vector<string> names;
+    if (opts.header && !readHeader(cur, names)) return false;
+
+    if (opts.inferSchema) {
+        if (!opts.header) {
+            diagnostics() << "Load error: " << path << ": schema inference needs a header row\n";
+            return false;
+        }
+        for (const auto& n : names) {
+            if (n.empty()) {
+                diagnostics() << "Load error: " << path << ": empty column name in header\n";
+                return false;
+            }
+        }
+        vector<FieldType> types;
+        if (!inferTypes(cur, names.size(), opts.inferRows, types)) return false;
+        schema = SymbolTable();
+        for (size_t c = 0; c < names.size(); ++c) schema.addField(names[c], types[c]);
+    }
+
+    // file column -> table column, -1 for columns the schema does not use
+    vector<int> target;
+    if (opts.header) {
+        vector<bool> found(schema.fieldCount(), false);
+        for (const auto& n : names) {
+            int c = schema.getColumn(n);
+            if (c >= 0 && found[c]) {
+                diagnostics() << "Load error: " << path << ": duplicate column '" << n
+                     << "' in header\n";
+                return false;
+            }
+            target.push_back(c);
+            if (c >= 0) found[c] = true;
+        }
+        for (size_t c = 0; c < found.size(); ++c) {
+            if (!found[c]) {
+                diagnostics() << "Load error: " << path << ": no column for field '"
+                     << schema.fieldName(c) << "'\n";
+                return false;
+            }
+        }
+    } else {
+        for (size_t c = 0; c < schema.fieldCount(); ++c) target.push_back((int)c);
+    }
+
+    auto wanted = [&](int c) {
+        return !columns || (c < (int)columns->size() && (*columns)[c]);
+    };
+    bool any = false;
+    size_t lastWanted = 0;      // file columns past this one are not loaded
+    for (size_t c = 0; c < target.size(); ++c) {
+        if (target[c] >= 0 && !wanted(target[c])) target[c] = -1;
+        if (target[c] >= 0) lastWanted = c;
+        any = any || target[c] >= 0;
+    }
+
+    out = Table(schema);
+    // with no field wanted, each record is skipped whole and only counted
+    size_t skipFrom = any ? lastWanted + 1 : 0;
+    size_t expectRows = any ? estimateRows(cur) : 0;
+    for (size_t c = 0; c < out.columnCount(); ++c) {
+        if (!any || !wanted((int)c)) continue;
+        Column& col = out.column(c);
+        switch (col.type) {
+            case FT_NUMBER: col.numbers.reserve(expectRows); break;
+            case FT_BOOL:   col.bools.reserve(expectRows); break;
+            case FT_STRING: col.offsets.reserve(expectRows + 1); break;
+        }
+    }
+
+    while (true) {
+        cur.skipBlankLines();
+        if (cur.atEnd()) break;
+        size_t recordLine = cur.line;
+        bool last = false, escaped;
+        size_t c = 0;
+        for (; !last; ++c) {
+            if (c == skipFrom) {
+                size_t rest = cur.skipRest();
+                if (rest) {
+                    c += rest;
+                    break;
+                }
+            }
+            string_view f;
+            if (!cur.nextField(f, escaped, last)) return false;
+            if (c >= target.size()) {
+                cur.line = recordLine;
+                cur.error("too many fields");
+                return false;
+            }
+            if (target[c] < 0) continue;
+            Column& col = out.column(target[c]);
+            switch (col.type) {
+                case FT_NUMBER: {
+                    double d;
+                    if (!parseDouble(f, d)) {
+                        cur.line = recordLine;
+                        if (trim(f).empty()) cur.error("missing number for field '" + col.name + "'");
+                        else cur.error("bad number for field '" + col.name + "': '" + string(f) + "'");
+                        return false;
+                    }
+                    col.numbers.push_back(d);
+                    break;
+                }
+                case FT_BOOL: {
+                    uint8_t b;
+                    if (!parseBool(f, b)) {
+                        cur.line = recordLine;
+                        if (trim(f).empty()) cur.error("missing bool for field '" + col.name + "'");
+                        else cur.error("bad bool for field '" + col.name + "': '" + string(f) + "'");
+                        return false;
+                    }
+                    col.bools.push_back(b);
+                    break;
+                }
+                case FT_STRING:
+                    appendStringField(col, f, escaped);
+                    break;
+            }
+        }
+        if (c != target.size()) {
+            cur.line = recordLine;
+            cur.error("expected " + std::to_string(target.size()) + " fields, found " +
+                      std::to_string(c));
+            return false;
+        }
+        out.finishRow();
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include "symbol_table.h"
+#include "table.h"
+
+using std::string;
+
+struct CsvOptions {
+    char delimiter = 0;         // 0: '\t' for .tsv/.tab files, ',' otherwise
+    bool header = true;         // first record names the columns
+    bool inferSchema = false;   // build the schema from the header and sampled rows
+    size_t inferRows = 1000;    // rows sampled when inferring types
+};
+
+// Loads a delimited text file straight into typed columns. The file is
+// memory-mapped and fields are parsed in place; only escaped quotes in
+// quoted strings are rewritten, directly into the column blob.
+//
+// Without inferSchema, `schema` gives the table layout and, if the file
+// has a header, file columns are matched to fields by name (unknown file
+// columns are skipped). With inferSchema, `schema` is replaced by fields
+// named from the header and typed as number, bool or string from the
+// first inferRows records. Empty fields are accepted in string columns
+// only, and a header naming one field twice is rejected. Prints an error
+// and returns false on failure.
+//
+// With `columns`, only the fields whose entry is true are parsed; the
+// others are skipped over and left empty, and their values are not
+// checked. If no field is wanted the records are only counted, and the
+// table has the schema and the row count but empty columns.
+bool loadDelimitedFile(const string& path, const CsvOptions& opts,
+                       SymbolTable& schema, Table& out,
+                       const vector<bool>* columns = nullptr);
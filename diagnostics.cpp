@@ -0,0 +1,16 @@
+#include "diagnostics.h"
+#include <iostream>
+
+static thread_local std::ostream* current = nullptr;
+
+std::ostream& diagnostics() {
+    return current ? *current : std::cerr;
+}
+
+DiagnosticsCapture::DiagnosticsCapture() : saved(current) {
+    current = &buf;
+}
+
+DiagnosticsCapture::~DiagnosticsCapture() {
+    current = saved;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <ostream>
+#include <sstream>
+#include <string>
+
+using std::string;
+
+// Where the library writes error messages: std::cerr, unless the calling
+// thread is inside a DiagnosticsCapture.
+std::ostream& diagnostics();
+
+// Collects the messages the current thread writes to diagnostics() while
+// it exists, instead of printing them. Captures may nest.
+class DiagnosticsCapture {
+public:
+    DiagnosticsCapture();
+    ~DiagnosticsCapture();
+    DiagnosticsCapture(const DiagnosticsCapture&) = delete;
+    DiagnosticsCapture& operator=(const DiagnosticsCapture&) = delete;
+
+    string text() const { return buf.str(); }
+
+private:
+    std::ostringstream buf;
+    std::ostream* saved;
+};
@@ -1,125 +1,1166 @@
 #include "evaluator.h"
-#include <cstdlib>
-#include <cctype>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "aggregate.h"
+#include "kernels.h"
+#include "optimizer.h"
 
-static bool evalBoolExpr(const BoolExpr* expr, const Row& row);
-static bool evalOrExpr(const OrExpr* expr, const Row& row);
-static bool evalAndExpr(const AndExpr* expr, const Row& row);
-static bool evalPredicate(const Predicate* expr, const Row& row);
-static bool evalParen(const ParenExpr* expr, const Row& row);
+static bool evalNode(const vector<PredNode>& prog, uint32_t i,
+                     const Table& t, size_t row) {
+    const PredNode& n = prog[i];
+    switch (n.op) {
+        case OP_AND:
+            for (uint32_t c = i + 1; c < n.end; c = prog[c].end) {
+                if (!evalNode(prog, c, t, row)) return false;
+            }
+            return true;
+        case OP_OR:
+            for (uint32_t c = i + 1; c < n.end; c = prog[c].end) {
+                if (evalNode(prog, c, t, row)) return true;
+            }
+            return false;
+        case OP_TRUE:   return true;
+        case OP_FALSE:  return false;
+        case OP_NUM_EQ: return t.column(n.column).numbers[row] == n.number;
+        case OP_NUM_NE: return t.column(n.column).numbers[row] != n.number;
+        case OP_NUM_LT: return t.column(n.column).numbers[row] <  n.number;
+        case OP_NUM_LE: return t.column(n.column).numbers[row] <= n.number;
+        case OP_NUM_GT: return t.column(n.column).numbers[row] >  n.number;
+        case OP_NUM_GE: return t.column(n.column).numbers[row] >= n.number;
+        case OP_BOOL_EQ: return t.column(n.column).bools[row] == n.boolean;
+        case OP_STR_EQ: return t.column(n.column).stringAt(row) == n.str;
+        case OP_STR_NE: return t.column(n.column).stringAt(row) != n.str;
+        case OP_CODE_EQ: return t.column(n.column).codes[row] == n.code;
+        case OP_CODE_NE: return t.column(n.column).codes[row] != n.code;
+        case OP_NUM_IN: return n.set->hasNumber(t.column(n.column).numbers[row]);
+        case OP_STR_IN: return n.set->hasString(t.column(n.column).stringAt(row));
+        case OP_CODE_IN: return n.set->hasCode(t.column(n.column).codes[row]);
+    }
+    return false;
+}
 
-static bool parseNumber(const string& s, double& out) {
-    char* endptr = nullptr;
-    out = std::strtod(s.c_str(), &endptr);
-    return endptr != s.c_str() && *endptr == '\0';
+static bool isComparison(OpCode op) {
+    return op >= OP_NUM_EQ;
 }
 
-static int compareLiterals(const string& a, const string& b) {
-    double da, db;
-    bool na = parseNumber(a, da);
-    bool nb = parseNumber(b, db);
+// Row-list kernels, for comparisons tested on a few rows at a time: each
+// keeps the ids in rows[0, n) whose value passes, in order, and returns
+// how many remain. There is one instantiation per (column type, op), so
+// the loops carry no switch; rowKernels[op] picks one once per node.
+typedef size_t (*RowKernel)(const PredNode& node, const Column& col, uint32_t* rows, size_t n);
 
-    if (na && nb) {
-        if (da < db) return -1;
-        if (da > db) return 1;
-        return 0;
+// Writes every id and advances past the ones that pass, so there is no
+// branch on the outcome.
+template <typename Test>
+static size_t keepRows(uint32_t* rows, size_t n, Test test) {
+    size_t kept = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t r = rows[i];
+        rows[kept] = r;
+        kept += test(r);
     }
-    if (a < b) return -1;
-    if (a > b) return 1;
-    return 0;
+    return kept;
+}
+
+template <class Cmp>
+static size_t keepNumbers(const PredNode& node, const Column& col, uint32_t* rows, size_t n) {
+    const double* v = col.numbers.data();
+    double lit = node.number;
+    Cmp cmp;
+    return keepRows(rows, n, [&](uint32_t r) { return cmp(v[r], lit); });
+}
+
+static size_t keepBools(const PredNode& node, const Column& col, uint32_t* rows, size_t n) {
+    const uint8_t* v = col.bools.data();
+    uint8_t lit = node.boolean;
+    return keepRows(rows, n, [&](uint32_t r) { return v[r] == lit; });
+}
+
+template <bool Equal>
+static size_t keepStrings(const PredNode& node, const Column& col, uint32_t* rows, size_t n) {
+    std::string_view lit = node.str;
+    return keepRows(rows, n, [&](uint32_t r) { return (col.stringAt(r) == lit) == Equal; });
+}
+
+template <bool Equal>
+static size_t keepCodes(const PredNode& node, const Column& col, uint32_t* rows, size_t n) {
+    const uint32_t* v = col.codes.data();
+    uint32_t lit = node.code;
+    return keepRows(rows, n, [&](uint32_t r) { return (v[r] == lit) == Equal; });
 }
 
-static string normalizeLiteral(const Predicate* p) {
-    if (p->literalKind == TRUE_LIT)  return "true";
-    if (p->literalKind == FALSE_LIT) return "false";
-    if (p->literalKind == STRING) {
-        if (!p->literalText.empty() &&
-            p->literalText.front() == '"' &&
-            p->literalText.back() == '"') {
-            return p->literalText.substr(1, p->literalText.size()-2);
+static size_t keepNumberSet(const PredNode& node, const Column& col, uint32_t* rows, size_t n) {
+    const double* v = col.numbers.data();
+    return keepRows(rows, n, [&](uint32_t r) { return node.set->hasNumber(v[r]); });
+}
+
+static size_t keepStringSet(const PredNode& node, const Column& col, uint32_t* rows, size_t n) {
+    return keepRows(rows, n, [&](uint32_t r) { return node.set->hasString(col.stringAt(r)); });
+}
+
+static size_t keepCodeSet(const PredNode& node, const Column& col, uint32_t* rows, size_t n) {
+    const uint32_t* v = col.codes.data();
+    return keepRows(rows, n, [&](uint32_t r) { return node.set->hasCode(v[r]); });
+}
+
+// Indexed by OpCode; null for the ones that are not comparisons.
+static const RowKernel rowKernels[] = {
+    nullptr, nullptr,
+    nullptr, nullptr,
+    keepNumbers<std::equal_to<double>>, keepNumbers<std::not_equal_to<double>>,
+    keepNumbers<std::less<double>>, keepNumbers<std::less_equal<double>>,
+    keepNumbers<std::greater<double>>, keepNumbers<std::greater_equal<double>>,
+    keepBools,
+    keepStrings<true>, keepStrings<false>,
+    keepCodes<true>, keepCodes<false>,
+    keepNumberSet, keepStringSet, keepCodeSet,
+};
+static_assert(sizeof rowKernels / sizeof rowKernels[0] == OP_CODE_IN + 1,
+              "one entry per OpCode");
+
+static size_t countSet(const uint64_t* bits, size_t words) {
+    size_t n = 0;
+    for (size_t w = 0; w < words; ++w) n += __builtin_popcountll(bits[w]);
+    return n;
+}
+
+// Blocks between reorderings, and one block in TIME_SAMPLE is timed.
+const size_t REORDER_BLOCKS = 32;
+const size_t TIME_SAMPLE = 8;
+// Once an AND keeps (or an OR has yet to accept) at most this many rows
+// of a block, later comparisons are tested on those rows alone.
+const size_t SPARSE_ROWS = BLOCK_ROWS / 16;
+
+// Per-scan statistics for each node of a bound program, and the order
+// they give the children of each AND/OR. `window` counters are halved at
+// every reordering so the order follows the data as the scan moves on;
+// `total` counters are kept for reporting. One per thread.
+struct AdaptiveOrder {
+    struct Counters {
+        double rows = 0, passed = 0, nanos = 0, timedRows = 0;
+    };
+    vector<vector<uint32_t>> children;  // AND/OR nodes: child starts in evaluation order
+    vector<Counters> window, total;
+    size_t blocks = 0;
+    bool timing = true;                 // whether the current block is timed
+
+    explicit AdaptiveOrder(const vector<PredNode>& prog)
+        : children(prog.size()), window(prog.size()), total(prog.size()) {
+        for (uint32_t i = 0; i < prog.size(); ++i) {
+            if (prog[i].op != OP_AND && prog[i].op != OP_OR) continue;
+            for (uint32_t c = i + 1; c < prog[i].end; c = prog[c].end) children[i].push_back(c);
+        }
+    }
+
+    void count(uint32_t i, size_t rows, size_t passed, double nanos) {
+        for (Counters* k : {&window[i], &total[i]}) {
+            k->rows += rows;
+            k->passed += passed;
+            if (timing) {
+                k->nanos += nanos;
+                k->timedRows += rows;
+            }
         }
     }
-    return p->literalText;
+
+    // Called after each block of the scan.
+    void nextBlock(const vector<PredNode>& prog) {
+        ++blocks;
+        timing = blocks % TIME_SAMPLE == 0;
+        if (blocks % REORDER_BLOCKS) return;
+        for (uint32_t i = 0; i < prog.size(); ++i) {
+            if (children[i].size() > 1) reorder(prog[i].op == OP_AND, children[i]);
+        }
+        for (Counters& k : window) k = {k.rows / 2, k.passed / 2, k.nanos / 2, k.timedRows / 2};
+    }
+
+    // AND runs the factor removing the most rows per unit of cost first,
+    // OR the term accepting the most; children not yet measured stay put.
+    void reorder(bool isAnd, vector<uint32_t>& kids) {
+        for (uint32_t c : kids) {
+            if (window[c].timedRows == 0 || window[c].rows == 0) return;
+        }
+        auto rank = [&](uint32_t c) {
+            double cost = window[c].nanos / window[c].timedRows;
+            double pass = window[c].passed / window[c].rows;
+            return cost / std::max(isAnd ? 1 - pass : pass, 1e-6);
+        };
+        std::stable_sort(kids.begin(), kids.end(),
+                         [&](uint32_t a, uint32_t b) { return rank(a) < rank(b); });
+    }
+};
+
+static void evalBlock(const vector<PredNode>& prog, uint32_t i, const Table& t,
+                      size_t begin, size_t n, uint64_t* out, AdaptiveOrder* ad);
+
+// evalBlock, counting the node's pass rate and (on sampled blocks) its
+// cost into `ad` when adaptive ordering is on.
+static void evalCounted(const vector<PredNode>& prog, uint32_t i, const Table& t,
+                        size_t begin, size_t n, uint64_t* out, AdaptiveOrder* ad) {
+    if (!ad) {
+        evalBlock(prog, i, t, begin, n, out, nullptr);
+        return;
+    }
+    if (!ad->timing) {
+        evalBlock(prog, i, t, begin, n, out, ad);
+        ad->count(i, n, countSet(out, bitmapWords(n)), 0);
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    evalBlock(prog, i, t, begin, n, out, ad);
+    double nanos = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+    ad->count(i, n, countSet(out, bitmapWords(n)), nanos);
 }
 
-static bool evalBoolExpr(const BoolExpr* expr, const Row& row) {
-    if (auto orExpr = dynamic_cast<const OrExpr*>(expr)) {
-        return evalOrExpr(orExpr, row);
-    } else if (auto andExpr = dynamic_cast<const AndExpr*>(expr)) {
-        return evalAndExpr(andExpr, row);
-    } else if (auto pred = dynamic_cast<const Predicate*>(expr)) {
-        return evalPredicate(pred, row);
-    } else if (auto par = dynamic_cast<const ParenExpr*>(expr)) {
-        return evalParen(par, row);
+// Tests comparison c only on the `live` rows of the block an AND still
+// keeps, or an OR has yet to accept, updating `out` in place.
+static void refineRows(const vector<PredNode>& prog, uint32_t c, const Table& t,
+                       size_t begin, size_t n, uint64_t* out, bool isAnd, size_t live,
+                       AdaptiveOrder* ad) {
+    bool timed = ad && ad->timing;
+    auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    uint64_t full[BLOCK_WORDS];
+    fillBitmap(n, full);
+    uint32_t rows[BLOCK_ROWS];
+    size_t count = 0;
+    for (size_t w = 0; w < bitmapWords(n); ++w) {
+        uint64_t cand = isAnd ? out[w] : ~out[w] & full[w];
+        while (cand) {
+            rows[count++] = (uint32_t)(begin + w * 64 + __builtin_ctzll(cand));
+            cand &= cand - 1;
+        }
+    }
+    const PredNode& node = prog[c];
+    size_t passed = rowKernels[node.op](node, t.column(node.column), rows, count);
+    if (isAnd) {
+        for (size_t w = 0; w < bitmapWords(n); ++w) out[w] = 0;
+    }
+    for (size_t k = 0; k < passed; ++k) {
+        size_t j = rows[k] - begin;
+        out[j / 64] |= 1ULL << (j % 64);
+    }
+    if (ad) {
+        double nanos = timed ? std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count() : 0;
+        ad->count(c, live, passed, nanos);
     }
-    return false;
 }
 
-static bool evalOrExpr(const OrExpr* expr, const Row& row) {
-    for (auto& term : expr->terms) {
-        if (evalBoolExpr(term.get(), row)) return true;
+// Evaluates node i for rows [begin, begin+n) of t into a selection bitmap.
+// AND/OR combine their children's results, in the order `ad` has settled
+// on if given, and stop early once the result can no longer change for
+// any row in the block.
+static void evalBlock(const vector<PredNode>& prog, uint32_t i, const Table& t,
+                      size_t begin, size_t n, uint64_t* out, AdaptiveOrder* ad) {
+    const PredNode& node = prog[i];
+    size_t words = bitmapWords(n);
+    switch (node.op) {
+        case OP_AND:
+        case OP_OR: {
+            bool isAnd = node.op == OP_AND;
+            uint64_t tmp[BLOCK_WORDS];
+            const vector<uint32_t>* order = ad ? &ad->children[i] : nullptr;
+            uint32_t c = order ? (*order)[0] : i + 1;
+            evalCounted(prog, c, t, begin, n, out, ad);
+            for (size_t k = 1; ; ++k) {
+                c = order ? (k < order->size() ? (*order)[k] : node.end) : prog[c].end;
+                if (c >= node.end) break;
+                size_t set = countSet(out, words);
+                size_t live = isAnd ? set : n - set;
+                if (live == 0) break;
+                if (live <= SPARSE_ROWS && isComparison(prog[c].op)) {
+                    refineRows(prog, c, t, begin, n, out, isAnd, live, ad);
+                    continue;
+                }
+                evalCounted(prog, c, t, begin, n, tmp, ad);
+                for (size_t w = 0; w < words; ++w) {
+                    out[w] = isAnd ? (out[w] & tmp[w]) : (out[w] | tmp[w]);
+                }
+            }
+            return;
+        }
+        case OP_TRUE:
+            fillBitmap(n, out);
+            return;
+        case OP_FALSE:
+            for (size_t w = 0; w < words; ++w) out[w] = 0;
+            return;
+        case OP_NUM_EQ: case OP_NUM_NE: case OP_NUM_LT:
+        case OP_NUM_LE: case OP_NUM_GT: case OP_NUM_GE:
+            compareNumbers(node.op, t.column(node.column).numbers.data() + begin,
+                           n, node.number, out);
+            return;
+        case OP_BOOL_EQ:
+            equalBytes(t.column(node.column).bools.data() + begin, n, node.boolean, out);
+            return;
+        case OP_STR_EQ:
+        case OP_STR_NE: {
+            const Column& col = t.column(node.column);
+            compareStrings(node.op == OP_STR_EQ, col.offsets.data() + begin,
+                           col.blob.data(), n, node.str, out);
+            return;
+        }
+        case OP_CODE_EQ:
+        case OP_CODE_NE:
+            compareCodes(node.op == OP_CODE_EQ, t.column(node.column).codes.data() + begin,
+                         n, node.code, out);
+            return;
+        case OP_NUM_IN:
+            memberNumbers(t.column(node.column).numbers.data() + begin, n, *node.set, out);
+            return;
+        case OP_STR_IN: {
+            const Column& col = t.column(node.column);
+            memberStrings(col.offsets.data() + begin, col.blob.data(), n, *node.set, out);
+            return;
+        }
+        case OP_CODE_IN:
+            memberCodes(t.column(node.column).codes.data() + begin, n, *node.set, out);
+            return;
     }
-    return false;
 }
 
-static bool evalAndExpr(const AndExpr* expr, const Row& row) {
-    for (auto& f : expr->factors) {
-        if (!evalBoolExpr(f.get(), row)) return false;
+// False when zone z of t provably has no row satisfying node i, judged
+// from the zone min/max alone. String comparisons are never ruled out.
+static bool zoneMayMatch(const vector<PredNode>& prog, uint32_t i,
+                         const Table& t, size_t z) {
+    const PredNode& n = prog[i];
+    switch (n.op) {
+        case OP_AND:
+            for (uint32_t c = i + 1; c < n.end; c = prog[c].end) {
+                if (!zoneMayMatch(prog, c, t, z)) return false;
+            }
+            return true;
+        case OP_OR:
+            for (uint32_t c = i + 1; c < n.end; c = prog[c].end) {
+                if (zoneMayMatch(prog, c, t, z)) return true;
+            }
+            return false;
+        case OP_TRUE:  return true;
+        case OP_FALSE: return false;
+        case OP_STR_EQ: case OP_STR_NE:
+        case OP_CODE_EQ: case OP_CODE_NE:
+        case OP_STR_IN: case OP_CODE_IN:
+            return true;
+        default: break;
+    }
+
+    const ZoneMap& zm = t.column(n.column).zones;
+    if (z >= zm.min.size()) return true;
+    double lo = zm.min[z], hi = zm.max[z];
+    double lit = n.op == OP_BOOL_EQ ? n.boolean : n.number;
+    switch (n.op) {
+        case OP_NUM_EQ:
+        case OP_BOOL_EQ: return lo <= lit && lit <= hi;
+        case OP_NUM_NE:  return !(lo == lit && hi == lit);
+        case OP_NUM_LT:  return lo <  lit;
+        case OP_NUM_LE:  return lo <= lit;
+        case OP_NUM_GT:  return hi >  lit;
+        case OP_NUM_GE:  return hi >= lit;
+        case OP_NUM_IN: {
+            // the smallest member at or above the zone minimum
+            const vector<double>& v = n.set->numbers;
+            auto it = std::lower_bound(v.begin(), v.end(), lo);
+            return it != v.end() && *it <= hi;
+        }
+        default:         return true;
     }
-    return true;
 }
 
-static bool evalParen(const ParenExpr* expr, const Row& row) {
-    if (!expr->inner) return false;
-    return evalBoolExpr(expr->inner.get(), row);
+// Appends node i of `in`, bound to `t`, to `out`. Returns the constant
+// the node folded to: 1 true, 0 false, -1 not constant.
+static int bindNode(const vector<PredNode>& in, uint32_t i, const Table& t,
+                    vector<PredNode>& out) {
+    const PredNode& n = in[i];
+    uint32_t at = (uint32_t)out.size();
+    out.push_back(n);
+
+    if (n.op == OP_AND || n.op == OP_OR) {
+        // an AND child that is false (OR child true) decides the node;
+        // true AND children (false OR children) are dropped
+        int decides = n.op == OP_AND ? 0 : 1;
+        int kept = 0;
+        for (uint32_t c = i + 1; c < n.end; c = in[c].end) {
+            uint32_t childAt = (uint32_t)out.size();
+            int k = bindNode(in, c, t, out);
+            if (k == decides) {
+                out.resize(at + 1);
+                out[at] = in[i];
+                out[at].op = decides ? OP_TRUE : OP_FALSE;
+                out[at].end = at + 1;
+                return decides;
+            }
+            if (k >= 0) out.resize(childAt);
+            else kept++;
+        }
+        if (kept == 0) {
+            out[at].op = decides ? OP_FALSE : OP_TRUE;
+            out[at].end = at + 1;
+            return !decides;
+        }
+        if (kept == 1) {
+            // hoist the only child over its parent
+            out.erase(out.begin() + at);
+            for (size_t j = at; j < out.size(); ++j) out[j].end--;
+            return -1;
+        }
+        out[at].end = (uint32_t)out.size();
+        return -1;
+    }
+
+    out[at].end = at + 1;
+    if (n.op == OP_TRUE) return 1;
+    if (n.op == OP_FALSE) return 0;
+    if ((n.op == OP_STR_EQ || n.op == OP_STR_NE) && t.column(n.column).encoded) {
+        bool eq = n.op == OP_STR_EQ;
+        int64_t code = t.column(n.column).findCode(n.str);
+        if (code < 0) {
+            // not in the dictionary: no row can be equal
+            out[at].op = eq ? OP_FALSE : OP_TRUE;
+            return eq ? 0 : 1;
+        }
+        out[at].op = eq ? OP_CODE_EQ : OP_CODE_NE;
+        out[at].code = (uint32_t)code;
+    }
+    if (n.op == OP_STR_IN && t.column(n.column).encoded) {
+        // members missing from the dictionary can never match
+        const Column& col = t.column(n.column);
+        vector<string> present;
+        vector<uint8_t> codes(col.dict.size(), 0);
+        for (const string& s : n.set->strings) {
+            int64_t code = col.findCode(s);
+            if (code < 0) continue;
+            present.push_back(s);
+            codes[code] = 1;
+        }
+        if (present.empty()) {
+            out[at].op = OP_FALSE;
+            return 0;
+        }
+        auto set = makeStringSet(std::move(present));
+        set->codes = std::move(codes);
+        out[at].op = OP_CODE_IN;
+        out[at].set = std::move(set);
+    }
+    return -1;
 }
 
-static bool evalPredicate(const Predicate* expr, const Row& row) { 
-    auto it = row.find(expr->ident);
-    if (it == row.end()) {
-        return false;
+vector<PredNode> bindProgram(const vector<PredNode>& where, const Table& input) {
+    vector<PredNode> out;
+    if (where.empty()) return out;
+    out.reserve(where.size());
+    // a WHERE that folds to true is the same as no WHERE
+    if (bindNode(where, 0, input, out) == 1) out.clear();
+    return out;
+}
+
+bool matchesRow(const CompiledQuery& plan, const Table& input, size_t row) {
+    return plan.where.empty() || evalNode(plan.where, 0, input, row);
+}
+
+AccessPath chooseAccessPath(const vector<PredNode>& prog, const Table& input) {
+    AccessPath best;
+    if (prog.empty() || input.indexes().empty()) return best;
+
+    vector<uint32_t> candidates;
+    const PredNode& root = prog[0];
+    if (root.op == OP_AND) {
+        for (uint32_t c = 1; c < root.end; c = prog[c].end) candidates.push_back(c);
+    } else {
+        candidates.push_back(0);
+    }
+
+    size_t limit = input.rowCount() / INDEX_MAX_FRACTION;
+    for (uint32_t c : candidates) {
+        const PredNode& n = prog[c];
+        if (!isComparison(n.op)) continue;
+        for (const auto& idx : input.indexes()) {
+            if (!idx->canAnswer(n)) continue;
+            size_t est = idx->estimate(n);
+            if (est <= limit && (!best.index || est < best.estimatedRows)) {
+                best.index = idx.get();
+                best.node = (int)c;
+                best.estimatedRows = est;
+            }
+        }
+    }
+    return best;
+}
+
+// Row ids from the index lookup that also pass every other factor. The
+// factors are applied one at a time to the whole list, comparisons
+// through their row kernels.
+static vector<uint32_t> selectIndexed(const vector<PredNode>& prog, const Table& input,
+                                      const AccessPath& path) {
+    vector<uint32_t> rows;
+    path.index->lookup(prog[path.node], rows);
+    if (path.node == 0) return rows;
+
+    const PredNode& root = prog[0];
+    size_t kept = rows.size();
+    for (uint32_t c = 1; c < root.end && kept; c = prog[c].end) {
+        if ((int)c == path.node) continue;
+        const PredNode& f = prog[c];
+        if (isComparison(f.op)) {
+            kept = rowKernels[f.op](f, input.column(f.column), rows.data(), kept);
+        } else {
+            kept = keepRows(rows.data(), kept,
+                            [&](uint32_t r) { return evalNode(prog, c, input, r); });
+        }
+    }
+    rows.resize(kept);
+    return rows;
+}
+
+// Appends the row numbers of the set bits, offset by `begin`.
+static void appendSelected(const uint64_t* bits, size_t n, size_t begin,
+                           vector<uint32_t>& rows) {
+    for (size_t w = 0; w < bitmapWords(n); ++w) {
+        uint64_t b = bits[w];
+        while (b) {
+            rows.push_back((uint32_t)(begin + w * 64 + __builtin_ctzll(b)));
+            b &= b - 1;
+        }
+    }
+}
+
+// Appends the passing row ids in [begin, end) to `rows`. Blocks in zones
+// whose min/max rule the WHERE clause out are skipped without being read.
+// Stops after the block that brings `rows` to `maxRows`, or before the
+// next block once `cancel` is set.
+static void selectRange(const vector<PredNode>& prog, const Table& input,
+                        size_t begin, size_t end, vector<uint32_t>& rows,
+                        AdaptiveOrder* ad, size_t maxRows = NO_LIMIT,
+                        const std::atomic<bool>* cancel = nullptr) {
+    uint64_t bits[BLOCK_WORDS];
+    size_t zoneRows = prog.empty() ? 0 : input.zoneRows();
+    for (; begin < end && rows.size() < maxRows; begin += BLOCK_ROWS) {
+        if (cancel && cancel->load(std::memory_order_relaxed)) return;
+        if (zoneRows && !zoneMayMatch(prog, 0, input, begin / zoneRows)) {
+            // jump to the first block of the next zone
+            begin = (begin / zoneRows + 1) * zoneRows - BLOCK_ROWS;
+            continue;
+        }
+        size_t n = std::min(BLOCK_ROWS, end - begin);
+        if (prog.empty()) fillBitmap(n, bits);
+        else if (prog[0].op == OP_FALSE) break;
+        else {
+            evalCounted(prog, 0, input, begin, n, bits, ad);
+            if (ad) ad->nextBlock(prog);
+        }
+        appendSelected(bits, n, begin, rows);
+    }
+}
+
+// One thread's adaptive ordering for a scan; null when it is turned off.
+static std::unique_ptr<AdaptiveOrder> makeAdaptive(const vector<PredNode>& prog,
+                                                   const EvalOptions& opts) {
+    if (!opts.adaptive || prog.empty()) return nullptr;
+    return std::make_unique<AdaptiveOrder>(prog);
+}
+
+// Adds one thread's counters to opts.stats, if the caller asked for them.
+static void reportStats(const vector<PredNode>& prog, const Table& input,
+                        const AdaptiveOrder* ad, const EvalOptions& opts) {
+    if (!opts.stats || !ad) return;
+    std::lock_guard<std::mutex> g(opts.stats->lock);
+    vector<FactorStats>& out = opts.stats->nodes;
+    if (out.empty()) {
+        out.resize(prog.size());
+        for (uint32_t i = 0; i < prog.size(); ++i) {
+            out[i].node = i;
+            out[i].text = describeNode(prog[i], input.schema());
+            for (uint32_t c = i + 1; c < prog[i].end; ++c) out[c].depth++;
+        }
+    }
+    for (uint32_t i = 0; i < prog.size(); ++i) {
+        out[i].rows += (uint64_t)ad->total[i].rows;
+        out[i].passed += (uint64_t)ad->total[i].passed;
+        out[i].nanos += ad->total[i].nanos;
+        out[i].timedRows += (uint64_t)ad->total[i].timedRows;
+        for (size_t k = 0; k < ad->children[i].size(); ++k) {
+            out[ad->children[i][k]].position = (int)k;
+        }
     }
-    string left = it->second;
-    string right = normalizeLiteral(expr);
+}
 
-    int cmp = compareLiterals(left, right);
+vector<uint32_t> selectRows(const CompiledQuery& plan, const Table& input, size_t firstRow) {
+    vector<uint32_t> rows;
+    vector<PredNode> prog = bindProgram(plan.where, input);
+    auto ad = makeAdaptive(prog, EvalOptions());
+    selectRange(prog, input, firstRow, input.rowCount(), rows, ad.get());
+    return rows;
+}
 
-    switch (expr->op) {
-        case EQUALS:   return cmp == 0;
-        case NOTEQUAL: return cmp != 0;
-        case LT:       return cmp < 0;
-        case LTE:      return cmp <= 0;
-        case GT:       return cmp > 0;
-        case GTE:      return cmp >= 0;
-        default:       return false;
+// Orders row ids by key(row), ascending unless `desc`; equal keys keep
+// input order, so every row has one place and the result is the same
+// for any thread count.
+template <class Key>
+struct ByKey {
+    Key key;
+    bool desc;
+    bool operator()(uint32_t a, uint32_t b) const {
+        auto x = key(a), y = key(b);
+        if (x == y) return a < b;
+        return (x < y) != desc;
     }
+};
+
+template <class Key>
+static ByKey<Key> byKey(Key key, bool desc) { return ByKey<Key>{key, desc}; }
+
+// Sorts `rows` under `order` with each key copied next to its row id, so
+// the comparisons do not chase the column.
+template <class Key>
+static void sortRows(vector<uint32_t>& rows, const ByKey<Key>& order) {
+    using K = decltype(order.key(0));
+    vector<std::pair<K, uint32_t>> keyed(rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) keyed[i] = {order.key(rows[i]), rows[i]};
+    std::sort(keyed.begin(), keyed.end(), [&](const std::pair<K, uint32_t>& a,
+                                             const std::pair<K, uint32_t>& b) {
+        if (a.first == b.first) return a.second < b.second;
+        return (a.first < b.first) != order.desc;
+    });
+    for (size_t i = 0; i < rows.size(); ++i) rows[i] = keyed[i].second;
 }
 
-Table evaluateQuery(const Query& q, const Table& input) {
-    Table result;
+// Keeps the `limit` rows that sort first under `before` of those offered.
+// Until then rows are only collected; after that `kept` is a max-heap, so
+// a row that cannot make the cut costs one comparison.
+template <class Before>
+struct TopRows {
+    size_t limit;
+    Before before;
+    vector<uint32_t> kept;
+
+    TopRows(size_t limit, Before before) : limit(limit), before(before) {}
+
+    void offer(uint32_t row) {
+        if (kept.size() < limit) {
+            kept.push_back(row);
+            if (kept.size() == limit) std::make_heap(kept.begin(), kept.end(), before);
+        } else if (limit && before(row, kept.front())) {
+            std::pop_heap(kept.begin(), kept.end(), before);
+            kept.back() = row;
+            std::push_heap(kept.begin(), kept.end(), before);
+        }
+    }
+
+    // The kept rows, first to last.
+    vector<uint32_t> take() {
+        sortRows(kept, before);
+        return std::move(kept);
+    }
+};
+
+// Threads a scan of `input` runs on: opts.threads once the table is big
+// enough to split, but no more than there are morsels.
+static unsigned scanThreads(const Table& input, const EvalOptions& opts) {
+    if (opts.threads <= 1 || input.rowCount() < opts.minParallelRows) return 1;
+    size_t morselRows = std::max(opts.morselRows, BLOCK_ROWS);
+    size_t morsels = (input.rowCount() + morselRows - 1) / morselRows;
+    return (unsigned)std::min<size_t>(opts.threads, std::max<size_t>(morsels, 1));
+}
 
-    for (const Row& r : input) {
-        bool keep = true;
-        if (q.where) {
-            keep = evalBoolExpr(q.where.get(), r);
+// Scans `input` in morsels on scanThreads() threads and calls
+// consume(t, rows) with the passing rows of each morsel, in increasing
+// row order, where t is the calling thread's number. Each thread claims
+// morsels in increasing order.
+template <class Consume>
+static void scanMorsels(const vector<PredNode>& prog, const Table& input,
+                        const EvalOptions& opts, Consume consume) {
+    size_t morselRows = std::max(opts.morselRows, BLOCK_ROWS);
+    size_t morsels = (input.rowCount() + morselRows - 1) / morselRows;
+    std::atomic<size_t> nextMorsel{0};
+    auto worker = [&](unsigned t) {
+        vector<uint32_t> rows;
+        auto ad = makeAdaptive(prog, opts);
+        for (size_t m = nextMorsel++; m < morsels; m = nextMorsel++) {
+            size_t begin = m * morselRows;
+            rows.clear();
+            selectRange(prog, input, begin, std::min(begin + morselRows, input.rowCount()),
+                        rows, ad.get());
+            consume(t, rows);
         }
-        if (!keep) continue;
+        reportStats(prog, input, ad.get(), opts);
+    };
+
+    unsigned n = scanThreads(input, opts);
+    vector<std::thread> threads;
+    for (unsigned t = 1; t < n; ++t) threads.emplace_back(worker, t);
+    worker(0);
+    for (auto& th : threads) th.join();
+}
+
+// Rows passing the WHERE clause that come first in ORDER BY order, at
+// most plan.limit of them, in that order. Each scan thread keeps its own
+// TopRows and the survivors are merged.
+template <class Before>
+static vector<uint32_t> selectTop(const CompiledQuery& plan, const vector<PredNode>& prog,
+                                  const Table& input, const AccessPath& path,
+                                  const EvalOptions& opts, Before before) {
+    TopRows<Before> top(plan.limit, before);
+    if (path.index) {
+        for (uint32_t r : selectIndexed(prog, input, path)) top.offer(r);
+        return top.take();
+    }
+
+    vector<TopRows<Before>> parts(scanThreads(input, opts), top);
+    scanMorsels(prog, input, opts, [&](unsigned t, const vector<uint32_t>& rows) {
+        for (uint32_t r : rows) parts[t].offer(r);
+    });
+    if (parts.size() == 1) return parts[0].take();
+    for (const auto& part : parts) {
+        for (uint32_t r : part.kept) top.offer(r);
+    }
+    return top.take();
+}
+
+// Calls f with the ByKey order on ids by the value of `col` at row
+// rowOf(id), for the column's type. NaN counts as greater than any
+// number; dictionary codes are compared by the rank of their strings.
+template <class RowOf, class F>
+static vector<uint32_t> withColumnOrder(const Column& col, bool desc, RowOf rowOf, F f) {
+    if (col.type == FT_NUMBER) {
+        const double* v = col.numbers.data();
+        return f(byKey([v, rowOf](uint32_t i) {
+            double x = v[rowOf(i)];
+            bool nan = x != x;
+            return std::make_pair(nan, nan ? 0.0 : x);
+        }, desc));
+    }
+    if (col.type == FT_BOOL) {
+        const uint8_t* v = col.bools.data();
+        return f(byKey([v, rowOf](uint32_t i) { return v[rowOf(i)]; }, desc));
+    }
+    if (col.encoded) {
+        vector<uint32_t> byRank(col.dict.size()), rank(col.dict.size());
+        for (uint32_t c = 0; c < byRank.size(); ++c) byRank[c] = c;
+        std::sort(byRank.begin(), byRank.end(),
+                  [&](uint32_t a, uint32_t b) { return col.dict[a] < col.dict[b]; });
+        for (uint32_t k = 0; k < byRank.size(); ++k) rank[byRank[k]] = k;
+        const uint32_t* codes = col.codes.data();
+        const uint32_t* rk = rank.data();
+        return f(byKey([codes, rk, rowOf](uint32_t i) { return rk[codes[rowOf(i)]]; }, desc));
+    }
+    return f(byKey([&col, rowOf](uint32_t i) { return col.stringAt(rowOf(i)); }, desc));
+}
 
-        Row outRow;
-        if (q.selectAll) {
-            outRow = r;
+// selectTop ordered by the ORDER BY column.
+static vector<uint32_t> selectOrdered(const CompiledQuery& plan, const vector<PredNode>& prog,
+                                      const Table& input, const AccessPath& path,
+                                      const EvalOptions& opts) {
+    return withColumnOrder(input.column(plan.orderColumn), plan.descending,
+                           [](uint32_t r) { return r; }, [&](auto before) {
+        return selectTop(plan, prog, input, path, opts, before);
+    });
+}
+
+Table aggregateResult(const CompiledQuery& plan, const Table& input,
+                      const HashAggregator& total) {
+    vector<uint32_t> groups(total.groupCount());
+    for (uint32_t g = 0; g < groups.size(); ++g) groups[g] = g;
+    std::sort(groups.begin(), groups.end(),
+              [&](uint32_t a, uint32_t b) { return total.firstRow(a) < total.firstRow(b); });
+    if (plan.orderColumn >= 0) {
+        // sort positions in `groups`, so that ties keep first-row order
+        groups = withColumnOrder(input.column(plan.orderColumn), plan.descending,
+                                 [&](uint32_t i) { return total.firstRow(groups[i]); },
+                                 [&](auto before) {
+            TopRows<decltype(before)> top(plan.limit, before);
+            for (uint32_t i = 0; i < groups.size(); ++i) top.offer(i);
+            vector<uint32_t> order = top.take();
+            for (uint32_t& i : order) i = groups[i];
+            return order;
+        });
+    } else if (groups.size() > plan.limit) {
+        groups.resize(plan.limit);
+    }
+    Table result(plan.outSchema);
+    total.emit(groups, result);
+    return result;
+}
+
+// Runs an aggregating query. Each scan thread folds the passing rows of
+// its morsels into its own HashAggregator and those are merged; no input
+// row is projected.
+static Table aggregateRows(const CompiledQuery& plan, const vector<PredNode>& prog,
+                           const Table& input, const EvalOptions& opts) {
+    HashAggregator total(plan, input);
+    if (prog.empty() || prog[0].op != OP_FALSE) {
+        AccessPath path = chooseAccessPath(prog, input);
+        if (path.index) {
+            vector<uint32_t> rows = selectIndexed(prog, input, path);
+            std::sort(rows.begin(), rows.end());
+            total.add(rows.data(), rows.size());
         } else {
-            for (const auto& field : q.fields) {
-                auto it = r.find(field);
-                if (it != r.end()) {
-                    outRow[field] = it->second;
-                } else {
-                    outRow[field] = "";
-                }
-            }
+            vector<HashAggregator> parts(scanThreads(input, opts), total);
+            scanMorsels(prog, input, opts, [&](unsigned t, const vector<uint32_t>& rows) {
+                parts[t].add(rows.data(), rows.size());
+            });
+            for (const HashAggregator& part : parts) total.merge(part);
         }
-        result.push_back(outRow);
     }
+    return aggregateResult(plan, input, total);
+}
+
+// Gathers the projected columns of `rows` onto the end of `out`.
+static void project(const CompiledQuery& plan, const Table& input,
+                    const vector<uint32_t>& rows, Table& out) {
+    for (size_t c = 0; c < plan.projection.size(); ++c) {
+        const Column& src = input.column(plan.projection[c]);
+        Column& dst = out.column(c);
+        dst.gather(src, rows);
+    }
+    out.setRowCount(out.rowCount() + rows.size());
+}
 
+Table projectRows(const CompiledQuery& plan, const Table& input, const vector<uint32_t>& rows) {
+    Table out(plan.outSchema);
+    project(plan, input, rows, out);
+    return out;
+}
+
+// Passes at most `limit` rows on to `inner`, then declines the rest so
+// the scan stops.
+class LimitSink : public ResultSink {
+public:
+    LimitSink(ResultSink& inner, size_t limit) : inner(inner), left(limit) {}
+
+    void begin(const SymbolTable& schema) override { inner.begin(schema); }
+    bool consume(const Table& batch) override {
+        if (batch.rowCount() <= left) {
+            left -= batch.rowCount();
+            return inner.consume(batch) && left > 0;
+        }
+        vector<uint32_t> head(left);
+        for (uint32_t r = 0; r < left; ++r) head[r] = r;
+        Table part(batch.schema());
+        for (size_t c = 0; c < batch.columnCount(); ++c) part.column(c).gather(batch.column(c), head);
+        part.setRowCount(left);
+        left = 0;
+        inner.consume(part);
+        return false;
+    }
+    void end() override { inner.end(); }
+
+private:
+    ResultSink& inner;
+    size_t left;
+};
+
+// Collects a streamed result into one table.
+class TableSink : public ResultSink {
+public:
+    explicit TableSink(Table& out) : out(out) {}
+    bool consume(const Table& batch) override {
+        out.append(batch);
+        return true;
+    }
+
+private:
+    Table& out;
+};
+
+// Projects `rows` into `sink` in batches of `batchRows`, in order.
+static void deliverRows(const CompiledQuery& plan, const Table& input,
+                        const vector<uint32_t>& all, size_t batchRows, ResultSink& sink) {
+    vector<uint32_t> rows;
+    for (size_t i = 0; i < all.size(); i += batchRows) {
+        rows.assign(all.begin() + i, all.begin() + std::min(all.size(), i + batchRows));
+        Table batch(plan.outSchema);
+        project(plan, input, rows, batch);
+        if (!sink.consume(batch)) break;
+    }
+}
+
+// Morsel-driven scan: workers claim morsels from a shared counter, filter
+// and project each into that morsel's own buffer, and the buffers are
+// concatenated in morsel order so output order matches the serial scan.
+static Table evaluateParallel(const CompiledQuery& plan, const vector<PredNode>& prog,
+                              const Table& input, const EvalOptions& opts) {
+    size_t morselRows = std::max(opts.morselRows, BLOCK_ROWS);
+    size_t morsels = (input.rowCount() + morselRows - 1) / morselRows;
+    vector<Table> parts(morsels);
+    std::atomic<size_t> nextMorsel{0};
+
+    auto worker = [&] {
+        vector<uint32_t> rows;
+        auto ad = makeAdaptive(prog, opts);
+        for (size_t m = nextMorsel++; m < morsels; m = nextMorsel++) {
+            size_t begin = m * morselRows;
+            size_t end = std::min(begin + morselRows, input.rowCount());
+            rows.clear();
+            selectRange(prog, input, begin, end, rows, ad.get());
+            parts[m] = Table(plan.outSchema);
+            project(plan, input, rows, parts[m]);
+        }
+        reportStats(prog, input, ad.get(), opts);
+    };
+
+    unsigned n = (unsigned)std::min<size_t>(opts.threads, morsels);
+    vector<std::thread> threads;
+    for (unsigned t = 1; t < n; ++t) threads.emplace_back(worker);
+    worker();
+    for (auto& th : threads) th.join();
+
+    Table result(plan.outSchema);
+    for (const Table& part : parts) result.append(part);
     return result;
 }
+
+Table evaluateQuery(const CompiledQuery& plan, const Table& input, const EvalOptions& opts) {
+    if (plan.orderColumn >= 0 || plan.limit != NO_LIMIT || !plan.aggregates.empty()) {
+        Table result(plan.outSchema);
+        TableSink sink(result);
+        evaluateQuery(plan, input, sink, opts);
+        return result;
+    }
+    if (opts.stats) opts.stats->nodes.clear();
+    vector<PredNode> prog = bindProgram(plan.where, input);
+    Table result(plan.outSchema);
+    if (!prog.empty() && prog[0].op == OP_FALSE) return result;
+
+    AccessPath path = chooseAccessPath(prog, input);
+    if (path.index) {
+        project(plan, input, selectIndexed(prog, input, path), result);
+        return result;
+    }
+
+    if (opts.threads > 1 && input.rowCount() >= opts.minParallelRows) {
+        return evaluateParallel(plan, prog, input, opts);
+    }
+
+    vector<uint32_t> rows;
+    auto ad = makeAdaptive(prog, opts);
+    selectRange(prog, input, 0, input.rowCount(), rows, ad.get());
+    reportStats(prog, input, ad.get(), opts);
+    project(plan, input, rows, result);
+    return result;
+}
+
+// Shared scan of [begin, end): each block is read once, tested against
+// every program and projected into each query's output while it is still
+// in cache. A zone is skipped only when its min/max rule out every program.
+static void scanShared(const vector<const CompiledQuery*>& plans,
+                       const vector<const vector<PredNode>*>& progs, const Table& input,
+                       size_t begin, size_t end, vector<Table>& outs,
+                       const vector<std::unique_ptr<AdaptiveOrder>>& ads) {
+    uint64_t bits[BLOCK_WORDS];
+    vector<uint32_t> rows;
+    size_t zoneRows = input.zoneRows();
+    for (; begin < end; begin += BLOCK_ROWS) {
+        size_t n = std::min(BLOCK_ROWS, end - begin);
+        bool live = false;
+        for (size_t q = 0; q < progs.size(); ++q) {
+            const vector<PredNode>& prog = *progs[q];
+            if (prog.empty()) {
+                fillBitmap(n, bits);
+            } else if (zoneRows && !zoneMayMatch(prog, 0, input, begin / zoneRows)) {
+                continue;
+            } else {
+                evalCounted(prog, 0, input, begin, n, bits, ads[q].get());
+                if (ads[q]) ads[q]->nextBlock(prog);
+            }
+            live = true;
+            rows.clear();
+            appendSelected(bits, n, begin, rows);
+            project(*plans[q], input, rows, outs[q]);
+        }
+        if (!live) begin = (begin / zoneRows + 1) * zoneRows - BLOCK_ROWS;
+    }
+}
+
+vector<Table> evaluateBatch(const vector<const CompiledQuery*>& plans, const Table& input,
+                            const EvalOptions& opts) {
+    vector<Table> results;
+    vector<vector<PredNode>> progs(plans.size());
+    vector<size_t> scanned;                     // queries on the shared scan
+    vector<const CompiledQuery*> scanPlans;
+    vector<const vector<PredNode>*> scanProgs;
+    for (size_t q = 0; q < plans.size(); ++q) {
+        results.emplace_back(plans[q]->outSchema);
+        if (plans[q]->orderColumn >= 0 || plans[q]->limit != NO_LIMIT ||
+            !plans[q]->aggregates.empty()) {
+            // sorted, cut short or aggregated: run on its own
+            EvalOptions own = opts;
+            own.stats = nullptr;
+            results[q] = evaluateQuery(*plans[q], input, own);
+            continue;
+        }
+        progs[q] = bindProgram(plans[q]->where, input);
+        if (!progs[q].empty() && progs[q][0].op == OP_FALSE) continue;
+        AccessPath path = chooseAccessPath(progs[q], input);
+        if (path.index) {
+            project(*plans[q], input, selectIndexed(progs[q], input, path), results[q]);
+            continue;
+        }
+        scanned.push_back(q);
+        scanPlans.push_back(plans[q]);
+        scanProgs.push_back(&progs[q]);
+    }
+    if (scanned.empty()) return results;
+
+    // per query, so that each keeps its own adaptive order
+    auto makeAdaptives = [&] {
+        vector<std::unique_ptr<AdaptiveOrder>> ads;
+        for (const vector<PredNode>* prog : scanProgs) ads.push_back(makeAdaptive(*prog, opts));
+        return ads;
+    };
+    if (opts.threads <= 1 || input.rowCount() < opts.minParallelRows) {
+        vector<Table> outs;
+        for (const CompiledQuery* plan : scanPlans) outs.emplace_back(plan->outSchema);
+        scanShared(scanPlans, scanProgs, input, 0, input.rowCount(), outs, makeAdaptives());
+        for (size_t k = 0; k < scanned.size(); ++k) results[scanned[k]] = std::move(outs[k]);
+        return results;
+    }
+
+    size_t morselRows = std::max(opts.morselRows, BLOCK_ROWS);
+    size_t morsels = (input.rowCount() + morselRows - 1) / morselRows;
+    vector<vector<Table>> parts(morsels);
+    std::atomic<size_t> nextMorsel{0};
+
+    auto worker = [&] {
+        auto ads = makeAdaptives();
+        for (size_t m = nextMorsel++; m < morsels; m = nextMorsel++) {
+            size_t begin = m * morselRows;
+            size_t end = std::min(begin + morselRows, input.rowCount());
+            for (const CompiledQuery* plan : scanPlans) parts[m].emplace_back(plan->outSchema);
+            scanShared(scanPlans, scanProgs, input, begin, end, parts[m], ads);
+        }
+    };
+
+    unsigned n = (unsigned)std::min<size_t>(opts.threads, morsels);
+    vector<std::thread> threads;
+    for (unsigned t = 1; t < n; ++t) threads.emplace_back(worker);
+    worker();
+    for (auto& th : threads) th.join();
+
+    for (size_t k = 0; k < scanned.size(); ++k) {
+        for (const auto& part : parts) results[scanned[k]].append(part[k]);
+    }
+    return results;
+}
+
+// Parallel form of the streaming scan. Workers claim morsels as in
+// evaluateParallel but may run at most `window` morsels ahead of the one
+// being delivered, which bounds the rows buffered for the sink.
+static void streamParallel(const CompiledQuery& plan, const vector<PredNode>& prog,
+                           const Table& input, ResultSink& sink, const EvalOptions& opts) {
+    size_t morselRows = std::max(opts.morselRows, BLOCK_ROWS);
+    size_t morsels = (input.rowCount() + morselRows - 1) / morselRows;
+    size_t window = 2 * (size_t)opts.threads;
+    vector<Table> parts(morsels);
+    vector<char> ready(morsels, 0);
+    size_t nextMorsel = 0, delivered = 0;
+    std::atomic<bool> stop{false};     // set once the sink declines more rows
+    std::mutex lock;
+    std::condition_variable cv;
+
+    auto worker = [&] {
+        vector<uint32_t> rows;
+        auto ad = makeAdaptive(prog, opts);
+        std::unique_lock<std::mutex> g(lock);
+        while (true) {
+            cv.wait(g, [&] { return stop || nextMorsel >= morsels || nextMorsel < delivered + window; });
+            if (stop || nextMorsel >= morsels) break;
+            size_t m = nextMorsel++;
+            g.unlock();
+            size_t begin = m * morselRows;
+            size_t end = std::min(begin + morselRows, input.rowCount());
+            rows.clear();
+            // no morsel contributes more than the LIMIT
+            selectRange(prog, input, begin, end, rows, ad.get(), plan.limit, &stop);
+            Table part(plan.outSchema);
+            project(plan, input, rows, part);
+            g.lock();
+            parts[m] = std::move(part);
+            ready[m] = 1;
+            cv.notify_all();
+        }
+        g.unlock();
+        reportStats(prog, input, ad.get(), opts);
+    };
+
+    unsigned n = (unsigned)std::min<size_t>(opts.threads, morsels);
+    vector<std::thread> threads;
+    for (unsigned t = 0; t < n; ++t) threads.emplace_back(worker);
+    for (size_t m = 0; m < morsels; ++m) {
+        Table part;
+        {
+            std::unique_lock<std::mutex> g(lock);
+            cv.wait(g, [&] { return ready[m] != 0; });
+            part = std::move(parts[m]);
+            delivered = m + 1;
+        }
+        cv.notify_all();
+        if (part.rowCount() && !sink.consume(part)) {
+            std::lock_guard<std::mutex> g(lock);
+            stop = true;
+            break;
+        }
+    }
+    cv.notify_all();
+    for (auto& th : threads) th.join();
+}
+
+void evaluateQuery(const CompiledQuery& plan, const Table& input, ResultSink& out,
+                   const EvalOptions& opts) {
+    if (opts.stats) opts.stats->nodes.clear();
+    LimitSink limited(out, plan.limit);
+    ResultSink& sink = plan.limit == NO_LIMIT ? out : limited;
+    sink.begin(plan.outSchema);
+    vector<PredNode> prog = bindProgram(plan.where, input);
+    if (!plan.aggregates.empty()) {
+        // one row even when nothing matches, unless grouped
+        Table groups = aggregateRows(plan, prog, input, opts);
+        if (groups.rowCount()) sink.consume(groups);
+        sink.end();
+        return;
+    }
+    if (plan.limit == 0 || (!prog.empty() && prog[0].op == OP_FALSE)) {
+        sink.end();
+        return;
+    }
+
+    size_t batchRows = std::max(opts.morselRows, BLOCK_ROWS);
+    AccessPath path = chooseAccessPath(prog, input);
+    if (plan.orderColumn >= 0) {
+        deliverRows(plan, input, selectOrdered(plan, prog, input, path, opts), batchRows, sink);
+    } else if (path.index) {
+        vector<uint32_t> all = selectIndexed(prog, input, path);
+        if (all.size() > plan.limit) all.resize(plan.limit);
+        deliverRows(plan, input, all, batchRows, sink);
+    } else if (opts.threads > 1 && input.rowCount() >= opts.minParallelRows) {
+        streamParallel(plan, prog, input, sink, opts);
+    } else {
+        vector<uint32_t> rows;
+        auto ad = makeAdaptive(prog, opts);
+        size_t found = 0;
+        for (size_t begin = 0; begin < input.rowCount() && found < plan.limit; begin += batchRows) {
+            rows.clear();
+            selectRange(prog, input, begin, std::min(begin + batchRows, input.rowCount()),
+                        rows, ad.get(), plan.limit - found);
+            if (rows.empty()) continue;
+            found += rows.size();
+            Table batch(plan.outSchema);
+            project(plan, input, rows, batch);
+            if (!sink.consume(batch)) break;
+        }
+        reportStats(prog, input, ad.get(), opts);
+    }
+    sink.end();
+}
+
+Table evaluateQuery(const Query& q, const Table& input, const EvalOptions& opts) {
+    CompiledQuery plan;
+    if (!compileQuery(q, input.schema(), plan)) return Table();
+    optimizeQuery(plan);
+    return evaluateQuery(plan, input, opts);
+}
@@ -1,14 +1,120 @@
 #pragma once
+#include <cstdint>
+#include <mutex>
 #include <string>
 #include <vector>
-#include <map>
 #include "parser.h"
+#include "table.h"
+#include "compiler.h"
 
 using std::string;
 using std::vector;
-using std::map;
 
-using Row = map<string,string>;
-using Table = vector<Row>;
+// Row-at-a-time evaluation of the WHERE program for one row.
+bool matchesRow(const CompiledQuery& plan, const Table& input, size_t row);
+// Row ids of `input` from `firstRow` on passing the WHERE clause, in input
+// order, computed a block at a time with the vectorised kernels.
+vector<uint32_t> selectRows(const CompiledQuery& plan, const Table& input, size_t firstRow = 0);
+// The projected columns of `rows`, in that order.
+Table projectRows(const CompiledQuery& plan, const Table& input, const vector<uint32_t>& rows);
 
-Table evaluateQuery(const Query& q, const Table& input);
+class HashAggregator;
+// The result of an aggregating plan from the groups collected in `groups`:
+// one row per group in order of its first row, or on the ORDER BY column,
+// at most plan.limit of them.
+Table aggregateResult(const CompiledQuery& plan, const Table& input,
+                      const HashAggregator& groups);
+
+// How the rows to test are found. With an index, `node` is the WHERE
+// comparison it answers: either the whole WHERE clause or one factor of a
+// top-level AND, whose other factors are then tested on the fetched rows
+// only. Without one, the table is scanned.
+struct AccessPath {
+    const ColumnIndex* index = nullptr;
+    int node = -1;
+    size_t estimatedRows = 0;
+};
+
+// Picks the index answering the fewest rows, if that is at most
+// 1/INDEX_MAX_FRACTION of the table; past that a vectorised scan is cheaper.
+const size_t INDEX_MAX_FRACTION = 8;
+AccessPath chooseAccessPath(const vector<PredNode>& prog, const Table& input);
+
+// Specialises a compiled WHERE program for one table, once per execution:
+// string comparisons on dictionary-encoded columns become code
+// comparisons, literals missing from a dictionary become constants, and
+// constants are folded out of AND/OR. An empty result means every row
+// matches; a lone OP_FALSE means none can.
+vector<PredNode> bindProgram(const vector<PredNode>& where, const Table& input);
+
+// Runtime counters for one node of the bound WHERE program, summed over
+// a scan. Cost is sampled on a fraction of blocks.
+struct FactorStats {
+    uint32_t node = 0;          // index in the bound program
+    string text;                // the node as WHERE text
+    int depth = 0;              // nesting below the root
+    int position = -1;          // final place among its siblings; -1 for the root
+    uint64_t rows = 0;          // rows tested
+    uint64_t passed = 0;        // rows that passed
+    double nanos = 0;           // time over the timed rows
+    uint64_t timedRows = 0;
+
+    double passRate() const { return rows ? (double)passed / rows : 0; }
+    double nanosPerRow() const { return timedRows ? nanos / timedRows : 0; }
+};
+
+// The counters of every node of a scan's bound WHERE program. Each scan
+// thread adds its own under `lock` once it finishes.
+struct ScanStats {
+    vector<FactorStats> nodes;
+    std::mutex lock;
+};
+
+struct EvalOptions {
+    unsigned threads = 1;               // worker threads for the scan
+    size_t morselRows = 64 * 1024;      // rows claimed by a worker at a time
+    size_t minParallelRows = 256 * 1024;  // smaller inputs are scanned serially
+    // Reorder AND factors and OR terms during the scan from their measured
+    // pass rates and costs: AND factors that remove the most rows per unit
+    // of cost run first, and OR terms that accept the most. Results are
+    // unaffected.
+    bool adaptive = true;
+    // If set, receives the counters of each WHERE node for the scan.
+    // Index lookups and queries ruled out before the scan leave it empty.
+    ScanStats* stats = nullptr;
+};
+
+// Receives a query's result as it is produced, one batch of rows at a
+// time, so the full result never has to be held in memory.
+class ResultSink {
+public:
+    virtual ~ResultSink() = default;
+    // Called once with the output schema before any rows.
+    virtual void begin(const SymbolTable& schema) { (void)schema; }
+    // Receives the next rows of the result in output order. Returning
+    // false stops the scan; no further batches are delivered.
+    virtual bool consume(const Table& batch) = 0;
+    // Called once after the last batch, including after an early stop.
+    virtual void end() {}
+};
+
+// Streams the result of a compiled query into `sink` in batches of at
+// most opts.morselRows rows. A parallel scan keeps at most a few morsels
+// per worker buffered ahead of the sink.
+void evaluateQuery(const CompiledQuery& plan, const Table& input, ResultSink& sink,
+                   const EvalOptions& opts = EvalOptions());
+
+// Runs a compiled query over `input`, which must be laid out from the
+// schema the query was compiled against. The result holds only the
+// projected columns, in input order regardless of thread count.
+Table evaluateQuery(const CompiledQuery& plan, const Table& input,
+                    const EvalOptions& opts = EvalOptions());
+// Runs several queries over the same table with one shared scan: each
+// block is read once and tested against every query's WHERE program.
+// Queries answered by an index or ruled out before the scan do not join
+// it. Results are returned in the order of `plans`.
+vector<Table> evaluateBatch(const vector<const CompiledQuery*>& plans, const Table& input,
+                            const EvalOptions& opts = EvalOptions());
+// Compiles and optimizes `q` against input.schema() and runs it.
+Table evaluateQuery(const Query& q, const Table& input,
+                    const EvalOptions& opts = EvalOptions());
@@ -0,0 +1,177 @@
+#include "explain.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include "print_sink.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static const char* indexKindName(IndexKind k) {
+    return k == INDEX_SORTED ? "sorted" : "hash";
+}
+
+static string formatMs(double seconds) {
+    char buf[32];
+    snprintf(buf, sizeof buf, "%.3f ms", seconds * 1e3);
+    return buf;
+}
+
+// The counters of one node, e.g. "rows=5 passed=3 (60.0%) time~0.002 ms".
+static string formatCounters(const FactorStats& s) {
+    char buf[128];
+    snprintf(buf, sizeof buf, "rows=%llu passed=%llu (%.1f%%) time~%.3f ms",
+             (unsigned long long)s.rows, (unsigned long long)s.passed, s.passRate() * 100,
+             s.nanosPerRow() * s.rows / 1e6);
+    return buf;
+}
+
+static void explainNode(const vector<PredNode>& prog, uint32_t i, int depth,
+                        const SymbolTable& schema, const vector<FactorStats>* stats,
+                        ostream& os) {
+    string text = string(2 * depth + 2, ' ') + describeNode(prog[i], schema);
+    if (stats && i < stats->size()) {
+        if (text.size() < 40) text.resize(40, ' ');
+        text += "  " + formatCounters((*stats)[i]);
+    }
+    os << text << "\n";
+
+    const PredNode& n = prog[i];
+    if (n.op != OP_AND && n.op != OP_OR) return;
+    vector<uint32_t> kids;
+    for (uint32_t c = i + 1; c < n.end; c = prog[c].end) kids.push_back(c);
+    if (stats && stats->size() == prog.size()) {
+        stable_sort(kids.begin(), kids.end(), [&](uint32_t a, uint32_t b) {
+            return (*stats)[a].position < (*stats)[b].position;
+        });
+    }
+    for (uint32_t c : kids) explainNode(prog, c, depth + 1, schema, stats, os);
+}
+
+void explainQuery(const CompiledQuery& plan, const Table& input, const string& tableName,
+                  const EvalOptions& opts, const ExplainRun* run, ostream& os) {
+    os << "Table: " << tableName << " (" << input.rowCount() << " rows)\n";
+    os << "Output:";
+    for (size_t c = 0; c < plan.outSchema.fieldCount(); ++c) {
+        os << (c ? ", " : " ") << plan.outSchema.fieldName(c);
+    }
+    os << "\n";
+
+    // the same decisions evaluateQuery makes
+    vector<PredNode> prog = bindProgram(plan.where, input);
+    AccessPath path = chooseAccessPath(prog, input);
+    os << "Access: ";
+    if (!prog.empty() && prog[0].op == OP_FALSE) {
+        os << "none, the WHERE clause cannot match\n";
+    } else if (path.index) {
+        os << indexKindName(path.index->kind()) << " index on "
+           << input.schema().fieldName(path.index->column()) << " for "
+           << describeNode(prog[path.node], input.schema()) << ", " << path.estimatedRows
+           << " rows";
+        if (path.node != 0) os << "; other factors tested on those rows";
+        os << "\n";
+    } else {
+        bool parallel = opts.threads > 1 && input.rowCount() >= opts.minParallelRows;
+        os << "scan, " << (parallel ? opts.threads : 1) << (parallel ? " threads" : " thread");
+        if (!prog.empty() && input.zoneRows()) os << ", zones of " << input.zoneRows() << " rows skipped by min/max";
+        if (!prog.empty() && opts.adaptive) os << ", AND/OR children reordered as it runs";
+        os << "\n";
+    }
+
+    const vector<FactorStats>* stats = run ? run->stats : nullptr;
+    if (stats && stats->size() != prog.size()) stats = nullptr;
+    if (prog.empty()) {
+        os << "Filter: none\n";
+    } else {
+        os << "Filter:";
+        if (run && !stats) {
+            os << (path.index ? " (no per-node counters for index lookups)"
+                              : " (no per-node counters without adaptive reordering)");
+        }
+        os << "\n";
+        explainNode(prog, 0, 0, input.schema(), stats, os);
+    }
+    if (!plan.aggregates.empty()) {
+        os << "Aggregate: ";
+        if (plan.groupBy.empty()) os << "one group";
+        else os << "hash table grouped by";
+        for (size_t i = 0; i < plan.groupBy.size(); ++i) {
+            os << (i ? ", " : " ") << input.schema().fieldName(plan.groupBy[i]);
+        }
+        os << ", partial results per thread merged\n";
+    }
+    if (plan.orderColumn >= 0) {
+        os << "Order: " << input.schema().fieldName(plan.orderColumn)
+           << (plan.descending ? " DESC" : " ASC");
+        if (plan.limit != NO_LIMIT) os << ", best " << plan.limit << " kept in a heap";
+        else os << ", full sort";
+        os << "\n";
+    } else if (plan.limit != NO_LIMIT) {
+        os << "Limit: " << plan.limit
+           << (plan.aggregates.empty() ? " rows, the scan stops once they are found\n"
+                                       : plan.limit == 1 ? " group\n" : " groups\n");
+    }
+
+    if (!run) return;
+    const PhaseTimings& t = run->timings;
+    vector<pair<const char*, double>> phases;
+    if (t.cached) {
+        phases = {{"cache", t.cache}};
+    } else {
+        phases = {{"tokenize", t.tokenize}, {"parse", t.parse}, {"check", t.check},
+                  {"compile", t.compile}, {"optimize", t.optimize}};
+    }
+    phases.insert(phases.end(), {{"bind", t.bind}, {"evaluate", t.evaluate}, {"print", t.print}});
+    double total = 0;
+    os << "Phases:\n";
+    for (const auto& p : phases) {
+        string name = p.first;
+        os << "  " << name << string(10 - name.size(), ' ') << formatMs(p.second) << "\n";
+        total += p.second;
+    }
+    os << "  total     " << formatMs(total) << "\n";
+    os << "Result: " << run->rows << (run->rows == 1 ? " row\n" : " rows\n");
+}
+
+bool runExplain(const PreparedQuery& q, const vector<string>& params, EvalOptions opts,
+                const PhaseTimings& prepared, ostream& os) {
+    CompiledQuery plan;
+    if (!bindPrepared(q, params, plan)) return false;
+    if (q.explain == EXPLAIN_PLAN) {
+        explainQuery(plan, *q.table, q.from, opts, nullptr, os);
+        return true;
+    }
+
+    ExplainRun run;
+    run.timings = prepared;
+    ScanStats stats;
+    opts.stats = &stats;
+    PrintSink discard(nullptr);
+    TimingSink timed(discard, &run.timings.print);
+    if (!executePrepared(q, params, timed, opts, &run.timings)) return false;
+    run.timings.evaluate -= run.timings.print;
+    run.stats = &stats.nodes;
+    run.rows = timed.rows;
+    explainQuery(plan, *q.table, q.from, opts, &run, os);
+    return true;
+}
+
+void TimingSink::begin(const SymbolTable& schema) {
+    auto start = Clock::now();
+    inner.begin(schema);
+    *seconds += chrono::duration<double>(Clock::now() - start).count();
+}
+
+bool TimingSink::consume(const Table& batch) {
+    auto start = Clock::now();
+    rows += batch.rowCount();
+    bool more = inner.consume(batch);
+    *seconds += chrono::duration<double>(Clock::now() - start).count();
+    return more;
+}
+
+void TimingSink::end() {
+    auto start = Clock::now();
+    inner.end();
+    *seconds += chrono::duration<double>(Clock::now() - start).count();
+}
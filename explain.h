@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "compiler.h"
+#include "evaluator.h"
+#include "query_cache.h"
+
+using std::string;
+using std::vector;
+
+// What an EXPLAIN ANALYZE run measured.
+struct ExplainRun {
+    const vector<FactorStats>* stats = nullptr;    // per bound WHERE node
+    PhaseTimings timings;
+    uint64_t rows = 0;                          // rows in the result
+};
+
+// Writes the plan `plan` (with its parameters bound) runs with over
+// `input`, registered as `tableName`: the access path and the bound WHERE
+// program in evaluation order. With `run`, each WHERE node also shows the
+// rows it tested and passed and its estimated time, siblings appear in
+// the order the scan settled on, and the phase times follow.
+void explainQuery(const CompiledQuery& plan, const Table& input, const string& tableName,
+                  const EvalOptions& opts, const ExplainRun* run, std::ostream& os);
+
+// Runs an EXPLAIN query with `params` bound and writes its plan to `os`.
+// EXPLAIN ANALYZE first runs the query with its rows formatted as usual
+// but not written, so that printing is timed along with the other phases;
+// `prepared` holds the front-end times. Returns false (after printing why)
+// if the parameters do not fit.
+bool runExplain(const PreparedQuery& q, const vector<string>& params, EvalOptions opts,
+                const PhaseTimings& prepared, std::ostream& os);
+
+// Forwards to another sink, counting the rows and adding the time spent
+// inside it to `*seconds`.
+class TimingSink : public ResultSink {
+public:
+    TimingSink(ResultSink& inner, double* seconds) : inner(inner), seconds(seconds) {}
+
+    void begin(const SymbolTable& schema) override;
+    bool consume(const Table& batch) override;
+    void end() override;
+
+    uint64_t rows = 0;
+
+private:
+    ResultSink& inner;
+    double* seconds;
+};
@@ -0,0 +1,176 @@
+#include "index.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "diagnostics.h"
+#include "table.h"
+
+
+shared_ptr<ColumnIndex> ColumnIndex::build(const Table& t, int column, IndexKind kind) {
+    auto idx = std::make_shared<ColumnIndex>();
+    idx->indexKind = kind;
+    idx->col = column;
+    const Column& c = t.column(column);
+    idx->type = c.type;
+    size_t rows = t.rowCount();
+
+    // group id for every row (or -1 for NaN), numbering groups in order of
+    // first appearance
+    vector<int64_t> groupOf(rows, -1);
+    vector<uint32_t> counts;
+    for (size_t r = 0; r < rows; ++r) {
+        uint32_t g;
+        if (c.type == FT_STRING) {
+            string_view v = c.stringAt(r);
+            auto it = idx->strGroup.find(string(v));
+            if (it == idx->strGroup.end()) {
+                g = (uint32_t)counts.size();
+                idx->strGroup.emplace(string(v), g);
+                idx->strKeys.push_back(string(v));
+                counts.push_back(0);
+            } else {
+                g = it->second;
+            }
+        } else {
+            double v = c.type == FT_NUMBER ? c.numbers[r] : c.bools[r];
+            if (std::isnan(v)) continue;
+            auto it = idx->numGroup.find(v);
+            if (it == idx->numGroup.end()) {
+                g = (uint32_t)counts.size();
+                idx->numGroup.emplace(v, g);
+                idx->numKeys.push_back(v);
+                counts.push_back(0);
+            } else {
+                g = it->second;
+            }
+        }
+        groupOf[r] = g;
+        counts[g]++;
+    }
+
+    // sorted indexes renumber the groups in key order
+    vector<uint32_t> rank(counts.size());
+    for (uint32_t g = 0; g < rank.size(); ++g) rank[g] = g;
+    if (kind == INDEX_SORTED) {
+        vector<uint32_t> order = rank;
+        if (c.type == FT_STRING) {
+            std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return idx->strKeys[a] < idx->strKeys[b];
+            });
+        } else {
+            std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return idx->numKeys[a] < idx->numKeys[b];
+            });
+        }
+        vector<double> nk;
+        vector<string> sk;
+        vector<uint32_t> sortedCounts;
+        for (uint32_t i = 0; i < order.size(); ++i) {
+            rank[order[i]] = i;
+            sortedCounts.push_back(counts[order[i]]);
+            if (c.type == FT_STRING) sk.push_back(std::move(idx->strKeys[order[i]]));
+            else nk.push_back(idx->numKeys[order[i]]);
+        }
+        idx->numKeys.swap(nk);
+        idx->strKeys.swap(sk);
+        counts.swap(sortedCounts);
+        idx->numGroup.clear();
+        idx->strGroup.clear();
+    }
+
+    idx->groupStart.assign(counts.size() + 1, 0);
+    for (size_t g = 0; g < counts.size(); ++g) {
+        idx->groupStart[g + 1] = idx->groupStart[g] + counts[g];
+    }
+    idx->rowIds.resize(idx->groupStart.back());
+    vector<uint32_t> fill(idx->groupStart.begin(), idx->groupStart.end() - 1);
+    for (size_t r = 0; r < rows; ++r) {
+        if (groupOf[r] < 0) continue;
+        idx->rowIds[fill[rank[groupOf[r]]]++] = (uint32_t)r;
+    }
+    return idx;
+}
+
+bool ColumnIndex::canAnswer(const PredNode& node) const {
+    if (node.column != col) return false;
+    switch (node.op) {
+        case OP_NUM_EQ:
+        case OP_BOOL_EQ:
+        case OP_STR_EQ:
+        case OP_CODE_EQ:
+            return true;
+        case OP_NUM_LT: case OP_NUM_LE:
+        case OP_NUM_GT: case OP_NUM_GE:
+            return indexKind == INDEX_SORTED;
+        default:
+            return false;
+    }
+}
+
+bool ColumnIndex::groupRange(const PredNode& node, uint32_t& first, uint32_t& last) const {
+    first = last = 0;
+    if (indexKind == INDEX_HASH) {
+        uint32_t g = 0;
+        bool found = false;
+        if (node.op == OP_STR_EQ || node.op == OP_CODE_EQ) {
+            auto it = strGroup.find(node.str);
+            if ((found = it != strGroup.end())) g = it->second;
+        } else {
+            auto it = numGroup.find(node.op == OP_BOOL_EQ ? node.boolean : node.number);
+            if ((found = it != numGroup.end())) g = it->second;
+        }
+        if (found) { first = g; last = g + 1; }
+        return true;
+    }
+
+    if (node.op == OP_STR_EQ || node.op == OP_CODE_EQ) {
+        auto lo = std::lower_bound(strKeys.begin(), strKeys.end(), node.str);
+        first = last = (uint32_t)(lo - strKeys.begin());
+        if (lo != strKeys.end() && *lo == node.str) last++;
+        return true;
+    }
+
+    // the matching keys form one contiguous run of groups
+    double lit = node.op == OP_BOOL_EQ ? node.boolean : node.number;
+    auto lo = numKeys.begin(), hi = numKeys.end();
+    switch (node.op) {
+        case OP_NUM_EQ:
+        case OP_BOOL_EQ:
+            lo = std::lower_bound(numKeys.begin(), numKeys.end(), lit);
+            hi = std::upper_bound(lo, numKeys.end(), lit);
+            break;
+        case OP_NUM_LT: hi = std::lower_bound(numKeys.begin(), numKeys.end(), lit); break;
+        case OP_NUM_LE: hi = std::upper_bound(numKeys.begin(), numKeys.end(), lit); break;
+        case OP_NUM_GT: lo = std::upper_bound(numKeys.begin(), numKeys.end(), lit); break;
+        case OP_NUM_GE: lo = std::lower_bound(numKeys.begin(), numKeys.end(), lit); break;
+        default: return false;
+    }
+    first = (uint32_t)(lo - numKeys.begin());
+    last = std::max(first, (uint32_t)(hi - numKeys.begin()));
+    return true;
+}
+
+size_t ColumnIndex::estimate(const PredNode& node) const {
+    uint32_t first, last;
+    if (!groupRange(node, first, last)) return SIZE_MAX;
+    return groupStart[last] - groupStart[first];
+}
+
+void ColumnIndex::lookup(const PredNode& node, vector<uint32_t>& rows) const {
+    rows.clear();
+    uint32_t first, last;
+    if (!groupRange(node, first, last) || first >= last) return;
+    rows.assign(rowIds.begin() + groupStart[first], rowIds.begin() + groupStart[last]);
+    // several groups: restore input order
+    if (last - first > 1) std::sort(rows.begin(), rows.end());
+}
+
+bool createIndex(Table& t, const string& field, IndexKind kind) {
+    int c = t.findColumn(field);
+    if (c < 0) {
+        diagnostics() << "Index error: unknown field '" << field << "'\n";
+        return false;
+    }
+    t.addIndex(ColumnIndex::build(t, c, kind));
+    return true;
+}
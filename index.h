@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "compiler.h"
+#include "symbol_table.h"
+
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+class Table;
+
+enum IndexKind {
+    INDEX_HASH,     // equality lookups
+    INDEX_SORTED    // equality and range lookups
+};
+
+// Secondary index on one column. Rows are grouped by distinct key and
+// each group lists its row ids in ascending order. A hash index finds a
+// group through a hash map; a sorted index keeps the groups ordered by key
+// and binary-searches them. Keys are copied out of the table, so the index
+// stays valid for any copy of the rows it was built from. NaN values are
+// left out, since no comparison can select them.
+class ColumnIndex {
+public:
+    static shared_ptr<ColumnIndex> build(const Table& t, int column, IndexKind kind);
+
+    IndexKind kind() const { return indexKind; }
+    int column() const { return col; }
+    size_t distinctKeys() const { return groupStart.empty() ? 0 : groupStart.size() - 1; }
+
+    // True if lookup() can answer the comparison `node`.
+    bool canAnswer(const PredNode& node) const;
+    // Exact number of rows lookup() would return for `node`.
+    size_t estimate(const PredNode& node) const;
+    // Row ids satisfying `node`, ascending.
+    void lookup(const PredNode& node, vector<uint32_t>& rows) const;
+
+private:
+    IndexKind indexKind = INDEX_HASH;
+    int col = -1;
+    FieldType type = FT_NUMBER;
+
+    vector<uint32_t> rowIds;        // grouped by key
+    vector<uint32_t> groupStart;    // group g is rowIds[groupStart[g], groupStart[g+1])
+
+    // Number and bool keys (bools as 0/1) or string keys, one per group.
+    // Sorted for INDEX_SORTED.
+    vector<double> numKeys;
+    vector<string> strKeys;
+    unordered_map<double, uint32_t> numGroup;   // INDEX_HASH only
+    unordered_map<string, uint32_t> strGroup;
+
+    // Groups [first, last) hold the rows matching `node`.
+    bool groupRange(const PredNode& node, uint32_t& first, uint32_t& last) const;
+};
+
+// Builds an index on `field` and attaches it to `t`, replacing any index
+// of the same kind on that field. Prints an error and returns false if
+// the field is unknown.
+bool createIndex(Table& t, const string& field, IndexKind kind);
@@ -0,0 +1,324 @@
+#include "kernels.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+using std::string_view;
+
+struct Eq { bool operator()(double a, double b) const { return a == b; } };
+struct Ne { bool operator()(double a, double b) const { return a != b; } };
+struct Lt { bool operator()(double a, double b) const { return a <  b; } };
+struct Le { bool operator()(double a, double b) const { return a <= b; } };
+struct Gt { bool operator()(double a, double b) const { return a >  b; } };
+struct Ge { bool operator()(double a, double b) const { return a >= b; } };
+
+// Scalar comparison of v[from, n) into the bitmap, used for whole blocks
+// by the scalar kernels and for the ragged tail by the vector ones.
+template <class Cmp>
+static void numScalarFrom(const double* v, size_t from, size_t n, double lit, uint64_t* out) {
+    Cmp cmp;
+    for (size_t w = from / 64; w * 64 < n; ++w) {
+        size_t base = w * 64;
+        size_t m = std::min<size_t>(64, n - base);
+        uint64_t bits = 0;
+        for (size_t j = 0; j < m; ++j) {
+            bits |= (uint64_t)cmp(v[base + j], lit) << j;
+        }
+        out[w] = bits;
+    }
+}
+
+template <class Cmp>
+static void numScalar(const double* v, size_t n, double lit, uint64_t* out) {
+    numScalarFrom<Cmp>(v, 0, n, lit, out);
+}
+
+static void bytesScalarFrom(const uint8_t* v, size_t from, size_t n, uint8_t lit, uint64_t* out) {
+    for (size_t w = from / 64; w * 64 < n; ++w) {
+        size_t base = w * 64;
+        size_t m = std::min<size_t>(64, n - base);
+        uint64_t bits = 0;
+        for (size_t j = 0; j < m; ++j) {
+            bits |= (uint64_t)(v[base + j] == lit) << j;
+        }
+        out[w] = bits;
+    }
+}
+
+static void bytesScalar(const uint8_t* v, size_t n, uint8_t lit, uint64_t* out) {
+    bytesScalarFrom(v, 0, n, lit, out);
+}
+
+static void codesScalarFrom(const uint32_t* v, size_t from, size_t n, uint32_t lit, uint64_t* out) {
+    for (size_t w = from / 64; w * 64 < n; ++w) {
+        size_t base = w * 64;
+        size_t m = std::min<size_t>(64, n - base);
+        uint64_t bits = 0;
+        for (size_t j = 0; j < m; ++j) {
+            bits |= (uint64_t)(v[base + j] == lit) << j;
+        }
+        out[w] = bits;
+    }
+}
+
+static void codesScalar(const uint32_t* v, size_t n, uint32_t lit, uint64_t* out) {
+    codesScalarFrom(v, 0, n, lit, out);
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// SSE2 is part of the x86-64 baseline, so these need no target attribute.
+struct SseEq { __m128d operator()(__m128d a, __m128d b) const { return _mm_cmpeq_pd(a, b); } };
+struct SseNe { __m128d operator()(__m128d a, __m128d b) const { return _mm_cmpneq_pd(a, b); } };
+struct SseLt { __m128d operator()(__m128d a, __m128d b) const { return _mm_cmplt_pd(a, b); } };
+struct SseLe { __m128d operator()(__m128d a, __m128d b) const { return _mm_cmple_pd(a, b); } };
+struct SseGt { __m128d operator()(__m128d a, __m128d b) const { return _mm_cmpgt_pd(a, b); } };
+struct SseGe { __m128d operator()(__m128d a, __m128d b) const { return _mm_cmpge_pd(a, b); } };
+
+template <class VecCmp, class Cmp>
+static void numSse2(const double* v, size_t n, double lit, uint64_t* out) {
+    VecCmp cmp;
+    __m128d l = _mm_set1_pd(lit);
+    size_t full = n / 64;
+    for (size_t w = 0; w < full; ++w) {
+        const double* p = v + w * 64;
+        uint64_t bits = 0;
+        for (int k = 0; k < 32; ++k) {
+            __m128d x = _mm_loadu_pd(p + 2 * k);
+            bits |= (uint64_t)_mm_movemask_pd(cmp(x, l)) << (2 * k);
+        }
+        out[w] = bits;
+    }
+    numScalarFrom<Cmp>(v, full * 64, n, lit, out);
+}
+
+static void bytesSse2(const uint8_t* v, size_t n, uint8_t lit, uint64_t* out) {
+    __m128i l = _mm_set1_epi8((char)lit);
+    size_t full = n / 64;
+    for (size_t w = 0; w < full; ++w) {
+        const uint8_t* p = v + w * 64;
+        uint64_t bits = 0;
+        for (int k = 0; k < 4; ++k) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+            bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, l)) << (16 * k);
+        }
+        out[w] = bits;
+    }
+    bytesScalarFrom(v, full * 64, n, lit, out);
+}
+
+static void codesSse2(const uint32_t* v, size_t n, uint32_t lit, uint64_t* out) {
+    __m128i l = _mm_set1_epi32((int)lit);
+    size_t full = n / 64;
+    for (size_t w = 0; w < full; ++w) {
+        const uint32_t* p = v + w * 64;
+        uint64_t bits = 0;
+        for (int k = 0; k < 16; ++k) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(p + 4 * k));
+            __m128 eq = _mm_castsi128_ps(_mm_cmpeq_epi32(x, l));
+            bits |= (uint64_t)_mm_movemask_ps(eq) << (4 * k);
+        }
+        out[w] = bits;
+    }
+    codesScalarFrom(v, full * 64, n, lit, out);
+}
+
+template <int Pred, class Cmp>
+__attribute__((target("avx2")))
+static void numAvx2(const double* v, size_t n, double lit, uint64_t* out) {
+    __m256d l = _mm256_set1_pd(lit);
+    size_t full = n / 64;
+    for (size_t w = 0; w < full; ++w) {
+        const double* p = v + w * 64;
+        uint64_t bits = 0;
+        for (int k = 0; k < 16; ++k) {
+            __m256d x = _mm256_loadu_pd(p + 4 * k);
+            bits |= (uint64_t)_mm256_movemask_pd(_mm256_cmp_pd(x, l, Pred)) << (4 * k);
+        }
+        out[w] = bits;
+    }
+    numScalarFrom<Cmp>(v, full * 64, n, lit, out);
+}
+
+__attribute__((target("avx2")))
+static void bytesAvx2(const uint8_t* v, size_t n, uint8_t lit, uint64_t* out) {
+    __m256i l = _mm256_set1_epi8((char)lit);
+    size_t full = n / 64;
+    for (size_t w = 0; w < full; ++w) {
+        const uint8_t* p = v + w * 64;
+        __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+        uint64_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, l));
+        bits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, l)) << 32;
+        out[w] = bits;
+    }
+    bytesScalarFrom(v, full * 64, n, lit, out);
+}
+
+__attribute__((target("avx2")))
+static void codesAvx2(const uint32_t* v, size_t n, uint32_t lit, uint64_t* out) {
+    __m256i l = _mm256_set1_epi32((int)lit);
+    size_t full = n / 64;
+    for (size_t w = 0; w < full; ++w) {
+        const uint32_t* p = v + w * 64;
+        uint64_t bits = 0;
+        for (int k = 0; k < 8; ++k) {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(p + 8 * k));
+            __m256 eq = _mm256_castsi256_ps(_mm256_cmpeq_epi32(x, l));
+            bits |= (uint64_t)_mm256_movemask_ps(eq) << (8 * k);
+        }
+        out[w] = bits;
+    }
+    codesScalarFrom(v, full * 64, n, lit, out);
+}
+
+#endif
+
+typedef void (*NumKernel)(const double*, size_t, double, uint64_t*);
+typedef void (*ByteKernel)(const uint8_t*, size_t, uint8_t, uint64_t*);
+typedef void (*CodeKernel)(const uint32_t*, size_t, uint32_t, uint64_t*);
+
+// Kernels indexed by op - OP_NUM_EQ.
+struct KernelSet {
+    NumKernel num[6];
+    ByteKernel bytes;
+    CodeKernel codes;
+};
+
+static const KernelSet scalarKernels = {
+    { numScalar<Eq>, numScalar<Ne>, numScalar<Lt>, numScalar<Le>, numScalar<Gt>, numScalar<Ge> },
+    bytesScalar,
+    codesScalar
+};
+
+#ifdef HAVE_X86_KERNELS
+static const KernelSet sse2Kernels = {
+    { numSse2<SseEq, Eq>, numSse2<SseNe, Ne>, numSse2<SseLt, Lt>,
+      numSse2<SseLe, Le>, numSse2<SseGt, Gt>, numSse2<SseGe, Ge> },
+    bytesSse2,
+    codesSse2
+};
+
+static const KernelSet avx2Kernels = {
+    { numAvx2<_CMP_EQ_OQ, Eq>, numAvx2<_CMP_NEQ_UQ, Ne>, numAvx2<_CMP_LT_OQ, Lt>,
+      numAvx2<_CMP_LE_OQ, Le>, numAvx2<_CMP_GT_OQ, Gt>, numAvx2<_CMP_GE_OQ, Ge> },
+    bytesAvx2,
+    codesAvx2
+};
+#endif
+
+static KernelIsa detectIsa() {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return ISA_AVX2;
+    return ISA_SSE2;
+#else
+    return ISA_SCALAR;
+#endif
+}
+
+static const KernelSet* kernelsFor(KernelIsa isa) {
+#ifdef HAVE_X86_KERNELS
+    if (isa == ISA_AVX2) return &avx2Kernels;
+    if (isa == ISA_SSE2) return &sse2Kernels;
+#endif
+    (void)isa;
+    return &scalarKernels;
+}
+
+static const KernelIsa detectedIsa = detectIsa();
+static KernelIsa currentIsa = detectedIsa;
+static const KernelSet* active = kernelsFor(detectedIsa);
+
+KernelIsa bestKernelIsa() { return detectedIsa; }
+KernelIsa activeKernelIsa() { return currentIsa; }
+
+void setKernelIsa(KernelIsa isa) {
+    if (isa > detectedIsa) isa = detectedIsa;
+    currentIsa = isa;
+    active = kernelsFor(isa);
+}
+
+const char* kernelIsaName(KernelIsa isa) {
+    switch (isa) {
+        case ISA_SCALAR: return "scalar";
+        case ISA_SSE2:   return "sse2";
+        case ISA_AVX2:   return "avx2";
+    }
+    return "unknown";
+}
+
+void compareNumbers(OpCode op, const double* v, size_t n, double lit, uint64_t* out) {
+    active->num[op - OP_NUM_EQ](v, n, lit, out);
+}
+
+void equalBytes(const uint8_t* v, size_t n, uint8_t lit, uint64_t* out) {
+    active->bytes(v, n, lit, out);
+}
+
+void compareCodes(bool equal, const uint32_t* v, size_t n, uint32_t lit, uint64_t* out) {
+    active->codes(v, n, lit, out);
+    if (equal) return;
+    uint64_t valid[BLOCK_WORDS];
+    fillBitmap(n, valid);
+    for (size_t w = 0; w < bitmapWords(n); ++w) out[w] = ~out[w] & valid[w];
+}
+
+template <bool Equal>
+static void stringsScalar(const uint64_t* offsets, const char* blob,
+                          size_t n, string_view lit, uint64_t* out) {
+    for (size_t w = 0; w * 64 < n; ++w) {
+        size_t base = w * 64;
+        size_t m = std::min<size_t>(64, n - base);
+        uint64_t bits = 0;
+        for (size_t j = 0; j < m; ++j) {
+            uint64_t b = offsets[base + j], e = offsets[base + j + 1];
+            bool eq = e - b == lit.size() && memcmp(blob + b, lit.data(), lit.size()) == 0;
+            bits |= (uint64_t)(Equal ? eq : !eq) << j;
+        }
+        out[w] = bits;
+    }
+}
+
+void compareStrings(bool equal, const uint64_t* offsets, const char* blob,
+                    size_t n, string_view lit, uint64_t* out) {
+    if (equal) stringsScalar<true>(offsets, blob, n, lit, out);
+    else stringsScalar<false>(offsets, blob, n, lit, out);
+}
+
+// Runs `test(j)` for each row j of the block into the bitmap.
+template <typename Test>
+static void memberBits(size_t n, uint64_t* out, Test test) {
+    for (size_t w = 0; w * 64 < n; ++w) {
+        size_t base = w * 64;
+        size_t m = std::min<size_t>(64, n - base);
+        uint64_t bits = 0;
+        for (size_t j = 0; j < m; ++j) bits |= (uint64_t)test(base + j) << j;
+        out[w] = bits;
+    }
+}
+
+void memberNumbers(const double* v, size_t n, const ValueSet& set, uint64_t* out) {
+    memberBits(n, out, [&](size_t j) { return set.hasNumber(v[j]); });
+}
+
+void memberStrings(const uint64_t* offsets, const char* blob, size_t n,
+                   const ValueSet& set, uint64_t* out) {
+    memberBits(n, out, [&](size_t j) {
+        return set.hasString(string_view(blob + offsets[j], offsets[j + 1] - offsets[j]));
+    });
+}
+
+void memberCodes(const uint32_t* v, size_t n, const ValueSet& set, uint64_t* out) {
+    memberBits(n, out, [&](size_t j) { return set.hasCode(v[j]); });
+}
+
+void fillBitmap(size_t n, uint64_t* out) {
+    size_t words = bitmapWords(n);
+    for (size_t w = 0; w < words; ++w) out[w] = ~0ULL;
+    if (n % 64) out[words - 1] = (1ULL << (n % 64)) - 1;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "compiler.h"
+
+// Predicates are evaluated a block of rows at a time. Each kernel writes a
+// selection bitmap: bit j of out[j/64] is set when row j of the block
+// passes. Bits past `n` in the last word are always left clear.
+const size_t BLOCK_ROWS = 1024;
+const size_t BLOCK_WORDS = BLOCK_ROWS / 64;
+
+inline size_t bitmapWords(size_t n) { return (n + 63) / 64; }
+
+enum KernelIsa { ISA_SCALAR, ISA_SSE2, ISA_AVX2 };
+
+// The best instruction set this CPU supports, detected once at startup.
+KernelIsa bestKernelIsa();
+KernelIsa activeKernelIsa();
+// Selects the kernels to use; requests above bestKernelIsa() are clamped.
+void setKernelIsa(KernelIsa isa);
+const char* kernelIsaName(KernelIsa isa);
+
+// `op` is one of the OP_NUM_* opcodes.
+void compareNumbers(OpCode op, const double* v, size_t n, double lit, uint64_t* out);
+// out bit set where v[j] == lit.
+void equalBytes(const uint8_t* v, size_t n, uint8_t lit, uint64_t* out);
+// Strings stored as blob[offsets[j], offsets[j+1]); `equal` selects = or !=.
+void compareStrings(bool equal, const uint64_t* offsets, const char* blob,
+                    size_t n, std::string_view lit, uint64_t* out);
+
+// Dictionary codes; `equal` selects = or !=.
+void compareCodes(bool equal, const uint32_t* v, size_t n, uint32_t lit, uint64_t* out);
+
+// Set membership (OP_*_IN): out bit set where the value is in `set`.
+// These are scalar; the lookups do not vectorise.
+void memberNumbers(const double* v, size_t n, const ValueSet& set, uint64_t* out);
+void memberStrings(const uint64_t* offsets, const char* blob, size_t n,
+                   const ValueSet& set, uint64_t* out);
+void memberCodes(const uint32_t* v, size_t n, const ValueSet& set, uint64_t* out);
+
+// Sets the first n bits.
+void fillBitmap(size_t n, uint64_t* out);
@@ -1,42 +1,304 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
 #include "tokenizer.h"
 #include "parser.h"
 #include "evaluator.h"
 #include "symbol_table.h"
+#include "catalog.h"
+#include "column_file.h"
+#include "query_cache.h"
+#include "explain.h"
+#include "print_sink.h"
+#include "server.h"
 
 using namespace std;
 
-static void printTable(const Table& t) {
-    if (t.empty()) {
-        cout << "(no rows)\n";
-        return;
+// Registers "name=path" with the catalog.
+static bool addTableArg(Catalog& catalog, const string& spec) {
+    size_t eq = spec.find('=');
+    if (eq == string::npos || eq == 0 || eq + 1 == spec.size()) {
+        cerr << "Expected NAME=PATH, got '" << spec << "'\n";
+        return false;
     }
-    // Print header from first row's keys
-    const Row& first = t[0];
-    for (auto it = first.begin(); it != first.end(); ++it) {
-        cout << it->first;
-        if (next(it) != first.end()) cout << "\t";
+    catalog.addFile(spec.substr(0, eq), spec.substr(eq + 1));
+    return true;
+}
+
+// Reads a catalog file of "name path" lines; '#' starts a comment.
+static bool loadCatalogFile(Catalog& catalog, const string& path) {
+    ifstream in(path);
+    if (!in) {
+        cerr << "Cannot open catalog '" << path << "'\n";
+        return false;
+    }
+    string line;
+    while (getline(in, line)) {
+        size_t hash = line.find('#');
+        if (hash != string::npos) line.erase(hash);
+        istringstream ls(line);
+        string name, file;
+        if (!(ls >> name)) continue;
+        if (!(ls >> file)) {
+            cerr << path << ": missing path for table '" << name << "'\n";
+            return false;
+        }
+        catalog.addFile(name, file);
+    }
+    return true;
+}
+
+// Writes the catalog table "name" to "path" in the column file format.
+static bool exportTable(Catalog& catalog, const string& spec) {
+    size_t eq = spec.find('=');
+    if (eq == string::npos || eq == 0 || eq + 1 == spec.size()) {
+        cerr << "Expected NAME=PATH, got '" << spec << "'\n";
+        return false;
     }
-    cout << "\n";
+    shared_ptr<const Table> t = catalog.lookup(spec.substr(0, eq));
+    return t && writeColumnFile(*t, spec.substr(eq + 1));
+}
 
-    for (const Row& r : t) {
-        for (auto it = first.begin(); it != first.end(); ++it) {
-            auto jt = r.find(it->first);
-            if (jt != r.end()) cout << jt->second;
-            if (next(it) != first.end()) cout << "\t";
+// Builds the index described by "table.field[:hash|sorted]".
+static bool indexArg(Catalog& catalog, const string& spec) {
+    size_t dot = spec.find('.');
+    size_t colon = spec.find(':', dot == string::npos ? 0 : dot);
+    if (dot == string::npos || dot == 0 || dot + 1 >= colon) {
+        cerr << "Expected TABLE.FIELD[:hash|sorted], got '" << spec << "'\n";
+        return false;
+    }
+    IndexKind kind = INDEX_HASH;
+    if (colon != string::npos) {
+        string k = spec.substr(colon + 1);
+        if (k == "sorted") kind = INDEX_SORTED;
+        else if (k != "hash") {
+            cerr << "Unknown index kind '" << k << "' (expected hash or sorted)\n";
+            return false;
+        }
+    }
+    string field = spec.substr(dot + 1, colon == string::npos ? string::npos : colon - dot - 1);
+    return catalog.createIndex(spec.substr(0, dot), field, kind);
+}
+
+// Runs every query in `text` (separated by blank lines), sharing one scan
+// per table, and prints the results in input order.
+static bool runBatch(Catalog& catalog, const string& text, const EvalOptions& opts) {
+    vector<shared_ptr<PreparedQuery>> queries;
+    istringstream in(text);
+    string line, query;
+    while (true) {
+        bool more = (bool)getline(in, line);
+        if (more && line.find_first_not_of(" \t\r") != string::npos) {
+            query += line + "\n";
+            continue;
         }
-        cout << "\n";
+        if (!query.empty()) {
+            queries.push_back(prepareQuery(catalog, query, "query " + to_string(queries.size() + 1)));
+            query.clear();
+        }
+        if (!more) break;
+    }
+
+    // group the queries by the table they read
+    map<const Table*, vector<size_t>> groups;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        if (!queries[i]) continue;
+        if (!queries[i]->plan.params.empty()) {
+            cerr << "query " << i + 1 << ": parameters are not supported in batch mode\n";
+            queries[i] = nullptr;
+            continue;
+        }
+        if (queries[i]->explain != EXPLAIN_NONE) {
+            cerr << "query " << i + 1 << ": EXPLAIN is not supported in batch mode\n";
+            queries[i] = nullptr;
+            continue;
+        }
+        groups[queries[i]->table.get()].push_back(i);
+    }
+    vector<Table> results(queries.size());
+    for (const auto& g : groups) {
+        vector<const CompiledQuery*> plans;
+        for (size_t i : g.second) plans.push_back(&queries[i]->plan);
+        vector<Table> out = evaluateBatch(plans, *g.first, opts);
+        for (size_t k = 0; k < g.second.size(); ++k) results[g.second[k]] = std::move(out[k]);
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        if (i) cout << "\n";
+        cout << "Query " << i + 1 << ":\n";
+        if (queries[i]) printTable(results[i]);
+        else {
+            cout << "(failed)\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Prints the per-node counters of the last scan to stderr, one line per
+// WHERE node, indented by nesting.
+static void printStats(const vector<FactorStats>& stats) {
+    if (stats.empty()) return;
+    cerr << "node\tpos\trows\tpass%\tns/row\tpredicate\n";
+    for (const FactorStats& s : stats) {
+        char line[96];
+        snprintf(line, sizeof line, "%u\t%d\t%llu\t%.1f\t%.2f\t", s.node, s.position,
+                 (unsigned long long)s.rows, s.passRate() * 100, s.nanosPerRow());
+        cerr << line << string(2 * s.depth, ' ') << s.text << "\n";
+    }
+}
+
+// Upper bounds for --threads/--workers and --queue.
+const long MAX_THREADS = 1024;
+const long MAX_QUEUE = 1 << 20;
+
+// Parses the value of a count option such as --threads: a whole number
+// from 1 to `max`, with nothing after it. Prints why and returns false
+// otherwise.
+static bool parseCount(const string& flag, const char* text, long max, long& out) {
+    char* end = nullptr;
+    errno = 0;
+    out = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || out < 1 || out > max) {
+        cerr << "Expected a number from 1 to " << max << " for " << flag
+             << ", got '" << text << "'\n";
+        return false;
+    }
+    return true;
+}
+
+static void usage(const char* prog) {
+    cerr << "usage: " << prog << " [--threads N] [--batch] [--stats] [--table NAME=PATH]... [--catalog FILE]"
+         << " [--index TABLE.FIELD[:hash|sorted]]... [--export NAME=PATH]..."
+         << " [--param VALUE]... [--serve SOCKET | --serve-stdio] [--workers N] [--queue N]\n";
+}
+
+// Answers queries on a Unix domain socket until SIGINT or SIGTERM, or on
+// stdin and stdout until end of input when `socketPath` is empty.
+static int runServer(Catalog& catalog, const ServerOptions& opts, const string& socketPath) {
+    signal(SIGPIPE, SIG_IGN);
+    if (socketPath.empty()) {
+        QueryServer server(catalog, opts);
+        server.serve(0, 1);
+        return 0;
     }
+    // block the stop signals in every server thread so that sigwait gets them
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+    QueryServer server(catalog, opts);
+    if (!server.listen(socketPath)) return 1;
+    cerr << "Serving on " << socketPath << " with " << opts.workers << " workers\n";
+    int sig;
+    sigwait(&stopSignals, &sig);
+    server.stop();
+    cerr << "Stopped after " << server.served() << " queries\n";
+    return 0;
 }
 
-int main() {
-    Table customers = {
+int main(int argc, char** argv) {
+    EvalOptions opts;
+    opts.threads = std::max(1u, thread::hardware_concurrency());
+    Catalog catalog;
+    vector<string> tableArgs, catalogFiles, exports, indexArgs, params;
+    bool batch = false, serve = false, threadsGiven = false;
+    string socketPath;
+    ServerOptions serverOpts;
+    serverOpts.workers = opts.threads;
+    ScanStats stats;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        long count;
+        if (arg == "--threads" && i + 1 < argc) {
+            if (!parseCount(arg, argv[++i], MAX_THREADS, count)) return 1;
+            opts.threads = (unsigned)count;
+            threadsGiven = true;
+        } else if (arg == "--table" && i + 1 < argc) {
+            tableArgs.push_back(argv[++i]);
+        } else if (arg == "--catalog" && i + 1 < argc) {
+            catalogFiles.push_back(argv[++i]);
+        } else if (arg == "--index" && i + 1 < argc) {
+            indexArgs.push_back(argv[++i]);
+        } else if (arg == "--export" && i + 1 < argc) {
+            exports.push_back(argv[++i]);
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg == "--stats") {
+            opts.stats = &stats;
+        } else if (arg == "--param" && i + 1 < argc) {
+            params.push_back(argv[++i]);
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serve = true;
+            socketPath = argv[++i];
+        } else if (arg == "--serve-stdio") {
+            serve = true;
+        } else if (arg == "--workers" && i + 1 < argc) {
+            if (!parseCount(arg, argv[++i], MAX_THREADS, count)) return 1;
+            serverOpts.workers = (unsigned)count;
+        } else if (arg == "--queue" && i + 1 < argc) {
+            if (!parseCount(arg, argv[++i], MAX_QUEUE, count)) return 1;
+            serverOpts.queueDepth = (size_t)count;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    SymbolTable customerSchema;
+    customerSchema.addField("name",   FT_STRING);
+    customerSchema.addField("age",    FT_NUMBER);
+    customerSchema.addField("status", FT_STRING);
+    customerSchema.addField("active", FT_BOOL);
+
+    Table customers = Table::fromRows(customerSchema, {
         { {"name","Alice"}, {"age","25"}, {"status","vip"}, {"active","true"} },
         { {"name","Ben"}, {"age","22"}, {"status","regular"}, {"active","true"} },
         { {"name","Bob"},   {"age","19"}, {"status","regular"}, {"active","true"} },
         { {"name","Carol"}, {"age","42"}, {"status","regular"}, {"active","false"} },
         { {"name","Ava"}, {"age","19"}, {"status","vip"}, {"active","false"} },
-    };
+    });
+    catalog.addTable("customers", std::move(customers));
+
+    // files named on the command line may override the built-in table
+    for (const auto& f : catalogFiles) {
+        if (!loadCatalogFile(catalog, f)) return 1;
+    }
+    for (const auto& t : tableArgs) {
+        if (!addTableArg(catalog, t)) return 1;
+    }
+    for (const auto& ix : indexArgs) {
+        if (!indexArg(catalog, ix)) return 1;
+    }
+    if (!exports.empty()) {
+        for (const auto& e : exports) {
+            if (!exportTable(catalog, e)) return 1;
+        }
+        return 0;
+    }
+
+    if (serve) {
+        // the workers already run queries side by side
+        serverOpts.eval = opts;
+        if (!threadsGiven) serverOpts.eval.threads = 1;
+        serverOpts.eval.stats = nullptr;
+        return runServer(catalog, serverOpts, socketPath);
+    }
+
+    if (batch) {
+        // queries are separated by blank lines and end at end of input
+        ostringstream all;
+        all << cin.rdbuf();
+        return runBatch(catalog, all.str(), opts) ? 0 : 1;
+    }
 
     cout << "Enter query:\n";
     string input, line;
@@ -46,25 +308,12 @@ int main() {
         input += line + "\n";
     }
 
-    setFilename("stdin");
-
-    Query q;
-    if (!parseQuery(input, q)) {
-        cerr << "Parse failed.\n";
-        return 1;
-    }
-
-    SymbolTable schema;
-    schema.addField("name",   FT_STRING);
-    schema.addField("age",    FT_NUMBER);
-    schema.addField("status", FT_STRING);
-    schema.addField("active", FT_BOOL);
-
-    if (!checkQuerySemantics(q, schema)) {
-        cerr << "Semantic check failed. Aborting.\n";
-        return 1;
-    }
+    PhaseTimings timings;
+    shared_ptr<PreparedQuery> q = prepareQuery(catalog, input, "stdin", &timings);
+    if (!q) return 1;
+    if (q->explain != EXPLAIN_NONE) return runExplain(*q, params, opts, timings, cout) ? 0 : 1;
 
-    Table out = evaluateQuery(q, customers);
-    printTable(out);
+    PrintSink sink;
+    if (!executePrepared(*q, params, sink, opts)) return 1;
+    printStats(stats.nodes);
 }
@@ -0,0 +1,50 @@
+#include "mapped_file.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "diagnostics.h"
+
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const string& path, bool populate) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        diagnostics() << "Load error: cannot open '" << path << "': " << strerror(errno) << "\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        diagnostics() << "Load error: cannot stat '" << path << "': " << strerror(errno) << "\n";
+        ::close(fd);
+        return false;
+    }
+    length = (size_t)st.st_size;
+    if (length == 0) {
+        ::close(fd);
+        return true;
+    }
+    void* p = mmap(nullptr, length, PROT_READ,
+                   MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        diagnostics() << "Load error: cannot map '" << path << "': " << strerror(errno) << "\n";
+        length = 0;
+        return false;
+    }
+    if (!populate) madvise(p, length, MADV_SEQUENTIAL);
+    base = (const char*)p;
+    return true;
+}
+
+void MappedFile::close() {
+    if (base) munmap((void*)base, length);
+    base = nullptr;
+    length = 0;
+}
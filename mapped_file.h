@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+using std::string;
+
+// Read-only memory mapping of a whole file. Unmapped on destruction.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps `path`, printing an error and returning false on failure.
+    // An empty file maps successfully with size() == 0. `populate` reads
+    // the whole file in up front, for callers that will touch every page.
+    bool open(const string& path, bool populate = false);
+    void close();
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+};
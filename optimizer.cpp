@@ -0,0 +1,342 @@
+#include "optimizer.h"
+#include <algorithm>
+#include <map>
+
+// The program as a tree while it is rewritten; `pred.end` is recomputed
+// when the tree is written back out.
+struct Node {
+    PredNode pred;
+    vector<Node> kids;      // AND/OR only
+};
+
+static Node toTree(const vector<PredNode>& prog, uint32_t i) {
+    Node n;
+    n.pred = prog[i];
+    if (n.pred.op == OP_AND || n.pred.op == OP_OR) {
+        for (uint32_t c = i + 1; c < prog[i].end; c = prog[c].end) {
+            n.kids.push_back(toTree(prog, c));
+        }
+    }
+    return n;
+}
+
+static void emit(const Node& n, vector<PredNode>& out) {
+    size_t at = out.size();
+    out.push_back(n.pred);
+    for (const Node& k : n.kids) emit(k, out);
+    out[at].end = (uint32_t)out.size();
+}
+
+static Node constant(bool value) {
+    Node n;
+    n.pred.op = value ? OP_TRUE : OP_FALSE;
+    n.pred.end = 0;
+    return n;
+}
+
+// A comparison on the same field as `base`.
+static Node leaf(const PredNode& base, OpCode op) {
+    Node n;
+    n.pred = base;
+    n.pred.op = op;
+    n.pred.set = nullptr;
+    return n;
+}
+
+static Node numberLeaf(const PredNode& base, OpCode op, double v) {
+    Node n = leaf(base, op);
+    n.pred.number = v;
+    return n;
+}
+
+static Node stringLeaf(const PredNode& base, OpCode op, const string& s) {
+    Node n = leaf(base, op);
+    n.pred.str = s;
+    return n;
+}
+
+static bool isNumberCompare(OpCode op) {
+    return op >= OP_NUM_EQ && op <= OP_NUM_GE;
+}
+
+// Comparisons that mergeGroup knows how to combine under an AND or OR.
+static bool mergeable(OpCode op, bool isAnd) {
+    if (isNumberCompare(op) || op == OP_BOOL_EQ || op == OP_STR_EQ || op == OP_STR_NE) return true;
+    return !isAnd && (op == OP_NUM_IN || op == OP_STR_IN);
+}
+
+// Lower and upper bounds on a number field; `incl` marks <= and >=.
+struct Bounds {
+    bool hasLo = false, loIncl = false;
+    bool hasHi = false, hiIncl = false;
+    double lo = 0, hi = 0;
+
+    bool lowerAdmits(double v) const { return hasLo && (v > lo || (v == lo && loIncl)); }
+    bool upperAdmits(double v) const { return hasHi && (v < hi || (v == hi && hiIncl)); }
+    bool admits(double v) const {
+        return (!hasLo || lowerAdmits(v)) && (!hasHi || upperAdmits(v));
+    }
+};
+
+static void sortUnique(vector<double>& v) {
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+static void sortUnique(vector<string>& v) {
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+// Comparisons on one number field under an AND: the tightest bounds, or
+// a single equality, plus the != tests inside them. False if no value
+// can pass them all.
+static bool mergeNumbersAnd(const vector<const PredNode*>& preds, vector<Node>& out) {
+    const PredNode& base = *preds[0];
+    Bounds b;
+    bool hasEq = false;
+    double eq = 0;
+    vector<double> ne;
+    for (const PredNode* p : preds) {
+        double x = p->number;
+        switch (p->op) {
+            case OP_NUM_EQ:
+                if (hasEq && eq != x) return false;
+                hasEq = true;
+                eq = x;
+                break;
+            case OP_NUM_NE:
+                ne.push_back(x);
+                break;
+            case OP_NUM_LT:
+                if (!b.hasHi || x < b.hi || (x == b.hi && b.hiIncl)) b.hi = x, b.hiIncl = false;
+                b.hasHi = true;
+                break;
+            case OP_NUM_LE:
+                if (!b.hasHi || x < b.hi) b.hi = x, b.hiIncl = true;
+                b.hasHi = true;
+                break;
+            case OP_NUM_GT:
+                if (!b.hasLo || x > b.lo || (x == b.lo && b.loIncl)) b.lo = x, b.loIncl = false;
+                b.hasLo = true;
+                break;
+            default:    // OP_NUM_GE
+                if (!b.hasLo || x > b.lo) b.lo = x, b.loIncl = true;
+                b.hasLo = true;
+                break;
+        }
+    }
+    if (b.hasLo && b.hasHi) {
+        if (b.lo > b.hi || (b.lo == b.hi && !(b.loIncl && b.hiIncl))) return false;
+        if (b.lo == b.hi && !hasEq) {
+            hasEq = true;
+            eq = b.lo;
+        }
+    }
+    if (hasEq) {
+        if (!b.admits(eq)) return false;
+        for (double v : ne) if (v == eq) return false;
+        out.push_back(numberLeaf(base, OP_NUM_EQ, eq));
+        return true;
+    }
+    if (b.hasLo) out.push_back(numberLeaf(base, b.loIncl ? OP_NUM_GE : OP_NUM_GT, b.lo));
+    if (b.hasHi) out.push_back(numberLeaf(base, b.hiIncl ? OP_NUM_LE : OP_NUM_LT, b.hi));
+    sortUnique(ne);
+    for (double v : ne) {
+        if (b.admits(v)) out.push_back(numberLeaf(base, OP_NUM_NE, v));
+    }
+    return true;
+}
+
+// Comparisons on one number field under an OR. `f != x` passes every row
+// but those equal to x (NaN included), so with one present the group is
+// either always true or just that test. Otherwise the loosest bound in
+// each direction is kept, with the equalities it does not cover. False if
+// the group is always true.
+static bool mergeNumbersOr(const vector<const PredNode*>& preds, vector<Node>& out) {
+    const PredNode& base = *preds[0];
+    Bounds b;
+    vector<double> eqs, ne;
+    for (const PredNode* p : preds) {
+        double x = p->number;
+        switch (p->op) {
+            case OP_NUM_EQ:
+                eqs.push_back(x);
+                break;
+            case OP_NUM_IN:
+                eqs.insert(eqs.end(), p->set->numbers.begin(), p->set->numbers.end());
+                break;
+            case OP_NUM_NE:
+                ne.push_back(x);
+                break;
+            case OP_NUM_LT:
+                if (!b.hasHi || x > b.hi) b.hi = x, b.hiIncl = false;
+                b.hasHi = true;
+                break;
+            case OP_NUM_LE:
+                if (!b.hasHi || x > b.hi || (x == b.hi && !b.hiIncl)) b.hi = x, b.hiIncl = true;
+                b.hasHi = true;
+                break;
+            case OP_NUM_GT:
+                if (!b.hasLo || x < b.lo) b.lo = x, b.loIncl = false;
+                b.hasLo = true;
+                break;
+            default:    // OP_NUM_GE
+                if (!b.hasLo || x < b.lo || (x == b.lo && !b.loIncl)) b.lo = x, b.loIncl = true;
+                b.hasLo = true;
+                break;
+        }
+    }
+    sortUnique(eqs);
+    sortUnique(ne);
+    if (!ne.empty()) {
+        double x = ne[0];
+        if (ne.size() > 1 || b.lowerAdmits(x) || b.upperAdmits(x)) return false;
+        if (std::find(eqs.begin(), eqs.end(), x) != eqs.end()) return false;
+        out.push_back(numberLeaf(base, OP_NUM_NE, x));
+        return true;
+    }
+    if (b.hasLo) out.push_back(numberLeaf(base, b.loIncl ? OP_NUM_GE : OP_NUM_GT, b.lo));
+    if (b.hasHi) out.push_back(numberLeaf(base, b.hiIncl ? OP_NUM_LE : OP_NUM_LT, b.hi));
+    eqs.erase(std::remove_if(eqs.begin(), eqs.end(), [&](double v) {
+        return b.lowerAdmits(v) || b.upperAdmits(v);
+    }), eqs.end());
+    if (eqs.size() >= IN_MIN_VALUES) {
+        Node in = leaf(base, OP_NUM_IN);
+        in.pred.set = makeNumberSet(std::move(eqs));
+        out.push_back(std::move(in));
+    } else {
+        for (double v : eqs) out.push_back(numberLeaf(base, OP_NUM_EQ, v));
+    }
+    return true;
+}
+
+// = and != on one string field. Under an AND two different equalities,
+// or an equality with its own !=, cannot all pass; under an OR two
+// different !=, or a != with its own equality, always do. Returns false
+// when the group decides its parent.
+static bool mergeStrings(const vector<const PredNode*>& preds, bool isAnd, vector<Node>& out) {
+    const PredNode& base = *preds[0];
+    vector<string> eqs, ne;
+    for (const PredNode* p : preds) {
+        if (p->op == OP_STR_EQ) eqs.push_back(p->str);
+        else if (p->op == OP_STR_NE) ne.push_back(p->str);
+        else eqs.insert(eqs.end(), p->set->strings.begin(), p->set->strings.end());
+    }
+    sortUnique(eqs);
+    sortUnique(ne);
+    auto isEq = [&](const string& s) { return std::binary_search(eqs.begin(), eqs.end(), s); };
+    if (isAnd) {
+        if (eqs.size() > 1) return false;
+        if (eqs.size() == 1) {
+            if (std::binary_search(ne.begin(), ne.end(), eqs[0])) return false;
+            out.push_back(stringLeaf(base, OP_STR_EQ, eqs[0]));
+            return true;
+        }
+        for (const string& s : ne) out.push_back(stringLeaf(base, OP_STR_NE, s));
+        return true;
+    }
+    if (!ne.empty()) {
+        if (ne.size() > 1 || isEq(ne[0])) return false;
+        out.push_back(stringLeaf(base, OP_STR_NE, ne[0]));
+        return true;
+    }
+    if (eqs.size() >= IN_MIN_VALUES) {
+        Node in = leaf(base, OP_STR_IN);
+        in.pred.set = makeStringSet(std::move(eqs));
+        out.push_back(std::move(in));
+    } else {
+        for (const string& s : eqs) out.push_back(stringLeaf(base, OP_STR_EQ, s));
+    }
+    return true;
+}
+
+// Bool tests on one field: both values decide an AND (false) or an OR
+// (true); otherwise one test remains.
+static bool mergeBools(const vector<const PredNode*>& preds, vector<Node>& out) {
+    bool seen[2] = {false, false};
+    for (const PredNode* p : preds) seen[p->boolean ? 1 : 0] = true;
+    if (seen[0] && seen[1]) return false;
+    Node n = leaf(*preds[0], OP_BOOL_EQ);
+    n.pred.boolean = seen[1];
+    out.push_back(std::move(n));
+    return true;
+}
+
+// Merges the comparisons on each field among the children of an AND or
+// OR, in place. Returns false if a field's comparisons alone decide the
+// parent: a contradiction under an AND, a tautology under an OR.
+static bool mergeFields(vector<Node>& kids, bool isAnd) {
+    std::map<int, vector<size_t>> byColumn;
+    for (size_t i = 0; i < kids.size(); ++i) {
+        if (mergeable(kids[i].pred.op, isAnd)) byColumn[kids[i].pred.column].push_back(i);
+    }
+    vector<Node> out;
+    for (size_t i = 0; i < kids.size(); ++i) {
+        if (!mergeable(kids[i].pred.op, isAnd)) {
+            out.push_back(std::move(kids[i]));
+            continue;
+        }
+        const vector<size_t>& group = byColumn[kids[i].pred.column];
+        if (group[0] != i) continue;    // merged with the group's first member
+        vector<const PredNode*> preds;
+        for (size_t g : group) preds.push_back(&kids[g].pred);
+        OpCode op = preds[0]->op;
+        bool keep;
+        if (op == OP_BOOL_EQ) keep = mergeBools(preds, out);
+        else if (op == OP_STR_EQ || op == OP_STR_NE || op == OP_STR_IN) keep = mergeStrings(preds, isAnd, out);
+        else if (isAnd) keep = mergeNumbersAnd(preds, out);
+        else keep = mergeNumbersOr(preds, out);
+        if (!keep) return false;
+    }
+    kids = std::move(out);
+    return true;
+}
+
+static void simplify(Node& n) {
+    OpCode op = n.pred.op;
+    if (op != OP_AND && op != OP_OR) return;
+    bool isAnd = op == OP_AND;
+
+    vector<Node> kids;
+    for (Node& k : n.kids) {
+        simplify(k);
+        if (k.pred.op == op) {
+            for (Node& g : k.kids) kids.push_back(std::move(g));
+        } else {
+            kids.push_back(std::move(k));
+        }
+    }
+
+    // FALSE decides an AND and TRUE an OR; the other constant is dropped
+    OpCode decides = isAnd ? OP_FALSE : OP_TRUE;
+    OpCode neutral = isAnd ? OP_TRUE : OP_FALSE;
+    vector<Node> rest;
+    for (Node& k : kids) {
+        if (k.pred.op == decides) {
+            n = constant(!isAnd);
+            return;
+        }
+        if (k.pred.op != neutral) rest.push_back(std::move(k));
+    }
+    if (!mergeFields(rest, isAnd)) {
+        n = constant(!isAnd);
+        return;
+    }
+    if (rest.empty()) {
+        n = constant(isAnd);
+    } else if (rest.size() == 1) {
+        Node only = std::move(rest[0]);
+        n = std::move(only);
+    } else {
+        n.kids = std::move(rest);
+    }
+}
+
+void optimizeQuery(CompiledQuery& plan) {
+    if (plan.where.empty() || !plan.params.empty()) return;
+    Node root = toTree(plan.where, 0);
+    simplify(root);
+    plan.where.clear();
+    if (root.pred.op != OP_TRUE) emit(root, plan.where);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include "compiler.h"
+
+// Equalities on one field under an OR become a set-membership test once
+// there are this many; below it, the vectorised comparisons are faster.
+const size_t IN_MIN_VALUES = 3;
+
+// Logical rewrites of a compiled WHERE program, run between compiling
+// (or binding parameters) and evaluation. The rows selected never change.
+//  - nested AND/OR of the same kind are flattened
+//  - under an AND, the comparisons on one number field are merged into at
+//    most a lower and an upper bound, or one equality, plus the != tests
+//    that still matter; bool and string tests on one field likewise. A
+//    contradiction such as `age < 10 AND age > 20` becomes FALSE
+//  - under an OR, one-sided bounds on a field keep only the loosest, and
+//    tests implied by others are dropped. A tautology such as
+//    `s = "x" OR s != "x"` becomes TRUE
+//  - IN_MIN_VALUES or more equalities on one field under an OR become a
+//    hashed set-membership test (OP_NUM_IN, OP_STR_IN)
+//  - TRUE and FALSE are folded into their parents
+// A WHERE that folds to TRUE is removed, and one that folds to FALSE is
+// left as a lone OP_FALSE, which evaluation answers without a scan. Plans
+// with unbound parameters are left alone. Number literals must be finite,
+// which compileQuery and bindParameters ensure.
+void optimizeQuery(CompiledQuery& plan);
@@ -1,5 +1,8 @@
 #include "parser.h"
+#include <algorithm>
+#include <cstring>
 #include <sstream>
+#include "diagnostics.h"
 
 using namespace std;
 
@@ -7,132 +10,286 @@ static void indent(ostream& os, int n) {
     for (int i=0;i<n;i++) os << ' ';
 }
 
-static bool accept(string &s, Symbol sym) {
-    Symbol got = peekNext(s);
-    if (got == sym) { (void)getNext(s); return true; }
+static void error(ParseContext &ctx, string msg) {
+    stringstream ss;
+    ss << ctx.filename << ':' << ctx.tokens.line() << ' ' << msg;
+    ctx.errors.push_back(ss.str());
+}
+
+static bool accept(ParseContext &ctx, Symbol sym) {
+    if (ctx.peek() == sym) { ctx.next(); return true; }
     return false;
 }
 
-static bool expect(string &s, Symbol sym, const char* err) {
-    if (accept(s, sym)) return true;
+static bool expect(ParseContext &ctx, Symbol sym, const char* err) {
+    if (accept(ctx, sym)) return true;
     stringstream ss;
     ss << "Expected " ;
     ss << err;
-    syntaxError(ss.str());
+    error(ctx, ss.str());
     return false;
 }
 
-static bool parseFieldList(string &s, Query &q);
-static bool parseBoolExpr(string &s, shared_ptr<BoolExpr>& out);
-static bool parseBoolTerm(string &s, shared_ptr<BoolExpr>& out);
-static bool parseBoolFactor(string &s, shared_ptr<BoolExpr>& out);
-static bool parsePredicate(string &s, shared_ptr<BoolExpr>& out);
+// Parentheses nest this deep at most. The parser and every pass over the
+// WHERE tree recurse once per level, so deeper input would overflow the
+// stack of whichever thread is compiling it.
+static const int MAX_NESTING = 1000;
+
+static bool parseStatement(ParseContext &ctx, Query &out);
+static bool parseFieldList(ParseContext &ctx, Query &q);
+static bool parseSelectItem(ParseContext &ctx, Query &q);
+static bool parseTrailingClauses(ParseContext &ctx, Query &q);
+static bool parseBoolExpr(ParseContext &ctx, Arena &a, const BoolExpr*& out);
+static bool parseBoolTerm(ParseContext &ctx, Arena &a, const BoolExpr*& out);
+static bool parseBoolFactor(ParseContext &ctx, Arena &a, const BoolExpr*& out);
+static bool parsePredicate(ParseContext &ctx, Arena &a, const BoolExpr*& out);
 
 bool parseQuery(string &s, Query &out) {
-    if (!expect(s, SELECTSYM, "SELECT")) return false;
+    ParseContext ctx;
+    bool ok = parseQuery(ctx, s, out);
+    for (const auto& e : ctx.errors) diagnostics() << e << endl;
+    return ok;
+}
+
+bool parseQuery(ParseContext &ctx, string_view src, Query &out) {
+    ctx.tokens.toks.clear();
+    tokenize(src, ctx.tokens.toks);
+    return parseTokens(ctx, out);
+}
+
+bool parseTokens(ParseContext &ctx, Query &out) {
+    ctx.tokens.pos = 0;
+    ctx.errors.clear();
+    ctx.params = 0;
+    ctx.depth = 0;
+    ctx.scratch.clear();
+    out.explain = EXPLAIN_NONE;
+    out.selectAll = false;
+    out.fields.clear();
+    out.aggregates.clear();
+    out.where = nullptr;
+    out.groupBy.clear();
+    out.orderBy.clear();
+    out.descending = false;
+    out.limit = -1;
+    out.paramCount = 0;
+    if (out.arena) out.arena->reset();
+    else out.arena = std::make_unique<Arena>();
+    return parseStatement(ctx, out);
+}
 
-    if (!parseFieldList(s, out)) return false;
+static bool parseStatement(ParseContext &ctx, Query &out) {
+    // STATEMENT := [ "EXPLAIN" [ "ANALYZE" ] ] QUERY
+    if (accept(ctx, EXPLAINSYM)) {
+        out.explain = accept(ctx, ANALYZESYM) ? EXPLAIN_ANALYZE : EXPLAIN_PLAN;
+    }
+    if (!expect(ctx, SELECTSYM, "SELECT")) return false;
+
+    if (!parseFieldList(ctx, out)) return false;
 
-    if (!expect(s, FROMSYM, "FROM")) return false;
+    if (!expect(ctx, FROMSYM, "FROM")) return false;
 
-    if (peekNext(s) != ID) {
-        syntaxError("Expected identifier after FROM");
+    if (ctx.peek() != ID) {
+        error(ctx, "Expected identifier after FROM");
         return false;
     }
-    (void)getNext(s);
-    out.fromIdent = getParsedId();
+    out.fromIdent = string(ctx.next().text);
 
-    if (accept(s, WHERESYM)) {
-        shared_ptr<BoolExpr> where;
-        if (!parseBoolExpr(s, where)) return false;
+    if (accept(ctx, WHERESYM)) {
+        const BoolExpr* where = nullptr;
+        if (!parseBoolExpr(ctx, *out.arena, where)) return false;
         out.where = where;
     }
+    out.paramCount = ctx.params;
 
+    return parseTrailingClauses(ctx, out);
+}
+
+static bool parseTrailingClauses(ParseContext &ctx, Query &q) {
+    // [ "GROUP" "BY" ID ( "," ID )* ]
+    // [ "ORDER" "BY" ID [ "ASC" | "DESC" ] ] [ "LIMIT" NUMBER ]
+    if (accept(ctx, GROUPSYM)) {
+        if (!expect(ctx, BYSYM, "BY after GROUP")) return false;
+        do {
+            if (ctx.peek() != ID) {
+                error(ctx, "Expected identifier in GROUP BY");
+                return false;
+            }
+            q.groupBy.push_back(string(ctx.next().text));
+        } while (accept(ctx, COMMA));
+    }
+    if (accept(ctx, ORDERSYM)) {
+        if (!expect(ctx, BYSYM, "BY after ORDER")) return false;
+        if (ctx.peek() != ID) {
+            error(ctx, "Expected identifier after ORDER BY");
+            return false;
+        }
+        q.orderBy = string(ctx.next().text);
+        if (accept(ctx, DESCSYM)) q.descending = true;
+        else accept(ctx, ASCSYM);
+    }
+    if (accept(ctx, LIMITSYM)) {
+        string_view text = ctx.peek() == NUMBER ? ctx.next().text : string_view();
+        bool whole = !text.empty() && text.size() <= 18 &&
+                     std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; });
+        if (!whole) {
+            error(ctx, "Expected a whole number of rows after LIMIT");
+            return false;
+        }
+        q.limit = std::stoll(string(text));
+    }
+    if (ctx.peek() != EOL) {
+        error(ctx, "Unexpected text after the end of the query");
+        return false;
+    }
     return true;
 }
 
-static bool parseFieldList(string &s, Query &q) {
-    Symbol sym = peekNext(s);
+static bool parseFieldList(ParseContext &ctx, Query &q) {
+    Symbol sym = ctx.peek();
     if (sym == STAR) {
-        (void)getNext(s);
+        ctx.next();
         q.selectAll = true;
         return true;
     }
     if (sym == ID) {
-        (void)getNext(s);
-        q.fields.push_back(getParsedId());
-        while (accept(s, COMMA)) {
-            if (peekNext(s) != ID) {
-                syntaxError("Expected identifier after ',' in field list");
+        if (!parseSelectItem(ctx, q)) return false;
+        while (accept(ctx, COMMA)) {
+            if (ctx.peek() != ID) {
+                error(ctx, "Expected identifier after ',' in field list");
                 return false;
             }
-            (void)getNext(s);
-            q.fields.push_back(getParsedId());
+            if (!parseSelectItem(ctx, q)) return false;
         }
         q.selectAll = false;
         return true;
     }
-    syntaxError("Expected '*' or identifier list after SELECT");
+    error(ctx, "Expected '*' or identifier list after SELECT");
     return false;
 }
 
-static bool parseBoolExpr(string &s, shared_ptr<BoolExpr>& out) {
-    shared_ptr<BoolExpr> first;
-    if (!parseBoolTerm(s, first)) return false;
+static AggFunc aggregateNamed(string_view name) {
+    static const pair<const char*, AggFunc> names[] = {
+        {"COUNT", AGG_COUNT}, {"SUM", AGG_SUM}, {"MIN", AGG_MIN}, {"MAX", AGG_MAX}, {"AVG", AGG_AVG},
+    };
+    for (const auto& n : names) {
+        if (name.size() == strlen(n.first) &&
+            std::equal(name.begin(), name.end(), n.first,
+                       [](char a, char b) { return toupper((unsigned char)a) == b; })) {
+            return n.second;
+        }
+    }
+    return AGG_NONE;
+}
+
+static bool parseSelectItem(ParseContext &ctx, Query &q) {
+    // ITEM := ID | FUNCTION "(" ( "*" | ID ) ")"
+    string_view name = ctx.next().text;
+    if (!accept(ctx, OPENPAREN)) {
+        q.fields.push_back(string(name));
+        q.aggregates.push_back(AGG_NONE);
+        return true;
+    }
+    AggFunc func = aggregateNamed(name);
+    if (func == AGG_NONE) {
+        error(ctx, "Unknown aggregate function '" + string(name) + "'");
+        return false;
+    }
+    string field;
+    if (func == AGG_COUNT && accept(ctx, STAR)) {
+        field = "*";
+    } else if (ctx.peek() == ID) {
+        field = string(ctx.next().text);
+    } else {
+        error(ctx, func == AGG_COUNT ? "Expected '*' or identifier in COUNT()"
+                                     : "Expected identifier in aggregate function");
+        return false;
+    }
+    if (!expect(ctx, CLOSEPAREN, "')'")) return false;
+    q.fields.push_back(field);
+    q.aggregates.push_back(func);
+    return true;
+}
 
-    if (!accept(s, ORSYM)) {
+// Moves the children pushed onto ctx.scratch since `mark` into the arena.
+static ExprList popList(ParseContext &ctx, Arena &a, size_t mark) {
+    ExprList list;
+    list.count = ctx.scratch.size() - mark;
+    const BoolExpr** items = a.makeArray<const BoolExpr*>(list.count);
+    std::copy(ctx.scratch.begin() + mark, ctx.scratch.end(), items);
+    ctx.scratch.resize(mark);
+    list.items = items;
+    return list;
+}
+
+static bool parseBoolExpr(ParseContext &ctx, Arena &a, const BoolExpr*& out) {
+    const BoolExpr* first;
+    if (!parseBoolTerm(ctx, a, first)) return false;
+
+    if (!accept(ctx, ORSYM)) {
         out = first;
         return true;
     }
 
-    auto node = make_shared<OrExpr>();
-    node->terms.push_back(first);
+    size_t mark = ctx.scratch.size();
+    ctx.scratch.push_back(first);
 
     do {
-        shared_ptr<BoolExpr> t;
-        if (!parseBoolTerm(s, t)) return false;
-        node->terms.push_back(t);
-    } while (accept(s, ORSYM));
+        const BoolExpr* t;
+        if (!parseBoolTerm(ctx, a, t)) return false;
+        ctx.scratch.push_back(t);
+    } while (accept(ctx, ORSYM));
 
+    OrExpr* node = a.make<OrExpr>();
+    node->terms = popList(ctx, a, mark);
     out = node;
     return true;
 }
 
-static bool parseBoolTerm(string &s, shared_ptr<BoolExpr>& out) {
+static bool parseBoolTerm(ParseContext &ctx, Arena &a, const BoolExpr*& out) {
     // BOOL_TERM := BOOL_FACTOR ( "AND" BOOL_FACTOR )*
-    shared_ptr<BoolExpr> first;
-    if (!parseBoolFactor(s, first)) return false;
+    const BoolExpr* first;
+    if (!parseBoolFactor(ctx, a, first)) return false;
 
-    if (!accept(s, ANDSYM)) {
+    if (!accept(ctx, ANDSYM)) {
         out = first;
         return true;
     }
 
-    auto node = make_shared<AndExpr>();
-    node->factors.push_back(first);
+    size_t mark = ctx.scratch.size();
+    ctx.scratch.push_back(first);
 
     do {
-        shared_ptr<BoolExpr> f;
-        if (!parseBoolFactor(s, f)) return false;
-        node->factors.push_back(f);
-    } while (accept(s, ANDSYM));
+        const BoolExpr* f;
+        if (!parseBoolFactor(ctx, a, f)) return false;
+        ctx.scratch.push_back(f);
+    } while (accept(ctx, ANDSYM));
 
+    AndExpr* node = a.make<AndExpr>();
+    node->factors = popList(ctx, a, mark);
     out = node;
     return true;
 }
 
-static bool parseBoolFactor(string &s, shared_ptr<BoolExpr>& out) {
+static bool parseBoolFactor(ParseContext &ctx, Arena &a, const BoolExpr*& out) {
     // BOOL_FACTOR := "(" BOOL_EXPR ")" | PREDICATE
-    if (accept(s, OPENPAREN)) {
-        shared_ptr<BoolExpr> inner;
-        if (!parseBoolExpr(s, inner)) return false;
-        if (!expect(s, CLOSEPAREN, "')'")) return false;
-        auto p = make_shared<ParenExpr>();
+    if (accept(ctx, OPENPAREN)) {
+        if (ctx.depth == MAX_NESTING) {
+            error(ctx, "Parentheses nested more than " + to_string(MAX_NESTING) + " deep");
+            return false;
+        }
+        const BoolExpr* inner;
+        ctx.depth++;
+        bool ok = parseBoolExpr(ctx, a, inner);
+        ctx.depth--;
+        if (!ok) return false;
+        if (!expect(ctx, CLOSEPAREN, "')'")) return false;
+        ParenExpr* p = a.make<ParenExpr>();
         p->inner = inner;
         out = p;
         return true;
     }
-    return parsePredicate(s, out);
+    return parsePredicate(ctx, a, out);
 }
 
 static bool isCompOp(Symbol sym) {
@@ -140,88 +297,109 @@ static bool isCompOp(Symbol sym) {
 }
 
 static bool isLiteral(Symbol sym) {
-    return sym==NUMBER || sym==STRING || sym==TRUE_LIT || sym==FALSE_LIT;
+    return sym==NUMBER || sym==STRING || sym==TRUE_LIT || sym==FALSE_LIT || sym==PARAM;
 }
 
-static bool parsePredicate(string &s, shared_ptr<BoolExpr>& out) {
-    if (peekNext(s) != ID) {
-        syntaxError("Expected identifier at start of predicate");
+static bool parsePredicate(ParseContext &ctx, Arena &a, const BoolExpr*& out) {
+    if (ctx.peek() != ID) {
+        error(ctx, "Expected identifier at start of predicate");
         return false;
     }
-    (void)getNext(s);
-    string ident = getParsedId();
+    string_view ident = ctx.next().text;
 
-    Symbol op = peekNext(s);
+    Symbol op = ctx.peek();
     if (!isCompOp(op)) {
-        syntaxError("Expected comparison operator (=, !=, <, <=, >, >=)");
+        error(ctx, "Expected comparison operator (=, !=, <, <=, >, >=)");
         return false;
     }
-    (void)getNext(s);
+    ctx.next();
 
-    Symbol litSym = peekNext(s);
+    Symbol litSym = ctx.peek();
     if (!isLiteral(litSym)) {
-        syntaxError("Expected literal (number, string, true, false)");
+        error(ctx, "Expected literal (number, string, true, false, ?)");
         return false;
     }
-    (void)getNext(s);
-    string lit = getParsedLiteral();
-    if (lit.empty()) {
-        if (litSym == TRUE_LIT) lit = "true";
-        else if (litSym == FALSE_LIT) lit = "false";
-    }
+    const Token &litTok = ctx.next();
 
-    auto p = make_shared<Predicate>();
-    p->ident = ident;
+    Predicate* p = a.make<Predicate>();
+    p->ident = a.copy(ident);
     p->op = op;
-    p->literalText = lit;
+    if (litSym == TRUE_LIT) p->literalText = "true";
+    else if (litSym == FALSE_LIT) p->literalText = "false";
+    else p->literalText = a.copy(litTok.text);
     p->literalKind = litSym;
+    if (litSym == PARAM) p->param = ctx.params++;
     out = p;
     return true;
 }
 
-void OrExpr::print(ostream& os, int indentLvl) const {
-    indent(os, indentLvl); os << "OR\n";
-    for (auto& t : terms) {
-        t->print(os, indentLvl + 2);
+static const char* opText(Symbol op) {
+    switch (op) {
+        case EQUALS: return "=";
+        case NOTEQUAL: return "!=";
+        case LT: return "<";
+        case LTE: return "<=";
+        case GT: return ">";
+        case GTE: return ">=";
+        default: return "?";
     }
 }
 
-void AndExpr::print(ostream& os, int indentLvl) const {
-    indent(os, indentLvl); os << "AND\n";
-    for (auto& f : factors) {
-        f->print(os, indentLvl + 2);
+void BoolExpr::print(ostream& os, int indentLvl) const {
+    switch (kind) {
+    case EXPR_OR:
+        indent(os, indentLvl); os << "OR\n";
+        for (const BoolExpr* t : static_cast<const OrExpr*>(this)->terms)
+            t->print(os, indentLvl + 2);
+        break;
+    case EXPR_AND:
+        indent(os, indentLvl); os << "AND\n";
+        for (const BoolExpr* f : static_cast<const AndExpr*>(this)->factors)
+            f->print(os, indentLvl + 2);
+        break;
+    case EXPR_PREDICATE: {
+        const Predicate* p = static_cast<const Predicate*>(this);
+        indent(os, indentLvl);
+        os << "PREDICATE " << p->ident << ' ' << opText(p->op) << ' ' << p->literalText << "\n";
+        break;
+    }
+    case EXPR_PAREN: {
+        const ParenExpr* p = static_cast<const ParenExpr*>(this);
+        indent(os, indentLvl); os << "(\n";
+        if (p->inner) p->inner->print(os, indentLvl + 2);
+        indent(os, indentLvl); os << ")\n";
+        break;
+    }
     }
 }
 
-void Predicate::print(ostream& os, int indentLvl) const {
-    indent(os, indentLvl);
-    os << "PREDICATE " << ident << ' ';
-    switch (op) {
-        case EQUALS: os << "="; break;
-        case NOTEQUAL: os << "!="; break;
-        case LT: os << "<"; break;
-        case LTE: os << "<="; break;
-        case GT: os << ">"; break;
-        case GTE: os << ">="; break;
-        default: os << "?"; break;
+string selectItemName(AggFunc func, const string& field) {
+    switch (func) {
+        case AGG_NONE:  return field;
+        case AGG_COUNT: return "COUNT(" + field + ")";
+        case AGG_SUM:   return "SUM(" + field + ")";
+        case AGG_MIN:   return "MIN(" + field + ")";
+        case AGG_MAX:   return "MAX(" + field + ")";
+        case AGG_AVG:   return "AVG(" + field + ")";
     }
-    os << ' ' << literalText << "\n";
+    return field;
 }
 
-void ParenExpr::print(ostream& os, int indentLvl) const {
-    indent(os, indentLvl); os << "(\n";
-    if (inner) inner->print(os, indentLvl + 2);
-    indent(os, indentLvl); os << ")\n";
+bool Query::grouped() const {
+    return !groupBy.empty() ||
+           std::any_of(aggregates.begin(), aggregates.end(), [](AggFunc f) { return f != AGG_NONE; });
 }
 
 void Query::print(ostream& os) const {
+    if (explain == EXPLAIN_PLAN) os << "EXPLAIN\n";
+    if (explain == EXPLAIN_ANALYZE) os << "EXPLAIN ANALYZE\n";
     os << "QUERY\n";
     os << "  SELECT ";
     if (selectAll) {
         os << "*\n";
     } else {
         for (size_t i=0;i<fields.size();++i) {
-            os << fields[i];
+            os << selectItemName(aggregates[i], fields[i]);
             if (i+1<fields.size()) os << ", ";
         }
         os << "\n";
@@ -231,4 +409,11 @@ void Query::print(ostream& os) const {
         os << "  WHERE\n";
         where->print(os, 4);
     }
+    if (!groupBy.empty()) {
+        os << "  GROUP BY ";
+        for (size_t i=0;i<groupBy.size();++i) os << (i ? ", " : "") << groupBy[i];
+        os << "\n";
+    }
+    if (!orderBy.empty()) os << "  ORDER BY " << orderBy << (descending ? " DESC\n" : " ASC\n");
+    if (limit >= 0) os << "  LIMIT " << limit << "\n";
 }
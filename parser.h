@@ -1,53 +1,114 @@
 #pragma once
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 #include <iostream>
+#include "arena.h"
 #include "tokenizer.h"
 
-using std::shared_ptr;
-using std::make_shared;
 using std::string;
 using std::vector;
 
+// WHERE clause syntax tree. Nodes live in the owning Query's arena and
+// are freed with it; they hold no heap memory of their own. Code walking
+// the tree switches on `kind` and static_casts to the node type.
+enum ExprKind { EXPR_OR, EXPR_AND, EXPR_PREDICATE, EXPR_PAREN };
+
 struct BoolExpr {
-    virtual ~BoolExpr() = default;
-    virtual void print(std::ostream& os, int indent=0) const = 0;
+    ExprKind kind;
+    explicit BoolExpr(ExprKind k) : kind(k) {}
+    void print(std::ostream& os, int indent=0) const;
+};
+
+// Children of an OR or AND, stored contiguously in the arena.
+struct ExprList {
+    const BoolExpr* const* items = nullptr;
+    size_t count = 0;
+    const BoolExpr* const* begin() const { return items; }
+    const BoolExpr* const* end() const { return items + count; }
+    size_t size() const { return count; }
+    const BoolExpr* operator[](size_t i) const { return items[i]; }
 };
 
 struct OrExpr : BoolExpr {
-    vector<shared_ptr<BoolExpr>> terms;
-    void print(std::ostream& os, int indent=0) const override;
+    ExprList terms;
+    OrExpr() : BoolExpr(EXPR_OR) {}
 };
 
 struct AndExpr : BoolExpr {
-    vector<shared_ptr<BoolExpr>> factors;
-    void print(std::ostream& os, int indent=0) const override;
+    ExprList factors;
+    AndExpr() : BoolExpr(EXPR_AND) {}
 };
 
 struct Predicate : BoolExpr {
-    string ident;
-    Symbol op;
-    string literalText;
-    Symbol literalKind;
-    void print(std::ostream& os, int indent=0) const override;
+    string_view ident;
+    Symbol op = EQUALS;
+    string_view literalText;
+    Symbol literalKind = NUMBER;
+    int param = -1;         // PARAM: placeholder number, counting from 0
+    Predicate() : BoolExpr(EXPR_PREDICATE) {}
 };
 
 struct ParenExpr : BoolExpr {
-    shared_ptr<BoolExpr> inner;
-    void print(std::ostream& os, int indent=0) const override;
+    const BoolExpr* inner = nullptr;
+    ParenExpr() : BoolExpr(EXPR_PAREN) {}
 };
 
+// Aggregate functions in a SELECT list. COUNT(*) is COUNT with the field
+// "*".
+enum AggFunc { AGG_NONE, AGG_COUNT, AGG_SUM, AGG_MIN, AGG_MAX, AGG_AVG };
+
+// The output column name of a SELECT list entry: the field itself, or
+// e.g. "SUM(age)".
+string selectItemName(AggFunc func, const string& field);
+
+// EXPLAIN shows the plan instead of running the query; EXPLAIN ANALYZE
+// runs it and shows the plan with what each node did.
+enum ExplainMode { EXPLAIN_NONE, EXPLAIN_PLAN, EXPLAIN_ANALYZE };
+
 struct Query {
+    ExplainMode explain = EXPLAIN_NONE;
     bool selectAll = false;
     vector<string> fields;
+    vector<AggFunc> aggregates;         // per entry of `fields`; AGG_NONE for a plain field
     string fromIdent;
-    shared_ptr<BoolExpr> where;
+    const BoolExpr* where = nullptr;    // points into `arena`
+    vector<string> groupBy;
+    string orderBy;         // ORDER BY field; empty without one
+    bool descending = false;
+    int64_t limit = -1;     // LIMIT row count; -1 without one
+    int paramCount = 0;     // number of `?` placeholders in WHERE
+    std::unique_ptr<Arena> arena;       // owns the WHERE tree
 
+    // Whether the query aggregates: it has GROUP BY or an aggregate.
+    bool grouped() const;
     void print(std::ostream& os) const;
 };
 
+// All lexer and parser state for one query. Each thread compiling
+// queries should own its own context; reusing one across queries keeps
+// its token buffer allocated.
+struct ParseContext {
+    string filename;
+    TokenStream tokens;
+    vector<string> errors;
+    int params = 0;         // placeholders seen so far
+    int depth = 0;          // parentheses open around the current factor
+    vector<const BoolExpr*> scratch;    // children of the AND/ORs being parsed
+
+    Symbol peek() const { return tokens.peek(); }
+    const Token& next() { return tokens.next(); }
+};
+
+// Parses `s`, printing any syntax errors to stderr.
 bool parseQuery(string &s, Query &out);
+// Reentrant form: syntax errors are collected in ctx.errors rather than
+// printed, so any number of threads may parse at once with their own
+// contexts.
+bool parseQuery(ParseContext &ctx, string_view src, Query &out);
+// Parses the tokens already in ctx.tokens.toks, as filled by tokenize().
+bool parseTokens(ParseContext &ctx, Query &out);
 
 inline std::ostream& operator<<(std::ostream& os, const Query& q) {
     q.print(os);
@@ -0,0 +1,58 @@
+#include "print_sink.h"
+#include <algorithm>
+
+using namespace std;
+
+void PrintSink::begin(const SymbolTable& schema) {
+    order.clear();
+    for (size_t c = 0; c < schema.fieldCount(); ++c) order.push_back(c);
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return schema.fieldName(a) < schema.fieldName(b);
+    });
+    names.clear();
+    for (size_t c : order) names.push_back(schema.fieldName(c));
+    rows = 0;
+}
+
+bool PrintSink::consume(const Table& batch) {
+    if (rows == 0 && batch.rowCount() > 0) {
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (i) buf += '\t';
+            buf += names[i];
+        }
+        buf += '\n';
+    }
+    for (size_t r = 0; r < batch.rowCount(); ++r) {
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (i) buf += '\t';
+            batch.column(order[i]).writeCell(r, buf);
+        }
+        buf += '\n';
+        if (buf.size() >= FLUSH_BYTES) flush();
+    }
+    rows += batch.rowCount();
+    return true;
+}
+
+void PrintSink::end() {
+    if (rows == 0) buf += "(no rows)\n";
+    flush();
+}
+
+void PrintSink::write(const string& text) {
+    if (!out) return;
+    fwrite(text.data(), 1, text.size(), out);
+    fflush(out);
+}
+
+void PrintSink::flush() {
+    write(buf);
+    buf.clear();
+}
+
+void printTable(const Table& table) {
+    PrintSink sink;
+    sink.begin(table.schema());
+    sink.consume(table);
+    sink.end();
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "evaluator.h"
+
+using std::string;
+using std::vector;
+
+// Writes results as tab-separated text through a large buffer, with the
+// columns in name order. The header is written before the first row, and
+// "(no rows)" if there is none. With a null `out` the text is formatted
+// and then dropped.
+class PrintSink : public ResultSink {
+public:
+    explicit PrintSink(FILE* out = stdout) : out(out) { buf.reserve(FLUSH_BYTES + 4096); }
+
+    void begin(const SymbolTable& schema) override;
+    bool consume(const Table& batch) override;
+    void end() override;
+
+protected:
+    // Receives each buffered piece of text; writes it to `out` by default.
+    virtual void write(const string& text);
+
+private:
+    static const size_t FLUSH_BYTES = 1 << 20;
+
+    void flush();
+
+    FILE* out;
+    string buf;
+    vector<size_t> order;       // output column for each printed column
+    vector<string> names;
+    size_t rows = 0;
+};
+
+// Prints `table` to stdout the way PrintSink would stream it.
+void printTable(const Table& table);
@@ -0,0 +1,188 @@
+#include "query_cache.h"
+#include <chrono>
+#include "diagnostics.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "symbol_table.h"
+
+using std::endl;
+using Clock = std::chrono::steady_clock;
+
+// Adds the time since `start` to `*slot`, if timing was asked for, and
+// restarts the clock.
+static void lap(double* slot, Clock::time_point& start) {
+    if (!slot) return;
+    Clock::time_point now = Clock::now();
+    *slot += std::chrono::duration<double>(now - start).count();
+    start = now;
+}
+
+string normalizeQuery(string_view text) {
+    string out;
+    out.reserve(text.size());
+    bool inString = false, space = false;
+    for (char c : text) {
+        if (!inString && isQuerySpace(c)) {
+            space = true;
+            continue;
+        }
+        if (space && !out.empty()) out += ' ';
+        space = false;
+        if (c == '"') inString = !inString;
+        out += c;
+    }
+    return out;
+}
+
+shared_ptr<PreparedQuery> prepareQuery(Catalog& catalog, string_view text,
+                                       const string& filename, PhaseTimings* timings) {
+    ParseContext ctx;
+    ctx.filename = filename;
+    Query q;
+    Clock::time_point start = Clock::now();
+    tokenize(text, ctx.tokens.toks);
+    lap(timings ? &timings->tokenize : nullptr, start);
+    bool parsed = parseTokens(ctx, q);
+    lap(timings ? &timings->parse : nullptr, start);
+    if (!parsed) {
+        for (const auto& e : ctx.errors) diagnostics() << e << endl;
+        diagnostics() << "Parse failed.\n";
+        return nullptr;
+    }
+
+    auto prepared = std::make_shared<PreparedQuery>();
+    prepared->text = normalizeQuery(text);
+    prepared->explain = q.explain;
+    // read the version first: a table registered again in between makes
+    // the plan look stale rather than current
+    prepared->from = q.fromIdent;
+    prepared->schemaVersion = catalog.schemaVersion(q.fromIdent);
+    // the schema is enough to check and compile; the columns the plan
+    // reads are loaded once it is known
+    prepared->table = catalog.lookup(q.fromIdent, {});
+    start = Clock::now();
+    if (!prepared->table || !checkQuerySemantics(q, prepared->table->schema())) {
+        diagnostics() << "Semantic check failed. Aborting.\n";
+        return nullptr;
+    }
+    lap(timings ? &timings->check : nullptr, start);
+    if (!compileQuery(q, prepared->table->schema(), prepared->plan)) {
+        diagnostics() << "Compile failed. Aborting.\n";
+        return nullptr;
+    }
+    lap(timings ? &timings->compile : nullptr, start);
+    optimizeQuery(prepared->plan);
+    lap(timings ? &timings->optimize : nullptr, start);
+    prepared->table = catalog.lookup(q.fromIdent, referencedColumns(prepared->plan));
+    if (!prepared->table) {
+        diagnostics() << "Load failed. Aborting.\n";
+        return nullptr;
+    }
+    return prepared;
+}
+
+bool executePrepared(const PreparedQuery& q, const vector<string>& values, Table& out,
+                     const EvalOptions& opts) {
+    if (q.plan.params.empty() && values.empty()) {
+        out = evaluateQuery(q.plan, *q.table, opts);
+        return true;
+    }
+    CompiledQuery bound = q.plan;
+    if (!bindParameters(bound, values)) return false;
+    optimizeQuery(bound);
+    out = evaluateQuery(bound, *q.table, opts);
+    return true;
+}
+
+bool executePrepared(const PreparedQuery& q, const vector<string>& values, ResultSink& sink,
+                     const EvalOptions& opts, PhaseTimings* timings) {
+    Clock::time_point start = Clock::now();
+    if (q.plan.params.empty() && values.empty()) {
+        evaluateQuery(q.plan, *q.table, sink, opts);
+        lap(timings ? &timings->evaluate : nullptr, start);
+        return true;
+    }
+    CompiledQuery bound = q.plan;
+    if (!bindParameters(bound, values)) return false;
+    optimizeQuery(bound);
+    lap(timings ? &timings->bind : nullptr, start);
+    evaluateQuery(bound, *q.table, sink, opts);
+    lap(timings ? &timings->evaluate : nullptr, start);
+    return true;
+}
+
+bool bindPrepared(const PreparedQuery& q, const vector<string>& values, CompiledQuery& out) {
+    out = q.plan;
+    if (q.plan.params.empty() && values.empty()) return true;
+    if (!bindParameters(out, values)) return false;
+    optimizeQuery(out);
+    return true;
+}
+
+QueryCache::QueryCache(Catalog& catalog, size_t capacity)
+    : catalog(catalog), capacity(capacity ? capacity : 1) {}
+
+shared_ptr<const PreparedQuery> QueryCache::prepare(string_view text, const string& filename,
+                                                    PhaseTimings* timings) {
+    Clock::time_point start = Clock::now();
+    string key = normalizeQuery(text);
+    {
+        std::lock_guard<std::mutex> g(lock);
+        auto it = byText.find(key);
+        if (it != byText.end()) {
+            const PreparedQuery& p = **it->second;
+            if (catalog.schemaVersion(p.from) == p.schemaVersion) {
+                order.splice(order.begin(), order, it->second);
+                hitCount++;
+                if (timings) {
+                    timings->cached = true;
+                    lap(&timings->cache, start);
+                }
+                return *it->second;
+            }
+            order.erase(it->second);
+            byText.erase(it);
+        }
+        missCount++;
+    }
+
+    // compile outside the lock so other queries are not held up
+    shared_ptr<const PreparedQuery> fresh = prepareQuery(catalog, text, filename, timings);
+    if (!fresh) return nullptr;
+
+    std::lock_guard<std::mutex> g(lock);
+    auto it = byText.find(key);
+    if (it != byText.end()) {
+        // another thread prepared it meanwhile; keep the newer plan
+        order.erase(it->second);
+        byText.erase(it);
+    }
+    order.push_front(fresh);
+    byText[key] = order.begin();
+    while (order.size() > capacity) {
+        byText.erase(order.back()->text);
+        order.pop_back();
+    }
+    return fresh;
+}
+
+size_t QueryCache::size() const {
+    std::lock_guard<std::mutex> g(lock);
+    return order.size();
+}
+
+size_t QueryCache::hits() const {
+    std::lock_guard<std::mutex> g(lock);
+    return hitCount;
+}
+
+size_t QueryCache::misses() const {
+    std::lock_guard<std::mutex> g(lock);
+    return missCount;
+}
+
+void QueryCache::clear() {
+    std::lock_guard<std::mutex> g(lock);
+    order.clear();
+    byText.clear();
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "catalog.h"
+#include "compiler.h"
+#include "evaluator.h"
+
+using std::shared_ptr;
+using std::string;
+using std::string_view;
+using std::vector;
+
+// A query that has been parsed, checked and compiled once and can be run
+// any number of times with different values for its `?` placeholders.
+struct PreparedQuery {
+    string text;                    // normalized query text
+    ExplainMode explain = EXPLAIN_NONE;
+    string from;                    // FROM name
+    shared_ptr<const Table> table;  // the FROM table it was compiled against
+    uint64_t schemaVersion = 0;     // catalog version of that table
+    CompiledQuery plan;             // optimized once parameters are bound
+
+    size_t paramCount() const { return plan.params.size(); }
+};
+
+// Wall-clock seconds spent in each stage of one query. `bind` covers
+// binding placeholders and optimizing the bound plan; `evaluate` is the
+// whole evaluateQuery call, including the time the sink took. A plan
+// taken from a QueryCache sets `cached` and spends `cache` finding it
+// instead of the front-end stages.
+struct PhaseTimings {
+    double tokenize = 0, parse = 0, check = 0, compile = 0, optimize = 0;
+    double bind = 0, evaluate = 0, print = 0;
+    double cache = 0;
+    bool cached = false;
+};
+
+// Collapses each run of whitespace outside string literals to one space
+// and trims the ends, so queries differing only in layout share a plan.
+string normalizeQuery(string_view text);
+
+// Runs the whole front end on `text`: parse, resolve FROM, semantic check,
+// compile and, when there are no placeholders, optimize. Prints errors (tagged with `filename`) and returns null if
+// any stage fails. Stage times are added to `timings` if given.
+shared_ptr<PreparedQuery> prepareQuery(Catalog& catalog, string_view text,
+                                       const string& filename = "query",
+                                       PhaseTimings* timings = nullptr);
+
+// Binds `values` to the placeholders of `q` and runs it. Returns false
+// (after printing why) if the values do not fit.
+bool executePrepared(const PreparedQuery& q, const vector<string>& values, Table& out,
+                     const EvalOptions& opts = EvalOptions());
+// Streaming form: the result is delivered to `sink` as it is produced.
+bool executePrepared(const PreparedQuery& q, const vector<string>& values, ResultSink& sink,
+                     const EvalOptions& opts = EvalOptions(), PhaseTimings* timings = nullptr);
+// The plan `q` runs with once `values` are bound, as executePrepared
+// would build it. Returns false (after printing why) if they do not fit.
+bool bindPrepared(const PreparedQuery& q, const vector<string>& values, CompiledQuery& out);
+
+// LRU cache of prepared queries keyed by normalized text. An entry is
+// only reused while the catalog reports the same schema version for its
+// table; otherwise the query is prepared again. Safe to share between
+// threads.
+class QueryCache {
+public:
+    explicit QueryCache(Catalog& catalog, size_t capacity = 256);
+
+    // Returns the cached plan for `text`, preparing it on a miss. Null if
+    // the query does not compile; failures are not cached. Stage times,
+    // or the lookup time on a hit, are added to `timings` if given.
+    shared_ptr<const PreparedQuery> prepare(string_view text,
+                                            const string& filename = "query",
+                                            PhaseTimings* timings = nullptr);
+
+    size_t size() const;
+    size_t hits() const;
+    size_t misses() const;
+    void clear();
+
+private:
+    using Lru = std::list<shared_ptr<const PreparedQuery>>;
+
+    Catalog& catalog;
+    size_t capacity;
+    Lru order;                                      // most recently used first
+    std::unordered_map<string, Lru::iterator> byText;
+    size_t hitCount = 0;
+    size_t missCount = 0;
+    mutable std::mutex lock;
+};
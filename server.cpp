@@ -0,0 +1,434 @@
+#include "server.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "diagnostics.h"
+#include "explain.h"
+#include "print_sink.h"
+
+using namespace std;
+
+// Responses are written in pieces of about this size.
+static const size_t WRITE_BYTES = 64 * 1024;
+// How long accepting waits when the process is out of descriptors.
+static const int ACCEPT_RETRY_MS = 100;
+
+// Writes all of p[0, n). Sockets are written without raising SIGPIPE
+// when the peer has gone; other descriptors, such as stdout, with write().
+static bool writeAll(int fd, const char* p, size_t n) {
+    bool socket = true;
+    while (n > 0) {
+        ssize_t w = socket ? ::send(fd, p, n, MSG_NOSIGNAL) : ::write(fd, p, n);
+        if (w < 0 && socket && errno == ENOTSOCK) {
+            socket = false;
+            continue;
+        }
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+static bool isBlank(string_view line) {
+    return line.find_first_not_of(" \t\r") == string_view::npos;
+}
+
+// Fills in the address of a Unix domain socket. Returns false (after
+// printing why) if the path does not fit.
+static bool socketAddress(const string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof addr.sun_path) {
+        diagnostics() << "Server error: socket path '" << path << "' is empty or too long\n";
+        return false;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
+
+// Splits what is read from `fd` into requests: runs of lines ended by a
+// blank line or by end of file.
+class RequestReader {
+public:
+    enum Status { REQUEST, END, TOO_LARGE };
+
+    explicit RequestReader(int fd) : fd(fd) {}
+
+    Status next(string& request) {
+        request.clear();
+        while (true) {
+            size_t nl = buf.find('\n', pos);
+            if (nl == string::npos) {
+                if (eof) {
+                    string_view rest(buf.data() + pos, buf.size() - pos);
+                    pos = buf.size();
+                    if (!isBlank(rest)) request.append(rest).push_back('\n');
+                    return request.empty() ? END : REQUEST;
+                }
+                if (request.size() + buf.size() - pos > MAX_REQUEST_BYTES) return TOO_LARGE;
+                buf.erase(0, pos);
+                pos = 0;
+                char chunk[WRITE_BYTES];
+                ssize_t n = ::read(fd, chunk, sizeof chunk);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) eof = true;
+                else buf.append(chunk, (size_t)n);
+                continue;
+            }
+            string_view line(buf.data() + pos, nl - pos);
+            pos = nl + 1;
+            if (isBlank(line)) {
+                if (!request.empty()) return REQUEST;
+                continue;
+            }
+            request.append(line).push_back('\n');
+            if (request.size() > MAX_REQUEST_BYTES) return TOO_LARGE;
+        }
+    }
+
+private:
+    int fd;
+    string buf;
+    size_t pos = 0;
+    bool eof = false;
+};
+
+struct QueryServer::Job {
+    string text;
+    int out;
+    bool ok = true;         // false once writing the answer has failed
+    bool done = false;
+    condition_variable finished;
+};
+
+// Formats results as PrintSink does and sends them as one answer: "OK",
+// the text in chunks, then the final empty chunk. Small answers go out in
+// a single write. The scan stops once the client has gone.
+class AnswerSink : public PrintSink {
+public:
+    AnswerSink(int fd, bool& ok) : PrintSink(nullptr), fd(fd), ok(ok), pending("OK\n") {}
+
+    bool consume(const Table& batch) override { return PrintSink::consume(batch) && ok; }
+    void end() override {
+        PrintSink::end();
+        pending += "0\n";
+        send();
+    }
+
+protected:
+    void write(const string& text) override {
+        if (text.empty()) return;
+        pending += to_string(text.size());
+        pending += '\n';
+        pending += text;
+        if (pending.size() >= WRITE_BYTES) send();
+    }
+
+private:
+    void send() {
+        if (ok) ok = writeAll(fd, pending.data(), pending.size());
+        pending.clear();
+    }
+
+    int fd;
+    bool& ok;
+    string pending;
+};
+
+// Sends "ERR" with the non-blank lines of `message`, the first after
+// "ERR " and the rest indented to line up under it, then an empty line.
+static bool sendError(int fd, const string& message) {
+    string answer = "ERR ";
+    istringstream in(message);
+    string part;
+    while (getline(in, part)) {
+        if (isBlank(part)) continue;
+        if (answer.size() > 4) answer += "    ";
+        answer += part;
+        answer += '\n';
+    }
+    if (answer.size() == 4) answer += "query failed\n";
+    answer += '\n';
+    return writeAll(fd, answer.data(), answer.size());
+}
+
+QueryServer::QueryServer(Catalog& catalog, const ServerOptions& opts)
+    : opts(opts), cache(catalog, opts.cacheEntries) {
+    for (unsigned w = 0; w < max(1u, opts.workers); ++w) workers.emplace_back(&QueryServer::workerLoop, this);
+}
+
+QueryServer::~QueryServer() {
+    stop();
+}
+
+bool QueryServer::listen(const string& path) {
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) return false;
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            diagnostics() << "Server error: '" << path << "' exists and is not a socket\n";
+            return false;
+        }
+        unlink(path.c_str());
+    }
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || bind(listenFd, (sockaddr*)&addr, sizeof addr) < 0 ||
+        ::listen(listenFd, 128) < 0 || pipe2(wakeFds, O_CLOEXEC) < 0) {
+        diagnostics() << "Server error: cannot listen on '" << path << "': " << strerror(errno) << "\n";
+        return false;
+    }
+    socketPath = path;
+    acceptor = thread(&QueryServer::acceptLoop, this);
+    return true;
+}
+
+void QueryServer::acceptLoop() {
+    pollfd fds[2] = {{listenFd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+    bool acceptFailing = false;     // reported once until an accept succeeds
+    while (!stopping) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+        joinFinishedReaders();
+        if (stopping || !(fds[0].revents & POLLIN)) continue;
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            // a client that gave up before it was accepted is not an error
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) continue;
+            // out of descriptors or memory: wait for readers to finish (or
+            // for stop()) rather than poll a listen socket that stays ready
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                if (!acceptFailing) diagnostics() << "Server error: cannot accept: " << strerror(errno) << "\n";
+                acceptFailing = true;
+                poll(&fds[1], 1, ACCEPT_RETRY_MS);
+                continue;
+            }
+            diagnostics() << "Server error: stopped accepting: " << strerror(errno) << "\n";
+            break;
+        }
+        acceptFailing = false;
+        timeval timeout = {SEND_TIMEOUT_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+        lock_guard<mutex> g(lock);
+        uint64_t id = nextReader++;
+        connections.insert(fd);
+        readers.emplace(id, thread([this, fd, id] {
+            serve(fd, fd);
+            lock_guard<mutex> g(lock);
+            connections.erase(fd);
+            close(fd);
+            finishedReaders.push_back(id);
+        }));
+    }
+}
+
+void QueryServer::joinFinishedReaders() {
+    vector<thread> done;
+    {
+        lock_guard<mutex> g(lock);
+        for (uint64_t id : finishedReaders) {
+            auto it = readers.find(id);
+            done.push_back(std::move(it->second));
+            readers.erase(it);
+        }
+        finishedReaders.clear();
+    }
+    for (thread& t : done) t.join();
+}
+
+void QueryServer::serve(int in, int out) {
+    RequestReader reader(in);
+    string text;
+    while (true) {
+        RequestReader::Status status = reader.next(text);
+        if (status == RequestReader::END) break;
+        if (status == RequestReader::TOO_LARGE) {
+            sendError(out, "request longer than " + to_string(MAX_REQUEST_BYTES) + " bytes");
+            break;
+        }
+        Job job;
+        job.text = std::move(text);
+        job.out = out;
+        if (!submit(job)) break;
+        unique_lock<mutex> g(lock);
+        job.finished.wait(g, [&] { return job.done; });
+        if (!job.ok) break;
+    }
+}
+
+bool QueryServer::submit(Job& job) {
+    unique_lock<mutex> g(lock);
+    notFull.wait(g, [&] { return closing || queue.size() < max<size_t>(opts.queueDepth, 1); });
+    if (closing) return false;
+    queue.push_back(&job);
+    notEmpty.notify_one();
+    return true;
+}
+
+void QueryServer::workerLoop() {
+    while (true) {
+        Job* job;
+        {
+            unique_lock<mutex> g(lock);
+            notEmpty.wait(g, [&] { return closing || !queue.empty(); });
+            if (queue.empty()) return;
+            job = queue.front();
+            queue.pop_front();
+            notFull.notify_one();
+        }
+        run(*job);
+        servedCount++;
+        lock_guard<mutex> g(lock);
+        job->done = true;
+        job->finished.notify_one();
+    }
+}
+
+void QueryServer::run(Job& job) {
+    DiagnosticsCapture capture;
+    PhaseTimings timings;
+    shared_ptr<const PreparedQuery> q = cache.prepare(job.text, "query", &timings);
+    if (q && !q->plan.params.empty()) {
+        diagnostics() << "Server error: parameters are not supported\n";
+        q = nullptr;
+    }
+    if (!q) {
+        job.ok = sendError(job.out, capture.text());
+        return;
+    }
+    if (q->explain != EXPLAIN_NONE) {
+        ostringstream os;
+        if (!runExplain(*q, {}, opts.eval, timings, os)) {
+            job.ok = sendError(job.out, capture.text());
+            return;
+        }
+        string text = os.str();
+        string answer = "OK\n" + to_string(text.size()) + "\n" + text + "0\n";
+        job.ok = writeAll(job.out, answer.data(), answer.size());
+        return;
+    }
+    AnswerSink sink(job.out, job.ok);
+    executePrepared(*q, {}, sink, opts.eval);
+}
+
+void QueryServer::stop() {
+    if (stopping.exchange(true) && workers.empty()) return;
+    if (acceptor.joinable()) {
+        char wake = 0;
+        writeAll(wakeFds[1], &wake, 1);
+        acceptor.join();
+    }
+    if (listenFd >= 0) {
+        close(listenFd);
+        close(wakeFds[0]);
+        close(wakeFds[1]);
+        unlink(socketPath.c_str());
+        listenFd = -1;
+    }
+
+    // readers see end of file, finish the request they are waiting on and exit
+    map<uint64_t, thread> left;
+    {
+        lock_guard<mutex> g(lock);
+        for (int fd : connections) shutdown(fd, SHUT_RD);
+        left.swap(readers);
+        finishedReaders.clear();
+    }
+    for (auto& r : left) r.second.join();
+
+    {
+        lock_guard<mutex> g(lock);
+        closing = true;
+    }
+    notEmpty.notify_all();
+    notFull.notify_all();
+    for (thread& w : workers) w.join();
+    workers.clear();
+}
+
+QueryClient::~QueryClient() {
+    if (fd >= 0) close(fd);
+}
+
+bool QueryClient::connect(const string& path) {
+    sockaddr_un addr;
+    if (!socketAddress(path, addr)) return false;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, (sockaddr*)&addr, sizeof addr) < 0) {
+        diagnostics() << "Client error: cannot connect to '" << path << "': " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool QueryClient::send(const string& query) {
+    string request = query;
+    if (request.empty() || request.back() != '\n') request += '\n';
+    request += '\n';
+    return writeAll(fd, request.data(), request.size());
+}
+
+bool QueryClient::receive(string& text, bool& ok) {
+    string line;
+    text.clear();
+    if (!readLine(line)) return false;
+    if (line.compare(0, 4, "ERR ") == 0) {
+        text = line.substr(4);
+        while (true) {
+            if (!readLine(line)) return false;
+            if (line.empty()) break;
+            text += '\n';
+            text.append(line, min<size_t>(4, line.size()), string::npos);
+        }
+        ok = false;
+        return true;
+    }
+    if (line != "OK") return false;
+    ok = true;
+    while (true) {
+        if (!readLine(line)) return false;
+        size_t n = strtoull(line.c_str(), nullptr, 10);
+        if (n == 0) return true;
+        if (!readBytes(n, text)) return false;
+    }
+}
+
+bool QueryClient::readLine(string& line) {
+    while (true) {
+        size_t nl = buf.find('\n', pos);
+        if (nl != string::npos) {
+            line.assign(buf, pos, nl - pos);
+            pos = nl + 1;
+            return true;
+        }
+        buf.erase(0, pos);
+        pos = 0;
+        char chunk[WRITE_BYTES];
+        ssize_t n = ::read(fd, chunk, sizeof chunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf.append(chunk, (size_t)n);
+    }
+}
+
+bool QueryClient::readBytes(size_t n, string& out) {
+    while (buf.size() - pos < n) {
+        buf.erase(0, pos);
+        pos = 0;
+        char chunk[WRITE_BYTES];
+        ssize_t got = ::read(fd, chunk, sizeof chunk);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        buf.append(chunk, (size_t)got);
+    }
+    out.append(buf, pos, n);
+    pos += n;
+    return true;
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "catalog.h"
+#include "evaluator.h"
+#include "query_cache.h"
+
+using std::string;
+using std::vector;
+
+// Wire format, shared by QueryServer and QueryClient. A request is the
+// query text followed by a blank line, as in --batch input; a client may
+// send any number of requests without waiting for the answers. Requests
+// on one connection are answered in order, each by either
+//   "OK\n", then chunks of PrintSink text, each as "<bytes>\n<bytes>",
+//   and a final "0\n"
+// or
+//   "ERR <message>\n", with any further lines of the message indented by
+//   four spaces to line up under the first, and a final empty line.
+const size_t MAX_REQUEST_BYTES = 1 << 20;
+const int SEND_TIMEOUT_SECONDS = 30;
+
+struct ServerOptions {
+    unsigned workers = 4;           // queries run at once
+    size_t queueDepth = 64;         // requests waiting for a worker
+    size_t cacheEntries = 256;      // prepared queries kept
+    EvalOptions eval;               // per query; eval.threads is per worker
+};
+
+// Answers queries against one catalog, loaded once, for any number of
+// clients. Connections are read by a thread each; their requests go to a
+// bounded queue served by a fixed pool of workers, which prepare them
+// through a shared QueryCache and stream the results straight back. Each
+// connection has at most one request in the queue or running, so answers
+// keep request order, and a full queue stops the reading of further
+// requests until a worker frees a place. A client that stops reading its
+// answers for SEND_TIMEOUT_SECONDS is disconnected.
+class QueryServer {
+public:
+    QueryServer(Catalog& catalog, const ServerOptions& opts);
+    // Calls stop().
+    ~QueryServer();
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    // Listens on a Unix domain socket at `path`, accepting connections on
+    // a background thread. A stale socket file at `path` is replaced; any
+    // other file is left alone. Returns false (after printing why) if the
+    // socket cannot be set up.
+    bool listen(const string& path);
+    // Serves one connection read from `in` and answered on `out`, on the
+    // calling thread, until `in` reaches end of file. Used for stdin and
+    // stdout.
+    void serve(int in, int out);
+    // Stops accepting, lets requests already read finish, closes every
+    // connection and joins all threads. Safe to call more than once.
+    void stop();
+
+    uint64_t served() const { return servedCount; }
+
+private:
+    struct Job;
+
+    void acceptLoop();
+    void joinFinishedReaders();
+    bool submit(Job& job);
+    void workerLoop();
+    void run(Job& job);
+
+    ServerOptions opts;
+    QueryCache cache;
+
+    std::mutex lock;
+    std::condition_variable notEmpty, notFull;
+    std::deque<Job*> queue;
+    bool closing = false;           // no more jobs are taken
+    vector<std::thread> workers;
+
+    int listenFd = -1;
+    int wakeFds[2] = {-1, -1};      // a pipe that wakes the acceptor on stop()
+    string socketPath;
+    std::thread acceptor;
+    std::atomic<bool> stopping{false};
+    // connection readers by number, with the sockets they read; those that
+    // have finished are joined by the acceptor. Guarded by `lock`.
+    std::map<uint64_t, std::thread> readers;
+    vector<uint64_t> finishedReaders;
+    std::set<int> connections;
+    uint64_t nextReader = 0;
+    std::atomic<uint64_t> servedCount{0};
+};
+
+// A blocking client for QueryServer's socket protocol.
+class QueryClient {
+public:
+    QueryClient() = default;
+    ~QueryClient();
+    QueryClient(const QueryClient&) = delete;
+    QueryClient& operator=(const QueryClient&) = delete;
+
+    // Returns false (after printing why) if the server cannot be reached.
+    bool connect(const string& path);
+    // Sends one request without waiting for the answer.
+    bool send(const string& query);
+    // Reads the next answer: the result text, or the error message (its
+    // lines unindented) with `ok` false. Returns false if the connection fails or closes.
+    bool receive(string& text, bool& ok);
+
+private:
+    bool readLine(string& line);
+    bool readBytes(size_t n, string& out);
+
+    int fd = -1;
+    string buf;
+    size_t pos = 0;
+};
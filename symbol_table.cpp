@@ -1,8 +1,9 @@
 #include "symbol_table.h"
+#include <algorithm>
 #include <iostream>
+#include "diagnostics.h"
 
 using std::cout;
-using std::cerr;
 using std::endl;
 
 static bool checkBoolExpr(const BoolExpr* expr, const SymbolTable& schema);
@@ -23,6 +24,7 @@ static const char* literalTypeName(Symbol s) {
         case STRING:    return "string literal";
         case TRUE_LIT:  return "true literal";
         case FALSE_LIT: return "false literal";
+        case PARAM:     return "parameter";
         default:        return "unknown literal";
     }
 }
@@ -31,42 +33,88 @@ bool checkQuerySemantics(const Query& q, const SymbolTable& schema) {
     bool ok = true;
 
     if (!q.selectAll) {
-        for (const auto& f : q.fields) {
+        for (size_t i = 0; i < q.fields.size(); ++i) {
+            const string& f = q.fields[i];
+            AggFunc func = q.aggregates[i];
+            if (f == "*") continue;     // COUNT(*)
             if (!schema.hasField(f)) {
-                cerr << "Semantic error: unknown field in SELECT list: '"
+                diagnostics() << "Semantic error: unknown field in SELECT list: '"
                      << f << "'\n";
                 ok = false;
+            } else if ((func == AGG_SUM || func == AGG_AVG) && schema.getFieldType(f) != FT_NUMBER) {
+                diagnostics() << "Semantic error: " << (func == AGG_SUM ? "SUM" : "AVG")
+                     << " of a " << fieldTypeName(schema.getFieldType(f))
+                     << " field: '" << f << "'\n";
+                ok = false;
             }
         }
     }
 
+    for (const auto& g : q.groupBy) {
+        if (!schema.hasField(g)) {
+            diagnostics() << "Semantic error: unknown field in GROUP BY: '" << g << "'\n";
+            ok = false;
+        }
+    }
+    if (q.grouped()) {
+        auto inGroup = [&](const string& f) {
+            return std::find(q.groupBy.begin(), q.groupBy.end(), f) != q.groupBy.end();
+        };
+        if (q.selectAll) {
+            diagnostics() << "Semantic error: SELECT * cannot be used with GROUP BY or aggregates\n";
+            ok = false;
+        }
+        for (size_t i = 0; i < q.fields.size(); ++i) {
+            const string& f = q.fields[i];
+            if (q.aggregates[i] == AGG_NONE && schema.hasField(f) && !inGroup(f)) {
+                diagnostics() << "Semantic error: field '" << f
+                     << "' must be in GROUP BY or inside an aggregate\n";
+                ok = false;
+            }
+        }
+        if (schema.hasField(q.orderBy) && !inGroup(q.orderBy)) {
+            diagnostics() << "Semantic error: ORDER BY field '" << q.orderBy << "' must be in GROUP BY\n";
+            ok = false;
+        }
+    }
+
     if (q.where) {
-        if (!checkBoolExpr(q.where.get(), schema)) {
+        if (!checkBoolExpr(q.where, schema)) {
             ok = false;
         }
     }
 
+    if (!q.orderBy.empty() && !schema.hasField(q.orderBy)) {
+        diagnostics() << "Semantic error: unknown field in ORDER BY: '" << q.orderBy << "'\n";
+        ok = false;
+    }
+
     return ok;
 }
 
 static bool checkBoolExpr(const BoolExpr* expr, const SymbolTable& schema) {
-    if (auto orExpr = dynamic_cast<const OrExpr*>(expr)) {
+    switch (expr->kind) {
+    case EXPR_OR: {
         bool ok = true;
-        for (auto& t : orExpr->terms) {
-            if (!checkBoolExpr(t.get(), schema)) ok = false;
+        for (const BoolExpr* t : static_cast<const OrExpr*>(expr)->terms) {
+            if (!checkBoolExpr(t, schema)) ok = false;
         }
         return ok;
-    } else if (auto andExpr = dynamic_cast<const AndExpr*>(expr)) {
+    }
+    case EXPR_AND: {
         bool ok = true;
-        for (auto& f : andExpr->factors) {
-            if (!checkBoolExpr(f.get(), schema)) ok = false;
+        for (const BoolExpr* f : static_cast<const AndExpr*>(expr)->factors) {
+            if (!checkBoolExpr(f, schema)) ok = false;
         }
         return ok;
-    } else if (auto pred = dynamic_cast<const Predicate*>(expr)) {
-        return checkPredicate(pred, schema);
-    } else if (auto par = dynamic_cast<const ParenExpr*>(expr)) {
+    }
+    case EXPR_PREDICATE:
+        return checkPredicate(static_cast<const Predicate*>(expr), schema);
+    case EXPR_PAREN: {
+        const ParenExpr* par = static_cast<const ParenExpr*>(expr);
         if (!par->inner) return true;
-        return checkBoolExpr(par->inner.get(), schema);
+        return checkBoolExpr(par->inner, schema);
+    }
     }
     return true;
 }
@@ -75,30 +123,32 @@ static bool checkPredicate(const Predicate* pred, const SymbolTable& schema) {
     bool ok = true;
 
     if (!schema.hasField(pred->ident)) {
-        cerr << "Semantic error: unknown field in WHERE: '"
+        diagnostics() << "Semantic error: unknown field in WHERE: '"
              << pred->ident << "'\n";
         return false;
     }
 
     FieldType ft = schema.getFieldType(pred->ident);
+    // a placeholder takes the field's type; its value is checked when bound
+    bool param = pred->literalKind == PARAM;
 
-    if (ft == FT_NUMBER && pred->literalKind != NUMBER) {
-        cerr << "Semantic error: field '" << pred->ident
+    if (ft == FT_NUMBER && !param && pred->literalKind != NUMBER) {
+        diagnostics() << "Semantic error: field '" << pred->ident
              << "' is a number, but compared with "
              << literalTypeName(pred->literalKind) << "\n";
         ok = false;
     }
 
-    if (ft == FT_STRING && pred->literalKind != STRING) {
-        cerr << "Semantic error: field '" << pred->ident
+    if (ft == FT_STRING && !param && pred->literalKind != STRING) {
+        diagnostics() << "Semantic error: field '" << pred->ident
              << "' is a string, but compared with "
              << literalTypeName(pred->literalKind) << "\n";
         ok = false;
     }
 
-    if (ft == FT_BOOL &&
+    if (ft == FT_BOOL && !param &&
         !(pred->literalKind == TRUE_LIT || pred->literalKind == FALSE_LIT)) {
-        cerr << "Semantic error: field '" << pred->ident
+        diagnostics() << "Semantic error: field '" << pred->ident
              << "' is a bool, but compared with "
              << literalTypeName(pred->literalKind) << "\n";
         ok = false;
@@ -108,7 +158,7 @@ static bool checkPredicate(const Predicate* pred, const SymbolTable& schema) {
                        pred->op == GT || pred->op == GTE);
 
     if (relational && ft != FT_NUMBER) {
-        cerr << "Semantic error: relational operator (<, <=, >, >=) used on non-number field '"
+        diagnostics() << "Semantic error: relational operator (<, <=, >, >=) used on non-number field '"
              << pred->ident << "' of type " << fieldTypeName(ft) << "\n";
         ok = false;
     }
@@ -1,10 +1,12 @@
 #pragma once
 #include <string>
 #include <map>
+#include <vector>
 #include "parser.h"
 
 using std::string;
 using std::map;
+using std::vector;
 
 enum FieldType {
     FT_NUMBER,
@@ -14,19 +16,26 @@ enum FieldType {
 
 struct FieldInfo {
     FieldType type;
+    int column;     // position of the field in a Table laid out from this schema
 };
 
 class SymbolTable {
 public:
     void addField(const string& name, FieldType t) {
-        fields[name] = FieldInfo{t};
+        auto it = fields.find(name);
+        if (it != fields.end()) {
+            it->second.type = t;
+            return;
+        }
+        fields[name] = FieldInfo{t, (int)order.size()};
+        order.push_back(name);
     }
 
-    bool hasField(const string& name) const {
+    bool hasField(string_view name) const {
         return fields.find(name) != fields.end();
     }
 
-    FieldType getFieldType(const string& name) const {
+    FieldType getFieldType(string_view name) const {
         auto it = fields.find(name);
         if (it == fields.end()) {
             return FT_STRING;
@@ -34,8 +43,22 @@ public:
         return it->second.type;
     }
 
+    // Column index of a field, or -1 if it is not in the schema.
+    int getColumn(string_view name) const {
+        auto it = fields.find(name);
+        if (it == fields.end()) {
+            return -1;
+        }
+        return it->second.column;
+    }
+
+    // Fields in the order they were added, which is also column order.
+    size_t fieldCount() const { return order.size(); }
+    const string& fieldName(size_t column) const { return order[column]; }
+
 private:
-    map<string, FieldInfo> fields;
+    map<string, FieldInfo, std::less<>> fields;     // transparent: finds by string_view
+    vector<string> order;
 };
 
 bool checkQuerySemantics(const Query& q, const SymbolTable& schema);
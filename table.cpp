@@ -0,0 +1,259 @@
+#include "table.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+static string formatNumber(double v) {
+    char buf[32];
+    snprintf(buf, sizeof buf, "%.15g", v);
+    return buf;
+}
+
+void Column::appendText(string_view text) {
+    switch (type) {
+        case FT_NUMBER: {
+            string tmp(text);
+            appendNumber(std::strtod(tmp.c_str(), nullptr));
+            break;
+        }
+        case FT_BOOL:
+            appendBool(text == "true");
+            break;
+        case FT_STRING:
+            appendString(text);
+            break;
+    }
+}
+
+void Column::appendFrom(const Column& src, size_t row) {
+    switch (type) {
+        case FT_NUMBER: appendNumber(src.numbers[row]); break;
+        case FT_BOOL:   bools.push_back(src.bools[row]); break;
+        case FT_STRING: appendString(src.stringAt(row)); break;
+    }
+}
+
+void Column::gather(const Column& src, const vector<uint32_t>& rows) {
+    switch (type) {
+        case FT_NUMBER: {
+            const double* in = src.numbers.data();
+            for (uint32_t r : rows) numbers.push_back(in[r]);
+            break;
+        }
+        case FT_BOOL: {
+            const uint8_t* in = src.bools.data();
+            for (uint32_t r : rows) bools.push_back(in[r]);
+            break;
+        }
+        case FT_STRING:
+            for (uint32_t r : rows) appendString(src.stringAt(r));
+            break;
+    }
+}
+
+void Column::appendColumn(const Column& src, size_t rows) {
+    switch (type) {
+        case FT_NUMBER:
+            numbers.append(src.numbers.data(), rows);
+            break;
+        case FT_BOOL:
+            bools.append(src.bools.data(), rows);
+            break;
+        case FT_STRING: {
+            if (encoded || src.encoded) {
+                for (size_t r = 0; r < rows; ++r) appendString(src.stringAt(r));
+                break;
+            }
+            uint64_t base = blob.size() - src.offsets[0];
+            blob.append(src.blob.data() + src.offsets[0], src.offsets[rows] - src.offsets[0]);
+            for (size_t r = 1; r <= rows; ++r) offsets.push_back(src.offsets[r] + base);
+            break;
+        }
+    }
+}
+
+// Code of `v`, whose hash is `hash`, among `values` as indexed by
+// `byHash` (laid out like Column::dictCodes), or -1 if it is not there.
+static int64_t findIn(const vector<string>& values, const unordered_multimap<size_t, uint32_t>& byHash,
+                      string_view v, size_t hash) {
+    auto range = byHash.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (values[it->second] == v) return it->second;
+    }
+    return -1;
+}
+
+int64_t Column::findCode(string_view v) const {
+    return findIn(dict, dictCodes, v, std::hash<string_view>()(v));
+}
+
+uint32_t Column::codeFor(string_view v) {
+    size_t hash = std::hash<string_view>()(v);
+    int64_t found = findIn(dict, dictCodes, v, hash);
+    if (found >= 0) return (uint32_t)found;
+    uint32_t code = (uint32_t)dict.size();
+    dict.emplace_back(v);
+    dictCodes.emplace(hash, code);
+    return code;
+}
+
+bool Column::dictionaryEncode(size_t rows, size_t maxDistinct) {
+    if (type != FT_STRING || encoded) return false;
+    vector<string> values;
+    unordered_multimap<size_t, uint32_t> lookup;
+    vector<uint32_t> rowCodes(rows);
+    for (size_t r = 0; r < rows; ++r) {
+        string_view v = stringAt(r);
+        size_t hash = std::hash<string_view>()(v);
+        int64_t code = findIn(values, lookup, v, hash);
+        if (code < 0) {
+            if (values.size() >= maxDistinct) return false;
+            code = (int64_t)values.size();
+            lookup.emplace(hash, (uint32_t)code);
+            values.emplace_back(v);
+        }
+        rowCodes[r] = (uint32_t)code;
+    }
+    encoded = true;
+    dict.swap(values);
+    dictCodes.swap(lookup);
+    codes = ColumnBuffer<uint32_t>();
+    codes.append(rowCodes.data(), rowCodes.size());
+    offsets = ColumnBuffer<uint64_t>{0};
+    blob = ColumnBuffer<char>();
+    return true;
+}
+
+string Column::cellText(size_t row) const {
+    switch (type) {
+        case FT_NUMBER: return formatNumber(numbers[row]);
+        case FT_BOOL:   return bools[row] ? "true" : "false";
+        case FT_STRING: return string(stringAt(row));
+    }
+    return "";
+}
+
+void Column::writeCell(size_t row, string& out) const {
+    switch (type) {
+        case FT_NUMBER: {
+            double v = numbers[row];
+            // whole numbers are the common case and skip snprintf
+            if (v > -1e15 && v < 1e15 && v == (double)(int64_t)v && (v != 0 || !std::signbit(v))) {
+                char buf[24];
+                auto res = std::to_chars(buf, buf + sizeof buf, (int64_t)v);
+                out.append(buf, res.ptr);
+            } else {
+                char buf[32];
+                out.append(buf, snprintf(buf, sizeof buf, "%.15g", v));
+            }
+            break;
+        }
+        case FT_BOOL:
+            out += bools[row] ? "true" : "false";
+            break;
+        case FT_STRING:
+            out += stringAt(row);
+            break;
+    }
+}
+
+Table::Table(const SymbolTable& schema) : fields(schema) {
+    columns.resize(schema.fieldCount());
+    for (size_t i = 0; i < columns.size(); ++i) {
+        columns[i].name = schema.fieldName(i);
+        columns[i].type = schema.getFieldType(columns[i].name);
+    }
+}
+
+Table Table::fromRows(const SymbolTable& schema, const RowTable& input) {
+    Table t(schema);
+    for (const Row& r : input) {
+        for (auto& col : t.columns) {
+            auto it = r.find(col.name);
+            col.appendText(it != r.end() ? it->second : string());
+        }
+        t.finishRow();
+    }
+    return t;
+}
+
+void Table::addIndex(shared_ptr<const ColumnIndex> idx) {
+    for (auto& existing : indexList) {
+        if (existing->column() == idx->column() && existing->kind() == idx->kind()) {
+            existing = idx;
+            return;
+        }
+    }
+    indexList.push_back(idx);
+}
+
+void Table::append(const Table& other) {
+    clearZoneMaps();
+    indexList.clear();
+    for (size_t c = 0; c < columns.size(); ++c) {
+        columns[c].appendColumn(other.columns[c], other.rows);
+    }
+    rows += other.rows;
+}
+
+ZoneMap computeZoneMap(const Column& col, size_t rows, size_t rowsPerZone) {
+    ZoneMap zm;
+    if (col.type == FT_STRING) return zm;
+    size_t zoneCount = (rows + rowsPerZone - 1) / rowsPerZone;
+    zm.min.resize(zoneCount);
+    zm.max.resize(zoneCount);
+    for (size_t z = 0; z < zoneCount; ++z) {
+        size_t begin = z * rowsPerZone;
+        size_t end = std::min(rows, begin + rowsPerZone);
+        double lo = HUGE_VAL, hi = -HUGE_VAL;
+        for (size_t r = begin; r < end; ++r) {
+            double v = col.type == FT_NUMBER ? col.numbers[r] : col.bools[r];
+            if (std::isnan(v)) {
+                lo = -HUGE_VAL;
+                hi = HUGE_VAL;
+                break;
+            }
+            if (v < lo) lo = v;
+            if (v > hi) hi = v;
+        }
+        zm.min[z] = lo;
+        zm.max[z] = hi;
+    }
+    return zm;
+}
+
+void Table::buildZoneMaps(size_t rowsPerZone) {
+    zoneSize = rowsPerZone;
+    for (auto& col : columns) {
+        col.zones = computeZoneMap(col, rows, rowsPerZone);
+    }
+}
+
+void Table::buildZoneMap(size_t c) {
+    if (zoneSize) columns[c].zones = computeZoneMap(columns[c], rows, zoneSize);
+}
+
+void Table::clearZoneMaps() {
+    zoneSize = 0;
+    for (auto& col : columns) col.zones = ZoneMap();
+}
+
+void Table::dictionaryEncode(size_t maxDistinct) {
+    for (size_t c = 0; c < columns.size(); ++c) dictionaryEncodeColumn(c, maxDistinct);
+}
+
+void Table::dictionaryEncodeColumn(size_t c, size_t maxDistinct) {
+    columns[c].dictionaryEncode(rows, std::min(maxDistinct, rows / 2));
+}
+
+RowTable Table::toRows() const {
+    RowTable out(rows);
+    for (const auto& col : columns) {
+        for (size_t r = 0; r < rows; ++r) {
+            out[r][col.name] = col.cellText(r);
+        }
+    }
+    return out;
+}
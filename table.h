@@ -0,0 +1,195 @@
+#pragma once
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "symbol_table.h"
+#include "index.h"
+
+using std::map;
+using std::shared_ptr;
+using std::string;
+using std::string_view;
+using std::unordered_map;
+using std::unordered_multimap;
+using std::vector;
+
+// Row-at-a-time form, kept for building small tables by hand and for
+// printing results.
+using Row = map<string,string>;
+using RowTable = vector<Row>;
+
+// Contiguous column storage that either owns its elements or borrows
+// read-only memory owned elsewhere (a mapped file). Appending to a
+// borrowed buffer first copies it into owned storage.
+template <class T>
+class ColumnBuffer {
+public:
+    ColumnBuffer() = default;
+    ColumnBuffer(std::initializer_list<T> init) : owned(init) {}
+
+    const T* data() const { return ext ? ext : owned.data(); }
+    size_t size() const { return ext ? extSize : owned.size(); }
+    bool empty() const { return size() == 0; }
+    const T& operator[](size_t i) const { return data()[i]; }
+    bool borrowed() const { return ext != nullptr; }
+
+    void borrow(const T* p, size_t n) {
+        owned.clear();
+        owned.shrink_to_fit();
+        ext = p;
+        extSize = n;
+    }
+    void reserve(size_t n) { own(); owned.reserve(n); }
+    void push_back(const T& v) { own(); owned.push_back(v); }
+    void append(const T* p, size_t n) { own(); owned.insert(owned.end(), p, p + n); }
+
+private:
+    void own() {
+        if (!ext) return;
+        owned.assign(ext, ext + extSize);
+        ext = nullptr;
+        extSize = 0;
+    }
+
+    vector<T> owned;
+    const T* ext = nullptr;
+    size_t extSize = 0;
+};
+
+// Per-zone min/max of a number or bool column (bools as 0/1). A zone
+// holding a NaN gets the full range so it is never skipped.
+struct ZoneMap {
+    vector<double> min;
+    vector<double> max;
+};
+
+// Strings columns with at most this many distinct values (and at most
+// one distinct value per two rows) are dictionary-encoded when loaded.
+const size_t DICT_MAX_DISTINCT = 64 * 1024;
+
+// One typed column. Only the storage matching `type` is used:
+//   FT_NUMBER  numbers[row]
+//   FT_BOOL    bools[row] (0 or 1)
+//   FT_STRING  blob[offsets[row], offsets[row+1]), or dict[codes[row]]
+//              once the column is dictionary-encoded
+struct Column {
+    string name;
+    FieldType type = FT_STRING;
+    ColumnBuffer<double> numbers;
+    ColumnBuffer<uint8_t> bools;
+    ColumnBuffer<uint64_t> offsets{0};
+    ColumnBuffer<char> blob;
+    ZoneMap zones;      // empty unless Table::buildZoneMaps() ran or the file had them
+
+    bool encoded = false;
+    ColumnBuffer<uint32_t> codes;
+    vector<string> dict;                    // code -> value
+    // Hash of a value -> codes of the values with that hash, compared
+    // through `dict`, so a lookup never copies the value it looks for.
+    unordered_multimap<size_t, uint32_t> dictCodes;
+
+    string_view stringAt(size_t row) const {
+        if (encoded) return dict[codes[row]];
+        return string_view(blob.data() + offsets[row], offsets[row+1] - offsets[row]);
+    }
+
+    void appendNumber(double v) { numbers.push_back(v); }
+    void appendBool(bool v) { bools.push_back(v ? 1 : 0); }
+    void appendString(string_view v) {
+        if (encoded) {
+            codes.push_back(codeFor(v));
+            return;
+        }
+        blob.append(v.data(), v.size());
+        offsets.push_back(blob.size());
+    }
+    // Code of `v` in the dictionary, adding it if new.
+    uint32_t codeFor(string_view v);
+    // Code of `v`, or -1 if it is not in the dictionary.
+    int64_t findCode(string_view v) const;
+    // Re-encodes the first `rows` strings as dictionary codes if there are
+    // at most `maxDistinct` distinct values. Returns whether it did.
+    bool dictionaryEncode(size_t rows, size_t maxDistinct);
+    // Parses `text` according to the column type and appends it.
+    void appendText(string_view text);
+    // Appends the value in `src` at `row`; `src` must have the same type.
+    void appendFrom(const Column& src, size_t row);
+    // Appends the values in `src` at each of `rows`, in order.
+    void gather(const Column& src, const vector<uint32_t>& rows);
+    // Appends every row of `src`, which must have the same type.
+    void appendColumn(const Column& src, size_t rows);
+    // The cell formatted the way it would be written in a Row.
+    string cellText(size_t row) const;
+    // Appends the same text as cellText() to `out` without a temporary.
+    void writeCell(size_t row, string& out) const;
+};
+
+// Columnar table whose layout comes from a SymbolTable: column i holds
+// the field with schema column index i.
+class Table {
+public:
+    Table() = default;
+    explicit Table(const SymbolTable& schema);
+
+    static Table fromRows(const SymbolTable& schema, const RowTable& rows);
+    RowTable toRows() const;
+
+    const SymbolTable& schema() const { return fields; }
+    size_t rowCount() const { return rows; }
+    size_t columnCount() const { return columns.size(); }
+    const Column& column(size_t i) const { return columns[i]; }
+    Column& column(size_t i) { return columns[i]; }
+    // Index of the named column, or -1.
+    int findColumn(const string& name) const { return fields.getColumn(name); }
+
+    // Appends all rows of `other`, which must have the same layout.
+    void append(const Table& other);
+    // Dictionary-encodes every string column whose distinct values number
+    // at most min(maxDistinct, rows / 2).
+    void dictionaryEncode(size_t maxDistinct = DICT_MAX_DISTINCT);
+    // The same for column `c` alone.
+    void dictionaryEncodeColumn(size_t c, size_t maxDistinct = DICT_MAX_DISTINCT);
+
+    // Call after appending one value to every column.
+    void finishRow() { rows++; }
+    void setRowCount(size_t n) { rows = n; }
+
+    // Rows per zone, or 0 when the table has no zone maps.
+    size_t zoneRows() const { return zoneSize; }
+    // Computes min/max for every number and bool column over zones of
+    // `rowsPerZone` rows, which must be a multiple of BLOCK_ROWS.
+    void buildZoneMaps(size_t rowsPerZone = DEFAULT_ZONE_ROWS);
+    // Computes the zone map of column `c` over zones of zoneRows() rows.
+    void buildZoneMap(size_t c);
+    void setZoneRows(size_t n) { zoneSize = n; }
+    // Drops the zone maps; call before appending rows.
+    void clearZoneMaps();
+
+    // Secondary indexes; see index.h. Dropped by append().
+    void addIndex(shared_ptr<const ColumnIndex> idx);
+    const vector<shared_ptr<const ColumnIndex>>& indexes() const { return indexList; }
+
+    // Keeps the memory that borrowed column buffers point into alive for
+    // as long as this table (or any copy of it) exists.
+    void addBacking(shared_ptr<const void> b) { backing.push_back(b); }
+    const vector<shared_ptr<const void>>& backings() const { return backing; }
+
+    static const size_t DEFAULT_ZONE_ROWS = 64 * 1024;
+
+private:
+    SymbolTable fields;
+    vector<Column> columns;
+    size_t rows = 0;
+    size_t zoneSize = 0;
+    vector<shared_ptr<const void>> backing;
+    vector<shared_ptr<const ColumnIndex>> indexList;
+};
+
+// Zone maps for one column over zones of `rowsPerZone` rows; empty for
+// string columns.
+ZoneMap computeZoneMap(const Column& col, size_t rows, size_t rowsPerZone);
@@ -0,0 +1,771 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "catalog.h"
+#include "column_file.h"
+#include "continuous.h"
+#include "diagnostics.h"
+#include "kernels.h"
+#include "query_cache.h"
+#include "server.h"
+
+using namespace std;
+
+// Result checks for the query engine. Each test runs queries through
+// prepareQuery and executePrepared, as queryparser does, and compares the
+// rows they return. `make test` builds and runs them; the exit status is
+// nonzero if any check failed.
+
+static int checks = 0, failures = 0;
+
+static void check(bool ok, const string& what) {
+    checks++;
+    if (ok) return;
+    failures++;
+    cerr << "FAILED: " << what << "\n";
+}
+
+// The table as "header;row;row", with cells joined by ',' in output
+// column order.
+static string formatRows(const Table& t) {
+    string out;
+    for (size_t c = 0; c < t.columnCount(); ++c) {
+        if (c) out += ',';
+        out += t.schema().fieldName(c);
+    }
+    for (size_t r = 0; r < t.rowCount(); ++r) {
+        out += ';';
+        for (size_t c = 0; c < t.columnCount(); ++c) {
+            if (c) out += ',';
+            t.column(c).writeCell(r, out);
+        }
+    }
+    return out;
+}
+
+// Runs `query` and returns its rows as formatRows() does, or "error: "
+// followed by the messages it printed.
+static string run(Catalog& catalog, const string& query, const vector<string>& params = {},
+                  const EvalOptions& opts = EvalOptions()) {
+    DiagnosticsCapture errors;
+    shared_ptr<PreparedQuery> q = prepareQuery(catalog, query);
+    Table result;
+    if (!q || !executePrepared(*q, params, result, opts)) return "error: " + errors.text();
+    return formatRows(result);
+}
+
+static void expectRows(Catalog& catalog, const string& query, const string& expected,
+                       const vector<string>& params = {}) {
+    string got = run(catalog, query, params);
+    check(got == expected, query + "\n  expected " + expected + "\n  got      " + got);
+}
+
+// Expects `query` to fail with a message containing `message`.
+static void expectError(Catalog& catalog, const string& query, const string& message,
+                        const vector<string>& params = {}) {
+    string got = run(catalog, query, params);
+    check(got.compare(0, 7, "error: ") == 0 && got.find(message) != string::npos,
+          query + "\n  expected an error with '" + message + "'\n  got " + got);
+}
+
+// The built-in table of queryparser.
+static Table customers() {
+    SymbolTable schema;
+    schema.addField("name",   FT_STRING);
+    schema.addField("age",    FT_NUMBER);
+    schema.addField("status", FT_STRING);
+    schema.addField("active", FT_BOOL);
+    return Table::fromRows(schema, {
+        { {"name","Alice"}, {"age","25"}, {"status","vip"}, {"active","true"} },
+        { {"name","Ben"}, {"age","22"}, {"status","regular"}, {"active","true"} },
+        { {"name","Bob"},   {"age","19"}, {"status","regular"}, {"active","true"} },
+        { {"name","Carol"}, {"age","42"}, {"status","regular"}, {"active","false"} },
+        { {"name","Ava"}, {"age","19"}, {"status","vip"}, {"active","false"} },
+    });
+}
+
+// A scratch file path unique to this run.
+static string tempPath(const string& name) {
+    return "/tmp/querytest-" + to_string(getpid()) + "-" + name;
+}
+
+static string writeFile(const string& name, const string& text) {
+    string path = tempPath(name);
+    ofstream(path) << text;
+    return path;
+}
+
+static void testProjection() {
+    Catalog catalog;
+    catalog.addTable("customers", customers());
+    expectRows(catalog, "SELECT name, age FROM customers WHERE age >= 25",
+               "name,age;Alice,25;Carol,42");
+    expectRows(catalog, "SELECT * FROM customers WHERE name = \"Bob\"",
+               "name,age,status,active;Bob,19,regular,true");
+    // a field listed twice comes out once
+    expectRows(catalog, "SELECT age, age FROM customers WHERE status = \"vip\"",
+               "age;25;19");
+    expectRows(catalog, "SELECT name, age, name FROM customers WHERE active = false",
+               "name,age;Carol,42;Ava,19");
+    expectRows(catalog, "SELECT name FROM customers WHERE age > 100", "name");
+    expectError(catalog, "SELECT height FROM customers", "unknown field in SELECT list");
+}
+
+// `rows` generated customers with varied ages, statuses and flags.
+static Table generated(size_t rows) {
+    SymbolTable schema;
+    schema.addField("id",     FT_NUMBER);
+    schema.addField("age",    FT_NUMBER);
+    schema.addField("status", FT_STRING);
+    schema.addField("active", FT_BOOL);
+    Table t(schema);
+    const char* statuses[] = {"regular", "vip", "gold", "new"};
+    for (size_t r = 0; r < rows; ++r) {
+        t.column(0).appendNumber((double)r);
+        t.column(1).appendNumber((double)(r * 7919 % 83));
+        t.column(2).appendString(statuses[r * 31 % 4]);
+        t.column(3).appendBool(r % 3 == 0);
+        t.finishRow();
+    }
+    return t;
+}
+
+// `rows` rows of a number column with NaN cells, a plain and a
+// dictionary-encoded string column, some values too long to be stored
+// inline in a std::string, and a bool column.
+static Table mixedCells(size_t rows) {
+    SymbolTable schema;
+    schema.addField("x", FT_NUMBER);
+    schema.addField("s", FT_STRING);
+    schema.addField("d", FT_STRING);
+    schema.addField("b", FT_BOOL);
+    Table t(schema);
+    for (size_t r = 0; r < rows; ++r) {
+        string v = (r % 9 < 3 ? "a value longer than any inline string " : "k") + to_string(r * 13 % 9);
+        t.column(0).appendNumber(r % 7 == 0 ? NAN : (double)(r * 37 % 50));
+        t.column(1).appendString(v);
+        t.column(2).appendString(v);
+        t.column(3).appendBool(r % 3 == 0);
+        t.finishRow();
+    }
+    t.dictionaryEncodeColumn(2);
+    return t;
+}
+
+// Every kernel set selects the rows matchesRow accepts, on row counts and
+// starting rows that do not line up with bitmap words or blocks.
+static void testKernels() {
+    const string longer = "\"a value longer than any inline string 1\"";
+    const vector<string> filters = {
+        "x < 20", "x <= 20", "x > 30", "x >= 30", "x = 7", "x != 7",
+        "x = 1 OR x = 4 OR x = 9 OR x = 45",
+        "s = \"k4\"", "s != \"k4\"", "s = " + longer, "s != " + longer,
+        "s = \"k4\" OR s = \"k5\" OR s = " + longer,
+        "d = \"k4\"", "d != \"k4\"", "d = " + longer, "d != " + longer,
+        "d = \"k4\" OR d = \"k5\" OR d = " + longer,
+        "b = true", "b != true",
+        "(x < 10 OR s = \"k2\") AND b = false AND d != \"k5\"",
+    };
+    for (size_t rows : {(size_t)37, BLOCK_ROWS + 1, 2 * BLOCK_ROWS + 77}) {
+        Catalog catalog;
+        catalog.addTable("cells", mixedCells(rows));
+        for (const string& f : filters) {
+            shared_ptr<PreparedQuery> q = prepareQuery(catalog, "SELECT x FROM cells WHERE " + f);
+            check(q != nullptr, "compile " + f);
+            if (!q) continue;
+            vector<uint32_t> expected;
+            for (size_t r = 0; r < rows; ++r) {
+                if (matchesRow(q->plan, *q->table, r)) expected.push_back((uint32_t)r);
+            }
+            size_t from = rows / 3;
+            vector<uint32_t> tail(std::lower_bound(expected.begin(), expected.end(), from), expected.end());
+            for (int isa = ISA_SCALAR; isa <= bestKernelIsa(); ++isa) {
+                setKernelIsa((KernelIsa)isa);
+                string what = f + " on " + to_string(rows) + " rows with " + kernelIsaName((KernelIsa)isa);
+                check(selectRows(q->plan, *q->table) == expected, what);
+                check(selectRows(q->plan, *q->table, from) == tail, what + " from row " + to_string(from));
+            }
+            setKernelIsa(bestKernelIsa());
+        }
+    }
+
+    // the ORs above are tested as sets
+    Catalog catalog;
+    catalog.addTable("cells", mixedCells(10));
+    shared_ptr<PreparedQuery> q = prepareQuery(catalog, "SELECT x FROM cells WHERE " + filters[6]);
+    check(q && q->plan.where.size() == 1 && q->plan.where[0].op == OP_NUM_IN, "ORs become an IN set");
+}
+
+static void testCsv() {
+    Catalog catalog;
+    catalog.addFile("people", writeFile("people.csv",
+        "name,age,member\nAnn,31,true\n\"Lee, Jo\",27,false\nMo,45,true\n"));
+    expectRows(catalog, "SELECT name, age FROM people WHERE member = true",
+               "name,age;Ann,31;Mo,45");
+    expectRows(catalog, "SELECT name FROM people WHERE age < 30", "name;Lee, Jo");
+
+    catalog.addFile("dup", writeFile("dup.csv", "id,name,id\n1,a,2\n"));
+    expectError(catalog, "SELECT id FROM dup", "duplicate column 'id' in header");
+    catalog.addFile("empty", writeFile("empty.csv", ""));
+    expectError(catalog, "SELECT id FROM empty", "missing header row");
+    catalog.addFile("gap", writeFile("gap.csv", "name,age\nAnn,31\nBo,\nCy,40\n"));
+    expectError(catalog, "SELECT name FROM gap WHERE age > 30",
+                "gap.csv:3 missing number for field 'age'");
+    // an empty string cell is fine
+    catalog.addFile("blank", writeFile("blank.csv", "name,age\n,31\nBo,20\n"));
+    expectRows(catalog, "SELECT name FROM blank WHERE age > 30", "name;");
+
+    for (const char* f : {"people.csv", "dup.csv", "empty.csv", "gap.csv", "blank.csv"}) {
+        unlink(tempPath(f).c_str());
+    }
+}
+
+// Runs `filter` on the table "t" of both catalogs, one with indexes and
+// one without, and expects the same rows, with the indexed catalog
+// reading them through an index only when `usesIndex`.
+static void expectIndexed(Catalog& indexed, Catalog& plain, const string& filter, bool usesIndex) {
+    const string q = "SELECT * FROM t WHERE " + filter;
+    string expected = run(plain, q);
+    check(expected.compare(0, 7, "error: ") != 0 && run(indexed, q) == expected,
+          "indexed " + filter + " matches a scan");
+    shared_ptr<PreparedQuery> p = prepareQuery(indexed, q);
+    if (!p) return;
+    vector<PredNode> prog = bindProgram(p->plan.where, *p->table);
+    check((chooseAccessPath(prog, *p->table).index != nullptr) == usesIndex,
+          filter + (usesIndex ? " reads an index" : " scans"));
+}
+
+static void testIndexes() {
+    Catalog indexed, plain;
+    indexed.addTable("t", generated(20000));
+    plain.addTable("t", generated(20000));
+    check(indexed.createIndex("t", "id", INDEX_HASH) && indexed.createIndex("t", "age", INDEX_SORTED) &&
+          indexed.createIndex("t", "status", INDEX_HASH), "create indexes");
+    expectIndexed(indexed, plain, "id = 1234", true);
+    expectIndexed(indexed, plain, "id = 20000", true);
+    expectIndexed(indexed, plain, "age = 7", true);
+    expectIndexed(indexed, plain, "age < 5", true);
+    expectIndexed(indexed, plain, "age >= 80", true);
+    expectIndexed(indexed, plain, "age >= 80 AND age < 82", true);
+    // the other factors of an AND are tested on the rows the index returns
+    expectIndexed(indexed, plain, "age = 7 AND active = true AND status != \"vip\"", true);
+    expectIndexed(indexed, plain, "id = 99 AND age > 50", true);
+    expectIndexed(indexed, plain, "id = 98 AND age > 50", true);
+    // past 1/INDEX_MAX_FRACTION of the rows a scan is cheaper
+    expectIndexed(indexed, plain, "age > 20", false);
+    expectIndexed(indexed, plain, "status = \"vip\"", false);
+    expectIndexed(indexed, plain, "age < 5 OR active = true", false);
+
+    // NaN cells are never in a range
+    Catalog withNan, scanned;
+    withNan.addTable("t", mixedCells(2000));
+    scanned.addTable("t", mixedCells(2000));
+    check(withNan.createIndex("t", "x", INDEX_SORTED), "create index on x");
+    for (const char* f : {"x < 3", "x <= 3", "x > 46", "x >= 46", "x = 0", "x > 46 AND x < 49"}) {
+        expectIndexed(withNan, scanned, f, true);
+    }
+    expectIndexed(withNan, scanned, "x != 7", false);
+}
+
+static void testDictionary() {
+    Catalog catalog;
+    catalog.addTable("customers", customers());
+    shared_ptr<const Table> t = catalog.lookup("customers");
+    check(t && t->column(t->findColumn("status")).encoded, "status is dictionary-encoded");
+    expectRows(catalog, "SELECT name FROM customers WHERE status = \"vip\"", "name;Alice;Ava");
+    expectRows(catalog, "SELECT name FROM customers WHERE status != \"regular\" AND age < 20",
+               "name;Ava");
+    // a literal missing from the dictionary
+    expectRows(catalog, "SELECT name FROM customers WHERE status = \"gold\"", "name");
+    expectRows(catalog, "SELECT name FROM customers WHERE status != \"gold\" AND age > 40",
+               "name;Carol");
+    expectRows(catalog, "SELECT name FROM customers WHERE status = \"gold\" OR status = \"vip\""
+               " OR status = \"silver\"", "name;Alice;Ava");
+
+    // the encoding survives a round trip through a column file
+    string path = tempPath("customers.qcol");
+    check(t && writeColumnFile(*t, path), "write customers.qcol");
+    catalog.addFile("saved", path);
+    expectRows(catalog, "SELECT name, status FROM saved WHERE status = \"regular\" AND age > 20",
+               "name,status;Ben,regular;Carol,regular");
+
+    // a file whose dictionary repeats a value is refused rather than read
+    // past the end of the dictionary
+    SymbolTable schema;
+    schema.addField("tag", FT_STRING);
+    Table tags = Table::fromRows(schema, {
+        { {"tag","qxvalue1"} }, { {"tag","qxvalue2"} }, { {"tag","qxvalue1"} }, { {"tag","qxvalue2"} },
+    });
+    tags.dictionaryEncode();
+    string bad = tempPath("tags.qcol");
+    check(writeColumnFile(tags, bad), "write tags.qcol");
+    string bytes;
+    {
+        ifstream in(bad, ios::binary);
+        bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    size_t at = bytes.find("qxvalue1qxvalue2");
+    check(at != string::npos, "dictionary bytes found in tags.qcol");
+    if (at != string::npos) {
+        bytes.replace(at + 8, 8, "qxvalue1");
+        ofstream(bad, ios::binary) << bytes;
+        catalog.addFile("tags", bad);
+        expectError(catalog, "SELECT tag FROM tags", "duplicate dictionary entry");
+    }
+
+    // string offsets that go backwards are refused rather than read as a
+    // huge length
+    Table words = Table::fromRows(schema, { { {"tag","aa"} }, { {"tag","bbbb"} }, { {"tag","c"} } });
+    string backwards = tempPath("words.qcol");
+    check(writeColumnFile(words, backwards), "write words.qcol");
+    {
+        ifstream in(backwards, ios::binary);
+        bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    const uint64_t offs[] = {0, 2, 6, 7};
+    at = bytes.find(string((const char*)offs, sizeof offs));
+    check(at != string::npos, "string offsets found in words.qcol");
+    if (at != string::npos) {
+        const uint64_t swapped[] = {6, 2};
+        bytes.replace(at + sizeof(uint64_t), sizeof swapped, (const char*)swapped, sizeof swapped);
+        ofstream(backwards, ios::binary) << bytes;
+        catalog.addFile("words", backwards);
+        expectError(catalog, "SELECT tag FROM words", "bad string offsets");
+    }
+    unlink(path.c_str());
+    unlink(bad.c_str());
+    unlink(backwards.c_str());
+}
+
+static void testParameters() {
+    Catalog catalog;
+    catalog.addTable("customers", customers());
+    const string q = "SELECT name FROM customers WHERE age >= ? AND status = ? AND active = ?";
+    expectRows(catalog, q, "name;Alice", {"21", "vip", "true"});
+    expectRows(catalog, q, "name;Ava", {"19", "vip", "false"});
+    expectRows(catalog, q, "name;Ben;Bob", {"18.5", "regular", "true"});
+    expectRows(catalog, "SELECT name FROM customers WHERE active != ? AND age < ?",
+               "name;Carol;Ava", {"true", "50"});
+
+    // the cache hands back one plan for the shape, bound per execution
+    QueryCache cache(catalog);
+    Table first, second;
+    auto p1 = cache.prepare(q);
+    auto p2 = cache.prepare(q);
+    check(p1 && p1 == p2 && executePrepared(*p1, {"40", "regular", "false"}, first) &&
+          executePrepared(*p2, {"20", "vip", "false"}, second) &&
+          formatRows(first) == "name;Carol" && formatRows(second) == "name",
+          "cached plan bound twice");
+
+    // CRLF line endings lex as the key treats them, whatever was cached first
+    const string crlf = "SELECT name\r\nFROM customers\r\nWHERE age > 40\r\n";
+    expectRows(catalog, crlf, "name;Carol");
+    QueryCache lineEnds(catalog);
+    auto withCr = lineEnds.prepare(crlf);
+    check(withCr && withCr == lineEnds.prepare("SELECT name\nFROM customers\nWHERE age > 40\n"),
+          "CRLF and LF queries share a plan");
+
+    expectError(catalog, q, "takes 3 parameter(s), got 2", {"21", "vip"});
+    expectError(catalog, q, "must be true or false", {"21", "vip", "yes"});
+    // numbers follow the lexical rules of number literals in the query
+    for (const char* bad : {"nan", "inf", "0x1p3", "1e3", " 21", "21.", "", "-5"}) {
+        expectError(catalog, q, "parameter 1 must be a number", {bad, "vip", "true"});
+    }
+}
+
+// A shared scan gives each query the rows it gets alone, as --batch runs
+// them: queries that fail to prepare are left out of the batch.
+static void testBatch() {
+    Catalog catalog;
+    catalog.addTable("people", generated(20000));
+    check(catalog.createIndex("people", "id", INDEX_SORTED), "create index on id");
+    const vector<string> texts = {
+        "SELECT id FROM people WHERE age > 60 AND active = true",
+        "SELECT id, status FROM people WHERE status = \"vip\" OR age < 3",
+        "SELECT nothing FROM people",
+        "SELECT id FROM people",
+        "SELECT id, age FROM people WHERE active = false ORDER BY age DESC LIMIT 10",
+        "SELECT status, COUNT(*), AVG(age) FROM people WHERE age > 20 GROUP BY status",
+        "SELECT id FROM people WHERE age < 5 AND age > 10",
+        "SELECT id, age FROM people WHERE id = 77",
+    };
+    vector<shared_ptr<PreparedQuery>> queries;
+    vector<const CompiledQuery*> plans;
+    {
+        DiagnosticsCapture errors;
+        for (const string& t : texts) {
+            queries.push_back(prepareQuery(catalog, t));
+            if (queries.back()) plans.push_back(&queries.back()->plan);
+        }
+    }
+    check(!queries[2] && plans.size() == texts.size() - 1, "only the bad query fails to prepare");
+
+    EvalOptions parallel;
+    parallel.threads = 4;
+    parallel.morselRows = 1024;
+    parallel.minParallelRows = 0;
+    for (const EvalOptions& opts : {EvalOptions(), parallel}) {
+        vector<Table> results = evaluateBatch(plans, *catalog.lookup("people"), opts);
+        check(results.size() == plans.size(), "one result per batched query");
+        if (results.size() != plans.size()) continue;
+        for (size_t i = 0, k = 0; i < texts.size(); ++i) {
+            if (!queries[i]) continue;
+            string alone = run(catalog, texts[i]);
+            check(formatRows(results[k++]) == alone, "batched " + texts[i] + " matches running it alone");
+        }
+    }
+}
+
+static void testAdaptive() {
+    Catalog catalog;
+    catalog.addTable("people", generated(20000));
+    const string q = "SELECT id FROM people WHERE (age > 60 OR status = \"vip\") AND active = true"
+                     " AND age != 70";
+    EvalOptions serial;
+    serial.adaptive = false;
+    string expected = run(catalog, q, {}, serial);
+    check(expected.size() > 1000, "adaptive query matches rows");
+
+    // reordering on many threads, with counters, returns the same rows
+    ScanStats stats;
+    EvalOptions opts;
+    opts.threads = 4;
+    opts.morselRows = 1024;
+    opts.minParallelRows = 0;
+    opts.stats = &stats;
+    check(run(catalog, q, {}, opts) == expected, "adaptive parallel scan matches serial");
+    check(!stats.nodes.empty() && stats.nodes[0].rows == 20000,
+          "counters of every thread are summed");
+}
+
+static void testOptimizer() {
+    Catalog catalog;
+    catalog.addTable("customers", customers());
+    expectRows(catalog, "SELECT name FROM customers WHERE age >= 21 AND age > 24", "name;Alice;Carol");
+    expectRows(catalog, "SELECT name FROM customers WHERE age < 20 AND age > 30", "name");
+    expectRows(catalog, "SELECT name FROM customers WHERE age != 19 AND age != 25 AND age <= 30",
+               "name;Ben");
+    expectRows(catalog, "SELECT name FROM customers WHERE age = 19 OR age = 42 OR age = 22 OR age = 7",
+               "name;Ben;Bob;Carol;Ava");
+    expectRows(catalog, "SELECT name FROM customers WHERE status = \"vip\" OR status != \"vip\"",
+               "name;Alice;Ben;Bob;Carol;Ava");
+    expectRows(catalog, "SELECT name FROM customers WHERE (age = ? OR age = ? OR age = ?) AND active = true",
+               "name;Alice;Bob", {"19", "25", "19"});
+
+    // literals the optimizer could not order are refused before it runs
+    string huge = "1" + string(400, '0');
+    expectError(catalog, "SELECT name FROM customers WHERE age = 1 OR age = 2 OR age = " + huge,
+                "number out of range");
+    expectError(catalog, "SELECT name FROM customers WHERE age = ? OR age = ? OR age = ?",
+                "parameter 3 is out of range", {"1", "2", huge});
+}
+
+static void testLazyLoad() {
+    string text = "id,name,score\n";
+    for (int r = 0; r < 3000; ++r) {
+        text += to_string(r) + "," + (r % 100 == 0 ? "\"multi\nline\"" : "n" + to_string(r % 7)) +
+                "," + to_string(r % 10) + "\n";
+    }
+    string path = writeFile("lazy.csv", text);
+
+    // a query naming no column still sees every row
+    {
+        Catalog catalog;
+        catalog.addFile("t", path);
+        expectRows(catalog, "SELECT COUNT(*) FROM t", "COUNT(*);3000");
+        expectRows(catalog, "SELECT COUNT(*) FROM t WHERE score = 3", "COUNT(*);300");
+        expectRows(catalog, "SELECT COUNT(*) FROM t", "COUNT(*);3000");
+        expectRows(catalog, "SELECT id FROM t WHERE id >= 2998", "id;2998;2999");
+    }
+    // and so does every one of many first queries racing to load the table
+    {
+        Catalog catalog;
+        catalog.addFile("t", path);
+        const vector<string> queries = {
+            "SELECT COUNT(*) FROM t",
+            "SELECT COUNT(*) FROM t WHERE score < 5",
+            "SELECT COUNT(name) FROM t",
+            "SELECT COUNT(*) FROM t WHERE id > 2899",
+        };
+        const vector<string> expected = {
+            "COUNT(*);3000", "COUNT(*);1500", "COUNT(name);3000", "COUNT(*);100",
+        };
+        vector<string> got(16);
+        vector<thread> threads;
+        for (size_t i = 0; i < got.size(); ++i) {
+            threads.emplace_back([&, i] { got[i] = run(catalog, queries[i % queries.size()]); });
+        }
+        for (auto& t : threads) t.join();
+        for (size_t i = 0; i < got.size(); ++i) {
+            check(got[i] == expected[i % queries.size()],
+                  "concurrent first load: " + queries[i % queries.size()] + " gave " + got[i]);
+        }
+    }
+    // a file rewritten between column loads is refused
+    {
+        Catalog catalog;
+        catalog.addFile("t", path);
+        expectRows(catalog, "SELECT COUNT(*) FROM t WHERE score = 9", "COUNT(*);300");
+        writeFile("lazy.csv", text + "3000,late,1\n");
+        expectError(catalog, "SELECT name FROM t WHERE id = 5", "has changed since table 't' was first loaded");
+        // registering it again picks up the new contents
+        catalog.addFile("t", path);
+        expectRows(catalog, "SELECT name FROM t WHERE id = 3000", "name;late");
+    }
+    unlink(path.c_str());
+}
+
+static void testAggregates() {
+    Catalog catalog;
+    catalog.addTable("customers", customers());
+    expectRows(catalog, "SELECT status, COUNT(*), SUM(age), AVG(age), MIN(age), MAX(name) FROM customers"
+               " GROUP BY status",
+               "status,COUNT(*),SUM(age),AVG(age),MIN(age),MAX(name);"
+               "vip,2,44,22,19,Ava;regular,3,83,27.6666666666667,19,Carol");
+    expectRows(catalog, "SELECT active, COUNT(*) FROM customers WHERE age < 40 GROUP BY active",
+               "active,COUNT(*);true,3;false,1");
+    expectRows(catalog, "SELECT status, active, MIN(name) FROM customers GROUP BY status, active",
+               "status,active,MIN(name);vip,true,Alice;regular,true,Ben;regular,false,Carol;vip,false,Ava");
+    expectRows(catalog, "SELECT status, COUNT(*) FROM customers GROUP BY status ORDER BY status LIMIT 1",
+               "status,COUNT(*);regular,3");
+    // without GROUP BY there is always one row
+    expectRows(catalog, "SELECT COUNT(*), SUM(age), MIN(age), MIN(name) FROM customers WHERE age > 100",
+               "COUNT(*),SUM(age),MIN(age),MIN(name);0,0,nan,");
+    expectError(catalog, "SELECT name, COUNT(*) FROM customers GROUP BY status", "must be in GROUP BY");
+    expectError(catalog, "SELECT SUM(name) FROM customers", "SUM of a string field");
+
+    // COUNT(field), SUM and AVG use the values that are there: NaN is missing
+    SymbolTable schema;
+    schema.addField("g", FT_STRING);
+    schema.addField("x", FT_NUMBER);
+    Table t(schema);
+    const char* keys[] = {"a", "a", "b", "b", "b"};
+    const double xs[] = {1, NAN, NAN, 2, 3};
+    for (size_t r = 0; r < 5; ++r) {
+        t.column(0).appendString(keys[r]);
+        t.column(1).appendNumber(xs[r]);
+        t.finishRow();
+    }
+    catalog.addTable("sparse", std::move(t));
+    expectRows(catalog, "SELECT g, COUNT(*), COUNT(x), COUNT(g), MIN(x), SUM(x), AVG(x) FROM sparse GROUP BY g",
+               "g,COUNT(*),COUNT(x),COUNT(g),MIN(x),SUM(x),AVG(x);a,2,1,2,1,1,1;b,3,2,3,2,5,2.5");
+    expectRows(catalog, "SELECT COUNT(x) FROM sparse WHERE g = \"b\"", "COUNT(x);2");
+
+    // groups built by several threads and merged match a serial run
+    catalog.addTable("people", generated(20000));
+    const string q = "SELECT status, active, COUNT(*), COUNT(age), SUM(age), MIN(age), MAX(id) FROM people"
+                     " WHERE age > 10 GROUP BY status, active";
+    EvalOptions opts;
+    opts.threads = 4;
+    opts.morselRows = 1024;
+    opts.minParallelRows = 0;
+    string serial = run(catalog, q);
+    check(serial.find(';') != string::npos && run(catalog, q, {}, opts) == serial,
+          "parallel GROUP BY matches serial");
+}
+
+static void testOrderBy() {
+    Catalog catalog;
+    catalog.addTable("customers", customers());
+    // equal keys keep table order, in either direction
+    expectRows(catalog, "SELECT name, age FROM customers ORDER BY age",
+               "name,age;Bob,19;Ava,19;Ben,22;Alice,25;Carol,42");
+    expectRows(catalog, "SELECT name, age FROM customers ORDER BY age DESC",
+               "name,age;Carol,42;Alice,25;Ben,22;Bob,19;Ava,19");
+    // dictionary-encoded strings sort by value, not by code
+    expectRows(catalog, "SELECT name FROM customers ORDER BY status DESC",
+               "name;Alice;Ava;Ben;Bob;Carol");
+    expectRows(catalog, "SELECT name FROM customers ORDER BY name DESC LIMIT 2", "name;Carol;Bob");
+    expectRows(catalog, "SELECT name FROM customers WHERE age < 30 ORDER BY active LIMIT 3",
+               "name;Ava;Alice;Ben");
+    expectRows(catalog, "SELECT name FROM customers LIMIT 2", "name;Alice;Ben");
+    expectRows(catalog, "SELECT name FROM customers LIMIT 0", "name");
+    expectRows(catalog, "SELECT name FROM customers ORDER BY age LIMIT 10",
+               "name;Bob;Ava;Ben;Alice;Carol");
+    expectError(catalog, "SELECT name FROM customers ORDER BY height", "unknown field in ORDER BY");
+    expectError(catalog, "SELECT name FROM customers LIMIT -1", "whole number of rows after LIMIT");
+
+    // NaN is greater than every number
+    SymbolTable schema;
+    schema.addField("x", FT_NUMBER);
+    Table t(schema);
+    for (double x : {3.0, (double)NAN, -1.0, 2.0}) {
+        t.column(0).appendNumber(x);
+        t.finishRow();
+    }
+    catalog.addTable("sparse", std::move(t));
+    expectRows(catalog, "SELECT x FROM sparse ORDER BY x", "x;-1;2;3;nan");
+    expectRows(catalog, "SELECT x FROM sparse ORDER BY x DESC LIMIT 2", "x;nan;3");
+
+    // many threads, each keeping its own best rows, agree with one
+    catalog.addTable("people", generated(20000));
+    EvalOptions opts;
+    opts.threads = 4;
+    opts.morselRows = 1024;
+    opts.minParallelRows = 0;
+    for (const string q : {"SELECT id, age FROM people WHERE active = true ORDER BY age DESC LIMIT 50",
+                           "SELECT id FROM people WHERE age > 40 ORDER BY status",
+                           "SELECT id, status FROM people ORDER BY status DESC LIMIT 1000"}) {
+        string serial = run(catalog, q);
+        check(serial.find(';') != string::npos && run(catalog, q, {}, opts) == serial,
+              "parallel matches serial: " + q);
+    }
+    // LIMIT alone may stop at any n matching rows, but exactly n of them
+    const string all = run(catalog, "SELECT id FROM people WHERE age > 70") + ";";
+    string some = run(catalog, "SELECT id FROM people WHERE age > 70 LIMIT 100", {}, opts);
+    size_t rows = 0, bad = 0;
+    for (size_t at = some.find(';'); at != string::npos; at = some.find(';', at + 1)) {
+        size_t end = some.find(';', at + 1);
+        string row = some.substr(at, (end == string::npos ? some.size() : end) - at) + ";";
+        rows++;
+        if (all.find(row) == string::npos) bad++;
+    }
+    check(rows == 100 && bad == 0, "parallel LIMIT returned " + to_string(rows) + " rows, " +
+          to_string(bad) + " not matching");
+}
+
+// Keeps each batch a standing query sends, as formatRows() text.
+class CollectSink : public ResultSink {
+public:
+    bool consume(const Table& batch) override {
+        batches.push_back(formatRows(batch));
+        return true;
+    }
+    void end() override { ended = true; }
+
+    vector<string> batches;
+    bool ended = false;
+};
+
+static void testContinuous() {
+    Catalog catalog;
+    catalog.addTable("customers", customers());
+    shared_ptr<const Table> base = catalog.lookup("customers");
+    ContinuousTable live(*base);
+    SymbolTable schema = base->schema();
+    Table batch = Table::fromRows(schema, {
+        { {"name","Dan"}, {"age","30"}, {"status","gold"}, {"active","true"} },
+        { {"name","Eve"}, {"age","10"}, {"status","vip"}, {"active","false"} },
+        { {"name","Fay"}, {"age","50"}, {"status","regular"}, {"active","true"} },
+    });
+
+    auto plan = [&](const string& text) {
+        DiagnosticsCapture errors;
+        shared_ptr<PreparedQuery> q = prepareQuery(catalog, text);
+        check(q != nullptr, "prepare " + text + ": " + errors.text());
+        return q ? q->plan : CompiledQuery();
+    };
+    CollectSink filtered, limited, grouped, gold;
+    int f = live.addQuery(plan("SELECT name FROM customers WHERE age > 20"));
+    int l = live.addQuery(plan("SELECT name FROM customers WHERE age > 20 LIMIT 4"));
+    int g = live.addQuery(plan("SELECT status, COUNT(*), MAX(age) FROM customers GROUP BY status"
+                               " ORDER BY status"));
+    // "gold" is not in the dictionary yet when this one is compiled
+    int d = live.addQuery(plan("SELECT name FROM customers WHERE status = \"gold\""));
+    check(f >= 0 && l >= 0 && g >= 0 && d >= 0, "standing queries registered");
+    live.subscribe(f, filtered);
+    live.subscribe(l, limited);
+    live.subscribe(g, grouped);
+    live.subscribe(d, gold);
+
+    live.refresh();
+    live.append(batch);
+    live.append(batch);
+    check(filtered.batches == vector<string>{"name;Alice;Ben;Carol", "name;Dan;Fay", "name;Dan;Fay"},
+          "standing filter sends only new matches");
+    check(limited.batches == vector<string>{"name;Alice;Ben;Carol", "name;Dan"} && limited.ended,
+          "standing LIMIT ends after n rows");
+    string groups = grouped.batches.empty() ? "nothing" : grouped.batches.back();
+    check(grouped.batches.size() == 3 && groups == "status,COUNT(*),MAX(age);gold,2,30;regular,5,50;vip,4,25",
+          "standing GROUP BY sends the updated groups: got " + groups);
+    check(gold.batches == vector<string>{"name;Dan", "name;Dan"},
+          "standing filter on a value new to the dictionary");
+    check(live.highWater(f) == 11 && live.table().rowCount() == 11, "high-water mark follows appends");
+
+    CompiledQuery sorted = plan("SELECT name FROM customers ORDER BY age");
+    {
+        DiagnosticsCapture errors;
+        check(live.addQuery(sorted) < 0, "ORDER BY without aggregates refused");
+    }
+    live.removeQuery(f);
+    check(filtered.ended, "removing a query ends its subscribers");
+}
+
+// Answers read back over the socket: pipelined requests come back in
+// order, and a multi-line error keeps its lines.
+static void testServer() {
+    Catalog catalog;
+    catalog.addTable("customers", customers());
+    ServerOptions opts;
+    opts.workers = 2;
+    QueryServer server(catalog, opts);
+    string path = tempPath("sock");
+    check(server.listen(path), "server listens on " + path);
+    QueryClient client;
+    check(client.connect(path), "client connects");
+    // nesting deep enough to overflow a worker's stack if it were parsed
+    const string deep = "SELECT name FROM customers WHERE " + string(50000, '(') + "age = 1" +
+                        string(50000, ')');
+    const vector<string> requests = {
+        "SELECT name FROM customers WHERE age > 40",
+        "SELECT name FROM",
+        "SELECT name FROM nowhere",
+        deep,
+        "SELECT COUNT(*) FROM customers",
+    };
+    for (const string& r : requests) client.send(r);
+    vector<string> text(requests.size());
+    vector<bool> ok(requests.size());
+    for (size_t i = 0; i < requests.size(); ++i) {
+        bool answerOk = false;
+        check(client.receive(text[i], answerOk), "answer to " + requests[i].substr(0, 80));
+        ok[i] = answerOk;
+    }
+    check(ok[0] && text[0] == "name\nCarol\n", "server rows: got " + text[0]);
+    check(!ok[1] && text[1].find('\n') != string::npos && text[1].find("\n ") == string::npos &&
+          text[1].substr(text[1].rfind('\n') + 1) == "Parse failed.",
+          "multi-line server error: got " + text[1]);
+    check(!ok[2] && text[2].find("nowhere") != string::npos, "server error: got " + text[2]);
+    check(!ok[3] && text[3].find("nested more than") != string::npos,
+          "deep nesting refused: got " + text[3]);
+    check(ok[4] && text[4] == "COUNT(*)\n5\n", "server after errors: got " + text[4]);
+
+    // EXPLAIN ANALYZE reports the front end it ran, or the cache lookup
+    // that replaced it
+    const string explain = "EXPLAIN ANALYZE SELECT name FROM customers WHERE age > 20";
+    string first, again;
+    bool firstOk = false, againOk = false;
+    client.send(explain);
+    client.send(explain);
+    check(client.receive(first, firstOk) && client.receive(again, againOk), "answers to EXPLAIN ANALYZE");
+    check(firstOk && first.find("  parse ") != string::npos && first.find("  cache ") == string::npos,
+          "EXPLAIN ANALYZE on a miss: got " + first);
+    check(againOk && again.find("  cache ") != string::npos && again.find("  parse ") == string::npos,
+          "EXPLAIN ANALYZE on a hit: got " + again);
+    server.stop();
+}
+
+int main() {
+    testProjection();
+    testKernels();
+    testCsv();
+    testIndexes();
+    testDictionary();
+    testParameters();
+    testBatch();
+    testAdaptive();
+    testOptimizer();
+    testLazyLoad();
+    testAggregates();
+    testOrderBy();
+    testContinuous();
+    testServer();
+    cout << checks - failures << " of " << checks << " checks passed\n";
+    return failures ? 1 : 0;
+}
@@ -1,23 +1,22 @@
 #include <iostream>
-#include <regex>
 #include <cctype>
 #include "tokenizer.h"
 
 using namespace std;
 
-int lineNum = 1;
-string filename = "";
-string parsedId;
-string parsedLiteral;
-
-string getParsedId() { return parsedId; }
-string getParsedLiteral() { return parsedLiteral; }
-
-void print(Symbol sym) {
-    switch(sym) {
+void print(const Token& tok) {
+    switch(tok.kind) {
         case SELECTSYM: cout << "SELECT keyword"; break;
         case FROMSYM: cout << "FROM keyword"; break;
         case WHERESYM: cout << "WHERE keyword"; break;
+        case EXPLAINSYM: cout << "EXPLAIN keyword"; break;
+        case ANALYZESYM: cout << "ANALYZE keyword"; break;
+        case GROUPSYM: cout << "GROUP keyword"; break;
+        case ORDERSYM: cout << "ORDER keyword"; break;
+        case BYSYM: cout << "BY keyword"; break;
+        case ASCSYM: cout << "ASC keyword"; break;
+        case DESCSYM: cout << "DESC keyword"; break;
+        case LIMITSYM: cout << "LIMIT keyword"; break;
         case ANDSYM: cout << "AND operator"; break;
         case ORSYM: cout << "OR operator"; break;
         case EQUALS: cout << "= symbol"; break;
@@ -30,89 +29,151 @@ void print(Symbol sym) {
         case COMMA: cout << ", symbol"; break;
         case OPENPAREN: cout << "Open paren ("; break;
         case CLOSEPAREN: cout << "Close paren )"; break;
-        case ID: cout << "Identifier: " << parsedId; break;
-        case NUMBER: cout << "Number literal: " << parsedLiteral; break;
-        case STRING: cout << "String literal: " << parsedLiteral; break;
+        case ID: cout << "Identifier: " << tok.text; break;
+        case NUMBER: cout << "Number literal: " << tok.text; break;
+        case STRING: cout << "String literal: " << tok.text; break;
         case TRUE_LIT: cout << "true literal"; break;
         case FALSE_LIT: cout << "false literal"; break;
+        case PARAM: cout << "Parameter ?"; break;
         case EOL: cout << "End of line"; break;
         case ERROR: cout << "Unrecognized symbol"; break;
     }
 }
 
-void syntaxError(string msg) {
-    cerr << filename << ':' << lineNum << ' ' << msg << endl;
+static bool isIdStart(char c) {
+    return isalpha((unsigned char)c) || c == '_';
 }
 
-Symbol peekNext(string &s) {
-    int tempLineCount = lineNum;
-    string temp = s;
-    Symbol sym = getNext(temp);
-    lineNum = tempLineCount;
-    return sym;
+static bool isIdChar(char c) {
+    return isalnum((unsigned char)c) || c == '_';
 }
 
-Symbol getNext(string &s) {
-    int pos = 1;
-    Symbol retVal = ERROR;
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
 
-    while (!s.empty() && (s[0] == ' ' || s[0] == '\t' || s[0] == '\n')) {
-        if (s[0] == '\n') lineNum++;
-        s = s.substr(1);
+// Length of the number literal at `start`, which must be a digit:
+// [0-9]+(\.[0-9]+)?
+static size_t numberLength(string_view s, size_t start) {
+    size_t len = 1;
+    while (start + len < s.size() && isDigit(s[start + len])) len++;
+    if (start + len + 1 < s.size() && s[start + len] == '.' && isDigit(s[start + len + 1])) {
+        len += 2;
+        while (start + len < s.size() && isDigit(s[start + len])) len++;
     }
-    if (s.empty()) return EOL;
+    return len;
+}
 
-    smatch sm;
-    parsedId = "";
-    parsedLiteral = "";
+bool isNumberLiteral(string_view s) {
+    return !s.empty() && isDigit(s[0]) && numberLength(s, 0) == s.size();
+}
 
-    regex idExp("^[A-Za-z_][A-Za-z0-9_]*");
-    if (regex_search(s, sm, idExp)) {
-        string token = sm[0].str();
-        string upperToken = token;
-        for (auto &c : upperToken) c = toupper(c);
+// Case-insensitive match of an identifier against an upper-case keyword.
+static bool keywordIs(string_view word, const char* kw) {
+    size_t i = 0;
+    for (; kw[i]; ++i) {
+        if (i >= word.size() || toupper((unsigned char)word[i]) != kw[i]) return false;
+    }
+    return i == word.size();
+}
 
-        if (upperToken == "SELECT") retVal = SELECTSYM;
-        else if (upperToken == "FROM") retVal = FROMSYM;
-        else if (upperToken == "WHERE") retVal = WHERESYM;
-        else if (upperToken == "AND") retVal = ANDSYM;
-        else if (upperToken == "OR") retVal = ORSYM;
-        else if (upperToken == "TRUE") retVal = TRUE_LIT;
-        else if (upperToken == "FALSE") retVal = FALSE_LIT;
-        else {
-            retVal = ID;
-            parsedId = token;
-        }
-        pos = token.length();
+static Symbol classifyWord(string_view word) {
+    switch (word.size()) {
+        case 2:
+            if (keywordIs(word, "OR")) return ORSYM;
+            if (keywordIs(word, "BY")) return BYSYM;
+            break;
+        case 3:
+            if (keywordIs(word, "AND")) return ANDSYM;
+            if (keywordIs(word, "ASC")) return ASCSYM;
+            break;
+        case 4:
+            if (keywordIs(word, "FROM")) return FROMSYM;
+            if (keywordIs(word, "TRUE")) return TRUE_LIT;
+            if (keywordIs(word, "DESC")) return DESCSYM;
+            break;
+        case 5:
+            if (keywordIs(word, "WHERE")) return WHERESYM;
+            if (keywordIs(word, "FALSE")) return FALSE_LIT;
+            if (keywordIs(word, "GROUP")) return GROUPSYM;
+            if (keywordIs(word, "ORDER")) return ORDERSYM;
+            if (keywordIs(word, "LIMIT")) return LIMITSYM;
+            break;
+        case 6:
+            if (keywordIs(word, "SELECT")) return SELECTSYM;
+            break;
+        case 7:
+            if (keywordIs(word, "EXPLAIN")) return EXPLAINSYM;
+            if (keywordIs(word, "ANALYZE")) return ANALYZESYM;
+            break;
     }
+    return ID;
+}
 
-    if (s.substr(0,2) == "!=") { retVal = NOTEQUAL; pos = 2; }
-    else if (s.substr(0,2) == "<=") { retVal = LTE; pos = 2; }
-    else if (s.substr(0,2) == ">=") { retVal = GTE; pos = 2; }
-    else if (s[0] == '=') { retVal = EQUALS; pos = 1; }
-    else if (s[0] == '<') { retVal = LT; pos = 1; }
-    else if (s[0] == '>') { retVal = GT; pos = 1; }
-    else if (s[0] == '*') { retVal = STAR; pos = 1; }
-    else if (s[0] == ',') { retVal = COMMA; pos = 1; }
-    else if (s[0] == '(') { retVal = OPENPAREN; pos = 1; }
-    else if (s[0] == ')') { retVal = CLOSEPAREN; pos = 1; }
+// Scans one token starting at `pos`, skipping leading whitespace and
+// advancing `pos`, `line` and `col` past it. Returns EOL at end of input.
+static Token scanToken(string_view s, size_t &pos, int &line, int &col) {
+    while (pos < s.size() && isQuerySpace(s[pos])) {
+        if (s[pos] == '\n') { line++; col = 1; }
+        else col++;
+        pos++;
+    }
 
-    regex numExp("^[0-9]+(\\.[0-9]+)?");
-    if (retVal == ERROR && regex_search(s, sm, numExp)) {
-        parsedLiteral = sm[0].str();
-        pos = parsedLiteral.length();
-        retVal = NUMBER;
+    Token tok{ERROR, string_view(), line, col};
+    if (pos >= s.size()) {
+        tok.kind = EOL;
+        return tok;
     }
 
-    regex strExp("^\"[^\"]*\"");
-    if (retVal == ERROR && regex_search(s, sm, strExp)) {
-        parsedLiteral = sm[0].str();
-        pos = parsedLiteral.length();
-        retVal = STRING;
+    size_t start = pos;
+    char c = s[pos];
+    char n = pos + 1 < s.size() ? s[pos + 1] : '\0';
+    size_t len = 1;
+
+    if (isIdStart(c)) {
+        while (start + len < s.size() && isIdChar(s[start + len])) len++;
+        tok.kind = classifyWord(s.substr(start, len));
+    } else if (c == '!' && n == '=') { tok.kind = NOTEQUAL; len = 2; }
+    else if (c == '<' && n == '=') { tok.kind = LTE; len = 2; }
+    else if (c == '>' && n == '=') { tok.kind = GTE; len = 2; }
+    else if (c == '=') tok.kind = EQUALS;
+    else if (c == '<') tok.kind = LT;
+    else if (c == '>') tok.kind = GT;
+    else if (c == '*') tok.kind = STAR;
+    else if (c == ',') tok.kind = COMMA;
+    else if (c == '(') tok.kind = OPENPAREN;
+    else if (c == ')') tok.kind = CLOSEPAREN;
+    else if (c == '?') tok.kind = PARAM;
+    else if (isDigit(c)) {
+        len = numberLength(s, start);
+        tok.kind = NUMBER;
+    } else if (c == '"') {
+        // "[^"]*" -- an unterminated string is a one-character ERROR token
+        size_t close = s.find('"', start + 1);
+        if (close != string_view::npos) {
+            len = close - start + 1;
+            tok.kind = STRING;
+        }
     }
 
-    s = s.substr(pos);
-    return retVal;
+    tok.text = s.substr(start, len);
+    // string literals may span lines
+    for (size_t i = 0; i < len; ++i) {
+        if (tok.text[i] == '\n') { line++; col = 1; }
+        else col++;
+    }
+    pos = start + len;
+    return tok;
 }
 
-void setFilename(string s) { filename = s; }
+void tokenize(string_view src, vector<Token> &out) {
+    size_t pos = 0;
+    int line = 1, col = 1;
+    // rough guess so long queries do not regrow the buffer repeatedly
+    out.reserve(out.size() + src.size() / 4 + 1);
+    while (true) {
+        Token tok = scanToken(src, pos, line, col);
+        out.push_back(tok);
+        if (tok.kind == EOL) break;
+    }
+}
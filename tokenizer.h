@@ -1,23 +1,59 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <vector>
 
 using namespace std;
 
 enum Symbol {
     SELECTSYM, FROMSYM, WHERESYM,
+    EXPLAINSYM, ANALYZESYM,
+    GROUPSYM, ORDERSYM, BYSYM, ASCSYM, DESCSYM, LIMITSYM,
     ANDSYM, ORSYM,
     EQUALS, NOTEQUAL, LT, LTE, GT, GTE,
     STAR, COMMA,
     OPENPAREN, CLOSEPAREN,
     ID, NUMBER, STRING,
     TRUE_LIT, FALSE_LIT,
+    PARAM,
     EOL, ERROR
 };
 
-void print(Symbol sym);
-void syntaxError(string msg);
-Symbol getNext(string &s);
-Symbol peekNext(string &s);
-void setFilename(string s);
-string getParsedId();
-string getParsedLiteral();
+// One lexed token. `text` points into the source the token was lexed
+// from, so the source must outlive the token vector.
+struct Token {
+    Symbol kind;
+    string_view text;
+    int line;
+    int col;
+};
+
+// A fully lexed query with a read cursor, giving the parser O(1)
+// lookahead. The trailing EOL token is never consumed, so peek() past the
+// end keeps returning EOL.
+struct TokenStream {
+    vector<Token> toks;
+    size_t pos = 0;
+
+    Symbol peek() const { return toks[pos].kind; }
+    const Token& next() {
+        const Token& t = toks[pos];
+        if (t.kind != EOL) pos++;
+        return t;
+    }
+    // Line of the last consumed token, used when reporting errors.
+    int line() const { return pos > 0 ? toks[pos-1].line : 1; }
+};
+
+// True for the characters skipped between tokens. A CRLF line ending is
+// whitespace like LF, so text from a network peer lexes as typed.
+inline bool isQuerySpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void print(const Token& tok);
+// True if all of `s` would lex as a single NUMBER token.
+bool isNumberLiteral(string_view s);
+// Lexes all of `src` in a single pass, appending to `out` and always
+// finishing with an EOL token.
+void tokenize(string_view src, vector<Token> &out);